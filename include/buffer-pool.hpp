@@ -0,0 +1,96 @@
+#ifndef INCLUDE_BUFFER_POOL_H
+#define INCLUDE_BUFFER_POOL_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief A process-wide pool of power-of-two sized memory blocks, shared by every growable buffer.
+ *
+ * Blocks smaller than a slab are carved out of SLAB_SIZE slabs, so that small buffers cost one allocation per slab
+ * rather than one per buffer. Larger blocks are allocated individually. Released blocks are kept on a free list per
+ * size, ready for the next buffer to grow into; large ones are only kept up to MAX_CACHED_BYTES per size.
+ */
+class BufferPool {
+    public:
+        static constexpr uint32_t MIN_BLOCK_SIZE = 1024;
+        static constexpr uint32_t SLAB_SIZE = 64 * 1024;
+        static constexpr size_t MAX_CACHED_BYTES = 4 * 1024 * 1024;
+
+    private:
+        struct SizeClass {
+            std::mutex mutex;
+            std::vector<char*> free;
+            std::vector<std::unique_ptr<char[]>> slabs;
+        };
+
+        std::array<SizeClass, 32> classes;
+        std::atomic<size_t> cached_bytes;
+        std::atomic<size_t> used_bytes;
+
+        BufferPool();
+
+        /**
+         * @brief Get the size class holding blocks of `size` bytes, a power of 2.
+         */
+        SizeClass& get_class(uint32_t size) noexcept;
+
+    public:
+        BufferPool(BufferPool& p) = delete;
+        BufferPool(BufferPool&& p) = delete;
+        ~BufferPool();
+
+        static BufferPool& get();
+
+        /**
+         * @brief Round `size` up to the size of the block that would hold it.
+         *
+         * @param size
+         * @return uint32_t A power of 2, no smaller than MIN_BLOCK_SIZE.
+         */
+        static uint32_t block_size(uint32_t size) noexcept;
+
+        /**
+         * @brief Take a block from the pool, allocating one if none is free.
+         *
+         * @param size The size of the block, as returned by block_size().
+         * @return char*
+         */
+        char* acquire(uint32_t size);
+
+        /**
+         * @brief Return a block to the pool.
+         *
+         * @param block
+         * @param size The size the block was acquired with.
+         */
+        void release(char* block, uint32_t size) noexcept;
+
+        /**
+         * @brief Get the number of bytes held in blocks currently acquired by buffers.
+         *
+         * @return size_t
+         */
+        inline size_t get_used_bytes() const noexcept {
+            return used_bytes;
+        }
+
+        /**
+         * @brief Get the number of bytes held in free blocks, waiting to be reused.
+         *
+         * @return size_t
+         */
+        inline size_t get_cached_bytes() const noexcept {
+            return cached_bytes;
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
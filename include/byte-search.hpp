@@ -0,0 +1,70 @@
+#ifndef INCLUDE_BYTE_SEARCH_H
+#define INCLUDE_BYTE_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief Vectorized search for single- and multi-byte delimiters in contiguous memory.
+ *
+ * The widest instruction set the CPU supports is detected once, at start-up: AVX2, then SSE2, falling back to a portable
+ * scalar search elsewhere.
+ */
+class ByteSearch {
+    public:
+        enum class Level : uint8_t {
+            SCALAR,
+            SSE2,
+            AVX2,
+        };
+
+        /**
+         * @brief Get the widest instruction set supported by the CPU.
+         *
+         * @return Level
+         */
+        static Level get_supported_level() noexcept;
+
+        /**
+         * @brief Get the instruction set searches currently dispatch to.
+         *
+         * @return Level
+         */
+        static Level get_level() noexcept;
+
+        /**
+         * @brief Select the instruction set searches dispatch to, e.g. to compare implementations.
+         * Levels the CPU does not support are lowered to the widest one it does.
+         *
+         * @param level
+         * @return Level The level selected.
+         */
+        static Level set_level(Level level) noexcept;
+
+        /**
+         * @brief Find the first instance of `c` in `data`.
+         *
+         * @param data
+         * @param n The number of bytes to search.
+         * @param c
+         * @return const char* The position of the byte, or nullptr if not found.
+         */
+        static const char* find(const char* data, size_t n, char c) noexcept;
+
+        /**
+         * @brief Find the first instance of `needle` in `data`.
+         *
+         * @param data
+         * @param n The number of bytes to search.
+         * @param needle
+         * @param m The length of the needle. An empty needle is never found.
+         * @return const char* The position of the first byte of the needle, or nullptr if not found.
+         */
+        static const char* find(const char* data, size_t n, const char* needle, size_t m) noexcept;
+};
+
+}
+
+#endif
\ No newline at end of file
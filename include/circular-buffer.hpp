@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <cstdint>
+#include <sys/uio.h>
 #include "logger.hpp"
 
 namespace serv {
@@ -15,27 +16,112 @@ namespace serv {
  * 
  */
 class CircularBuf {
+    public:
+        static constexpr uint32_t npos = -1;
+
+        /**
+         * @brief How the buffer's memory is laid out.
+         *
+         *  - HEAP: a plain array. Reads and writes that run past the end of the array are split in two.
+         *
+         *  - MIRRORED: the same pages mapped twice, back to back, so that every readable or writable region is a single
+         * contiguous span. The capacity is rounded up to at least one page. Falls back to HEAP if the mapping fails.
+         *
+         *  - POOLED: holds no memory while empty. Grows on demand, by doubling, into blocks taken from the BufferPool,
+         * up to the capacity given; the block goes back to the pool as soon as the buffer is drained.
+         */
+        enum class Backend : uint8_t {
+            HEAP,
+            MIRRORED,
+            POOLED,
+        };
+
+        /**
+         * @brief A contiguous run of bytes inside the buffer.
+         */
+        struct Segment {
+            const char* data;
+            uint32_t size;
+        };
+
+        /**
+         * @brief A read-only view of bytes held in the buffer, in place. Bytes that wrap round the end of the underlying
+         * array span two segments; otherwise `second` is empty.
+         *
+         * A view remains valid until the bytes it covers are consumed, or the buffer is cleared.
+         */
+        struct View {
+            Segment first;
+            Segment second;
+
+            inline uint32_t size() const noexcept {
+                return first.size + second.size;
+            }
+
+            inline bool empty() const noexcept {
+                return size() == 0;
+            }
+
+            inline bool contiguous() const noexcept {
+                return second.size == 0;
+            }
+
+            /**
+             * @brief Copy the viewed bytes into `dest`, which must hold at least size() bytes.
+             *
+             * @param dest
+             */
+            void copy_to(char* dest) const noexcept;
+        };
+
     private:
         char* buf;
         uint64_t r;
         uint64_t w;
+        uint32_t held;
         uint32_t capacity;
+        uint32_t limit;
+        Backend backend;
 
         uint32_t get_capacity(uint32_t c) const noexcept;
 
+        /**
+         * @brief Allocates `buf` for the current capacity and backend.
+         */
+        void allocate();
+
+        /**
+         * @brief Frees `buf`, according to the backend it was allocated with.
+         */
+        void release() noexcept;
+
         uint32_t mask(uint64_t i) const noexcept;
 
-        bool push(char b) noexcept;
+        /**
+         * @brief Moves a pooled buffer into a larger block if it cannot hold `n` bytes. A no-op for other backends.
+         *
+         * @param n
+         */
+        void grow(uint32_t n);
+
+        /**
+         * @brief Returns a pooled buffer's block to the pool, if the buffer is empty.
+         */
+        void settle() noexcept;
 
-        bool shift(char& b) noexcept;
+        /**
+         * @brief Passes the free space in the current block to the write callback, in up to two calls.
+         */
+        uint32_t fill(uint32_t cb(char* dest, uint32_t n, void* data) noexcept, uint32_t n, void* data);
     public:
         /**
          * @brief Create a new circular buffer of size `capacity`; must be a power of 2:
          * if an invalid capacity is passed, defaults to 1024.
          * 
-         * @param capacity Must be a power of 2
+         * @param capacity Must be a power of 2. For a pooled buffer, the most it may grow to.
+         * @param backend How the memory is laid out. See Backend
          */
-        CircularBuf(uint32_t capacity=1024);
+        CircularBuf(uint32_t capacity=1024, Backend backend=Backend::HEAP);
 
         /**
          * @brief Create a new circular buffer and initialize with data.
@@ -71,6 +157,17 @@ class CircularBuf {
 
         bool empty() const noexcept;
 
+        inline Backend get_backend() const noexcept {
+            return backend;
+        }
+
+        /**
+         * @brief Get the most the buffer can hold, growing if pooled.
+         */
+        inline uint32_t get_limit() const noexcept {
+            return limit;
+        }
+
         /**
          * @brief Read the content of the buffer, optionally specifying a maximum number of bytes.
          * 
@@ -79,6 +176,95 @@ class CircularBuf {
          */
         std::vector<char> read(uint32_t lim=-1) noexcept;
 
+        /**
+         * @brief Copy up to `n` bytes from the buffer without consuming them.
+         * 
+         * @param dest Where to copy the bytes to.
+         * @param n The maximum number of bytes to copy.
+         * @param offset The number of bytes to skip from the front of the buffer.
+         * @return uint32_t The number of bytes copied.
+         */
+        uint32_t peek(char* dest, uint32_t n, uint32_t offset=0) const noexcept;
+
+        /**
+         * @brief View up to `n` bytes of the buffer in place, without copying or consuming them.
+         *
+         * @param n The maximum number of bytes to view.
+         * @param offset The number of bytes to skip from the front of the buffer.
+         * @return View
+         */
+        View view(uint32_t n=-1, uint32_t offset=0) const noexcept;
+
+        /**
+         * @brief Like view(), but the bytes may be modified in place, e.g. to decrypt them.
+         *
+         * @param n The maximum number of bytes to view.
+         * @param offset The number of bytes to skip from the front of the buffer.
+         * @param iov Set to the one or two segments viewed.
+         * @return int The number of segments set; 0 if there are no bytes at `offset`.
+         */
+        int span(uint32_t n, uint32_t offset, iovec iov[2]) noexcept;
+
+        /**
+         * @brief Moves `n` bytes back to an earlier position in the buffer, e.g. to close a gap left by bytes stripped from
+         * between them. Both positions are relative to the front of the buffer.
+         *
+         * @param from Where the bytes are.
+         * @param to Where to move them to; no later than `from`.
+         * @param n
+         */
+        void shift(uint32_t from, uint32_t to, uint32_t n) noexcept;
+
+        /**
+         * @brief Drops every byte past the first `n`, moving the write pointer back, along with any held bytes.
+         *
+         * @param n
+         */
+        void truncate(uint32_t n) noexcept;
+
+        /**
+         * @brief Holds the last `n` bytes back, e.g. the start of a record still on its way: no read or search finds them,
+         * but they stay where they are, taking up space, until unhold(). Bytes already held stay held after them.
+         *
+         * @param n
+         */
+        void hold(uint32_t n) noexcept;
+
+        /**
+         * @brief Puts the held bytes back at the end of the buffer. Every write does so first, so that it lands after them.
+         */
+        void unhold() noexcept;
+
+        inline uint32_t get_held() const noexcept {
+            return held;
+        }
+
+        /**
+         * @brief Find the first instance of the delimiter, searching from `offset`.
+         *
+         * @param delim
+         * @param offset The number of bytes to skip from the front of the buffer.
+         * @return uint32_t The position of the delimiter relative to the front of the buffer, or npos if not found.
+         */
+        uint32_t find(char delim, uint32_t offset=0) const noexcept;
+
+        /**
+         * @brief Find the first instance of the multi-byte delimiter, searching from `offset`.
+         *
+         * @param delim
+         * @param offset The number of bytes to skip from the front of the buffer.
+         * @return uint32_t The position of the delimiter relative to the front of the buffer, or npos if not found.
+         */
+        uint32_t find(const std::string& delim, uint32_t offset=0) const noexcept;
+
+        /**
+         * @brief Release up to `n` bytes from the front of the buffer, e.g. once a view of them has been processed.
+         *
+         * @param n
+         * @return uint32_t The number of bytes released.
+         */
+        uint32_t consume(uint32_t n) noexcept;
+
         /**
          * @brief Read up to the first instance of the single-byte delimiter.
          * 
@@ -107,6 +293,15 @@ class CircularBuf {
          */
         std::vector<char> read_from(uint32_t offset);
 
+        /**
+         * @brief Write data to the buffer.
+         * 
+         * @param data 
+         * @param n The number of bytes to write.
+         * @return uint32_t 
+         */
+        uint32_t write(const char* data, uint32_t n);
+
         /**
          * @brief Write data to the buffer.
          * 
@@ -162,6 +357,18 @@ class CircularBuf {
          */
         uint32_t write(uint32_t cb(char* dest, uint32_t n, void* data) noexcept, uint32_t n, void* data=nullptr);
 
+        /**
+         * @brief Like write(cb, n, data), but passes every free segment to the callback at once, so that a procedure
+         * such as readv() or recvmsg() can fill the space either side of the wrap point in a single call.
+         * 
+         * @param cb (iovec* iov, int iovcnt, void* data) The write-procedure, given one or two segments of at most `n`
+         * bytes in total. Returns the number of bytes written.
+         * @param n The number of bytes to write.
+         * @param data Optional dependency injection passed through to the callback.
+         * @return uint32_t 
+         */
+        uint32_t write_vectored(uint32_t cb(iovec* iov, int iovcnt, void* data) noexcept, uint32_t n, void* data=nullptr);
+
         void clear();
 };
 
@@ -0,0 +1,83 @@
+#ifndef INCLUDE_COMPLETION_QUEUE_H
+#define INCLUDE_COMPLETION_QUEUE_H
+
+#include <event-base.hpp>
+#include <event.hpp>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "task.hpp"
+
+using namespace libev;
+
+namespace serv {
+
+/**
+ * @brief Carries work from pool threads back to the thread running an event base.
+ *
+ * Workers post tasks (finished responses, event modifications) from any thread; an eventfd registered on the base wakes
+ * the loop, which then runs everything posted so far in one batch. This keeps socket and libevent operations on the
+ * loop thread without workers ever blocking on them.
+ */
+class CompletionQueue {
+    private:
+        EventBase* base;
+        evutil_socket_t efd;
+        std::unique_ptr<Event> event;
+        std::mutex queue_mutex;
+        std::vector<Task> queue;
+        std::vector<Task> batch;
+        std::atomic<bool> signalled;
+        std::atomic<std::thread::id> loop_thread;
+        static event_callback_fn wake_callback;
+
+        /**
+         * @brief Runs every task posted so far, on the loop thread.
+         */
+        void flush();
+
+    public:
+        CompletionQueue(EventBase* base);
+        CompletionQueue(CompletionQueue& c) = delete;
+        CompletionQueue(CompletionQueue&& c) = delete;
+        ~CompletionQueue();
+
+        /**
+         * @brief Records the calling thread as the one running the event base loop.
+         */
+        void set_loop_thread() noexcept;
+
+        /**
+         * @brief Whether the calling thread is the one running the event base loop.
+         */
+        bool in_loop_thread() const noexcept;
+
+        /**
+         * @brief Queue a task to run on the loop thread, waking the loop if it has not already been signalled.
+         *
+         * @param task
+         */
+        void post(Task&& task);
+
+        /**
+         * @brief Runs the function straight away if called on the loop thread, otherwise posts it.
+         *
+         * @tparam F The function type
+         * @param f The function
+         */
+        template <typename F>
+        void dispatch(F&& f) {
+            if (in_loop_thread()) {
+                f();
+                return;
+            }
+
+            post(Task(std::forward<F>(f)));
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,190 @@
+#ifndef INCLUDE_CONNECTION_TABLE_H
+#define INCLUDE_CONNECTION_TABLE_H
+
+#include <event.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace serv {
+
+class Server;
+class Reactor;
+class Context;
+class SecureSocket;
+
+/**
+ * @brief A reactor's accepted connections, indexed directly by file descriptor.
+ *
+ * Contexts are constructed in place in fixed-size slots, carved SLAB_SLOTS at a time from slabs that are never freed, so
+ * that accepting a connection costs no allocation once the table has warmed up. Each fd carries a generation, bumped
+ * whenever its connection is removed, so that a Handle to a closed connection stays invalid even after the kernel reuses
+ * its fd for a new one.
+ *
+ * Removing a connection only retires its context: it is closed and unlinked straight away, but its slot is reclaimed later,
+ * once no pool thread can still be running its work. See reclaim() and Epoch.
+ *
+ * Not thread-safe: the table belongs to its reactor's loop thread.
+ */
+class ConnectionTable {
+    public:
+        static constexpr uint32_t SLAB_SLOTS = 64;
+
+        /**
+         * @brief Identifies one connection for the lifetime of the table, not just for the lifetime of its fd.
+         */
+        struct Handle {
+            evutil_socket_t fd = -1;
+            uint32_t generation = 0;
+        };
+
+    private:
+        struct Slot;
+
+        struct Entry {
+            Slot* slot = nullptr;
+            uint32_t generation = 0;
+        };
+
+        struct Retired {
+            Slot* slot;
+            uint64_t epoch;
+            bool idle;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<Retired> retired;
+        std::vector<std::unique_ptr<Slot[]>> slabs;
+        std::vector<Slot*> free_slots;
+        size_t count;
+
+        /**
+         * @brief Get the entry for `fd`, or nullptr if `fd` is out of range.
+         */
+        Entry* find(evutil_socket_t fd) noexcept;
+        const Entry* find(evutil_socket_t fd) const noexcept;
+
+        /**
+         * @brief Take a free slot, carving a new slab if none are left.
+         */
+        Slot* acquire();
+
+        /**
+         * @brief Unlink the context held in the entry, close it, and queue its slot for reclamation.
+         */
+        void retire(Entry& entry) noexcept;
+
+        /**
+         * @brief Destroy the context held in the slot and return the slot to the free list.
+         */
+        void release(Slot* slot) noexcept;
+
+    public:
+        ConnectionTable();
+        ConnectionTable(ConnectionTable& t) = delete;
+        ConnectionTable(ConnectionTable&& t) = delete;
+        ~ConnectionTable();
+
+        /**
+         * @brief Construct a context for an accepted socket in the slot for its fd. A context still occupying that fd belongs
+         * to a connection the kernel has since closed, so it is retired first.
+         *
+         * @param server See Context::Context()
+         * @param sock The accepted socket.
+         * @param reactor See Context::Context()
+         * @return Handle A handle to the new context, or an invalid handle if the socket has no fd.
+         */
+        Handle emplace(Server* server, SecureSocket&& sock, Reactor* reactor);
+
+        /**
+         * @brief Get the context a handle refers to.
+         *
+         * @param handle
+         * @return Context* The context, or nullptr if the connection has since been removed.
+         */
+        Context* get(Handle handle) const noexcept;
+
+        /**
+         * @brief Get the context currently occupying `fd`.
+         *
+         * @param fd
+         * @return Context* The context, or nullptr if there is none.
+         */
+        Context* get(evutil_socket_t fd) const noexcept;
+
+        /**
+         * @brief Remove the context a handle refers to, if it is still in the table, retiring it until it can be reclaimed.
+         *
+         * @param handle
+         * @return bool Whether a context was removed.
+         */
+        bool erase(Handle handle) noexcept;
+
+        /**
+         * @brief Remove the context currently occupying `fd`, if any, retiring it until it can be reclaimed.
+         *
+         * @param fd
+         * @return bool Whether a context was removed.
+         */
+        bool erase(evutil_socket_t fd) noexcept;
+
+        /**
+         * @brief Destroy retired contexts that no thread can still reference: those whose work has finished, once every
+         * thread pinned at the time has since unpinned. Never blocks.
+         *
+         * @return size_t The number of contexts still waiting to be reclaimed.
+         */
+        size_t reclaim() noexcept;
+
+        /**
+         * @brief Destroy every context, live or retired, blocking until the work of each has finished. For shutdown, once
+         * no new work can be dispatched.
+         */
+        void clear() noexcept;
+
+        /**
+         * @brief Call `f` with every context in the table, in fd order.
+         *
+         * @tparam F A callable taking Context&
+         * @param f
+         */
+        template <typename F>
+        void for_each(F&& f) {
+            for (auto& entry : entries) {
+                if (entry.slot != nullptr) {
+                    f(*get({ static_cast<evutil_socket_t>(&entry - entries.data()), entry.generation }));
+                }
+            }
+        }
+
+        /**
+         * @brief Get the number of contexts in the table.
+         *
+         * @return size_t
+         */
+        inline size_t size() const noexcept {
+            return count;
+        }
+
+        /**
+         * @brief Get the number of retired contexts waiting to be reclaimed.
+         *
+         * @return size_t
+         */
+        inline size_t get_retired_count() const noexcept {
+            return retired.size();
+        }
+
+        /**
+         * @brief Get the number of slots allocated, occupied or free.
+         *
+         * @return size_t
+         */
+        inline size_t capacity() const noexcept {
+            return slabs.size() * SLAB_SLOTS;
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
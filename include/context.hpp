@@ -1,12 +1,17 @@
 #ifndef INCLUDE_CONTEXT_H
 #define INCLUDE_CONTEXT_H
 
+#include <event-base.hpp>
 #include <event.hpp>
 #include <crypt/exchange.hpp>
 #include <string>
-#include <thread>
 #include <memory>
+#include <optional>
 #include "secure-socket.hpp"
+#include "connection-table.hpp"
+#include "reactor.hpp"
+#include "thread-pool.hpp"
+#include "completion-queue.hpp"
 #include "header.pb.h"
 
 using namespace libev;
@@ -18,23 +23,38 @@ class Server;
 
 /**
  * @brief Encapsulates the state of an accepted connection, managing data reading and writing over arbitrarily many send & receive operations.
+ *
+ * Socket I/O and event changes happen on the loop thread of the reactor that accepted the connection. Parsing and
+ * request handling run on the context's strand; anything they send is handed back to the loop via its CompletionQueue.
+ * The CPU-bound half of the handshake, deriving the key, runs on the strand too, between reading the peer's reply and
+ * confirming the handshake on the loop.
+ * A resumed session's early data is parsed on the strand as soon as the handshake completes; only requests to idempotent
+ * endpoints are served from it.
+ * Contexts are held in place by their reactor's ConnectionTable, socket and events included.
  */
 class Context {
     private:
         Server* server;
-        std::shared_ptr<SecureSocket> sock;
-        std::shared_ptr<Event> event;
-        std::shared_ptr<std::thread> thread;
+        Reactor* reactor;
+        EventBase* base;
+        CompletionQueue* completions;
+        ConnectionTable::Handle handle;
+        SecureSocket sock;
+        std::optional<Event> event;
+        std::optional<Event> write_event;
+        Strand strand;
         std::string header_data;
         std::string request_data;
         proto::Header header;
         static event_callback_fn receive_callback;
         static event_callback_fn handshake_callback;
+        static event_callback_fn write_callback;
         bool header_parsed = false;
+        bool early = false;
         int fd = 0;
 
         /**
-         * @brief Adds a new event to the server event base for this socket, passing itself as the arg.
+         * @brief Adds a new event to the event base this context was accepted on, passing itself as the arg.
          * 
          * @param what The kind of event to trigger on, e.g. EV_READ, EV_WRITE. See libevent
          * @param cb The callback to execute when the even triggers.
@@ -56,7 +76,42 @@ class Context {
         }
 
         /**
-         * @brief If a header has been parsed the complete request data received, processes the request
+         * @brief Whether handshake key derivation is left to the pool, per Server::get_handshake_offload(). Only contexts
+         * with a reactor to hand the result back to can offload it.
+         */
+        bool offloads_handshake() const noexcept;
+
+        /**
+         * @brief Finishes a handshake once its key derivation is done, then starts watching for requests; if anything
+         * failed, starts the handshake over instead. Loop thread only.
+         * 
+         * @param derived Whether the key was derived.
+         */
+        void complete_handshake(bool derived);
+
+        /**
+         * @brief Takes the messages out of a resumed session's early data, then parses them on the strand, before anything
+         * the peer sends after the handshake. Loop thread only.
+         */
+        void read_early_data();
+
+        /**
+         * @brief If the socket has data queued that it could not yet write, arms a one-shot write event to flush it with
+         * Context::write_callback once the socket is writable.
+         */
+        void watch_writable();
+
+        /**
+         * @brief Sends or queues data on the socket, watching for writability if any of it is left pending. Loop thread only.
+         * 
+         * @param data The data to send
+         * @return bool False if the data could not be sent or queued.
+         */
+        bool send(const std::string& data);
+
+        /**
+         * @brief If a header has been parsed the complete request data received, processes the request. Requests from early
+         * data are refused unless their endpoint is idempotent.
          */
         void handle_request();
 
@@ -65,8 +120,61 @@ class Context {
          */
         void reset();
 
+        /**
+         * @brief Deals with the non-positive results of SecureSocket::try_recv.
+         * 
+         * @param nbytes The number of bytes received.
+         * @return bool Whether there is new data in the buffer to parse.
+         */
+        bool handle_recv(int32_t nbytes);
+
+        /**
+         * @brief Parses every complete header and request in the socket buffer, handling each in turn.
+         * 
+         * @param can_write Whether the buffer had space left after the last receive.
+         */
+        void parse_buffer(bool can_write);
+
+        /**
+         * @brief Parses one message as the next header or request, handling the request once both have arrived.
+         * 
+         * @param data The message.
+         */
+        void parse_message(std::string&& data);
+
+        /**
+         * @brief Runs `f` on the loop thread: straight away if already there (or if there is no loop), otherwise via the
+         * reactor's CompletionQueue. Posted work is dropped if the context has been closed by the time the loop runs it.
+         * 
+         * @tparam F The function type
+         * @param f The function
+         */
+        template <typename F>
+        void on_loop(F&& f) {
+            if (completions == nullptr || completions->in_loop_thread()) {
+                f();
+                return;
+            }
+
+            completions->post([reactor = reactor, handle = handle, f = std::forward<F>(f)] () mutable {
+                if (reactor->get_connection(handle) != nullptr) {
+                    f();
+                }
+            });
+        }
+
     public:
-        Context(Server* server, SecureSocket&& sock);
+        /**
+         * @brief Create a context for an accepted connection.
+         * 
+         * @param server The server the connection was accepted by.
+         * @param sock The accepted socket.
+         * @param reactor The reactor that accepted the connection. Defaults to the server's first event base, with sends made inline.
+         * @param handle The context's handle in the reactor's ConnectionTable, used to drop work posted after it is closed.
+         */
+        Context(Server* server, SecureSocket&& sock, Reactor* reactor = nullptr, ConnectionTable::Handle handle = {});
+        Context(Context& c) = delete;
+        Context(Context&& c) = delete;
         ~Context();
 
         /**
@@ -75,9 +183,11 @@ class Context {
         void read_sock();
 
         /**
-         * @brief Sends data to the client via the open sock stream.
+         * @brief Sends data to the client via the open sock stream. Called off the loop thread, the send is queued for the loop
+         * and any failure is reported to the peer with do_error() once it is attempted.
          * 
          * @param data Data to send to the client
+         * @return bool Whether the data was sent, or queued to be sent.
          */
         bool send_message(const std::string& data);
 
@@ -88,6 +198,14 @@ class Context {
          */
         void do_error(int err_code);
 
+        /**
+         * @brief Whether handlers should stop producing messages for this connection until its peer catches up.
+         * See Socket::is_congested()
+         */
+        inline bool is_congested() {
+            return sock.is_congested();
+        }
+
         inline const std::string get_header_data() const noexcept {
             return header_data;
         }
@@ -96,7 +214,41 @@ class Context {
             return request_data;
         }
 
+        /**
+         * @brief Get the reactor that accepted the connection, if any.
+         * 
+         * @return Reactor* 
+         */
+        inline Reactor* get_reactor() const noexcept {
+            return reactor;
+        }
+
+        /**
+         * @brief Get the context's handle in its reactor's ConnectionTable.
+         * 
+         * @return ConnectionTable::Handle 
+         */
+        inline ConnectionTable::Handle get_handle() const noexcept {
+            return handle;
+        }
+
+        /**
+         * @brief Blocks until all work dispatched for this context has finished executing.
+         */
         void join() noexcept;
+
+        /**
+         * @brief Whether all work dispatched for this context has finished executing, without blocking.
+         */
+        inline bool is_idle() noexcept {
+            return strand.is_idle();
+        }
+
+        /**
+         * @brief Stops watching the socket and closes it, ahead of the context being reclaimed. Loop thread only.
+         * Work already dispatched still runs, but anything it sends back to the loop is dropped.
+         */
+        void close() noexcept;
 };
 
 };
@@ -0,0 +1,58 @@
+#ifndef INCLUDE_EPOCH_H
+#define INCLUDE_EPOCH_H
+
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief Process-wide epoch-based reclamation, for freeing objects that other threads may still be referencing.
+ *
+ * Threads pin the current epoch for as long as they may touch shared objects. An object is retired by recording the epoch
+ * once it has become unreachable; it is safe to free once has_passed() returns true for that epoch, by which point every
+ * thread that was pinned when it was retired has since unpinned. Pinning and unpinning are lock-free; a mutex is only taken
+ * the first time each thread pins.
+ */
+class Epoch {
+    public:
+        /**
+         * @brief Keeps the calling thread pinned for as long as it is alive. Guards may be nested.
+         */
+        class Guard {
+            private:
+                bool pinned;
+
+            public:
+                Guard() noexcept;
+                Guard(Guard& g) = delete;
+                Guard(Guard&& g) noexcept;
+                ~Guard();
+        };
+
+        /**
+         * @brief Pin the calling thread to the current epoch.
+         *
+         * @return Guard Unpins the thread when destroyed.
+         */
+        static Guard pin() noexcept;
+
+        /**
+         * @brief Get the current epoch, to record against an object that has just become unreachable.
+         *
+         * @return uint64_t
+         */
+        static uint64_t current() noexcept;
+
+        /**
+         * @brief Check whether every thread that could have been pinned at `epoch` has since unpinned, first trying to advance
+         * the global epoch if no thread is still pinned to an older one.
+         *
+         * @param epoch An epoch returned by current().
+         * @return bool Whether objects retired at `epoch` may now be freed.
+         */
+        static bool has_passed(uint64_t epoch) noexcept;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -34,6 +34,7 @@ constexpr int ERR_SOCKET_BUFFER_FULL = 11009;
 constexpr int ERR_SOCKET_RECV_FAILED = 11010;
 constexpr int ERR_SOCKET_INVALID_SEND_ATTEMPT = 11011;
 constexpr int ERR_SOCKET_SEND_FAILED = 11012;
+constexpr int ERR_SOCKET_MALFORMED_FRAME = 11013;
 
 // SecureSocket
 constexpr int ERR_SECURE_SOCKET_HANDSHAKE_INIT_FAILED = 12001;
@@ -56,6 +57,7 @@ constexpr int ERR_CONTEXT_HANDLE_READ_FAILED = 13003;
 constexpr int ERR_CONTEXT_DO_ERROR_FAILED = 13004;
 constexpr int ERR_CONTEXT_PING_FAILED = 13005;
 constexpr int ERR_CONTEXT_SEND_MESSAGE_FAILED = 13006;
+constexpr int ERR_CONTEXT_EARLY_DATA_REJECTED = 13007;
 
 // Server
 constexpr int ERR_SERVER_ACCEPT_CONN_FAILED = 14001;
@@ -63,6 +65,14 @@ constexpr int ERR_SERVER_ACCEPT_CONN_FAILED = 14001;
 // ThreadPool
 constexpr int ERR_THREAD_POOL_THREAD_LOOP_ERROR = 15001;
 constexpr int ERR_THREAD_POOL_DESTROY_POOL_ERROR = 15002;
+constexpr int ERR_THREAD_POOL_STRAND_TASK_ERROR = 15003;
+
+// CompletionQueue
+constexpr int ERR_COMPLETION_QUEUE_EVENTFD_FAILED = 16001;
+constexpr int ERR_COMPLETION_QUEUE_TASK_ERROR = 16002;
+
+// CircularBuf
+constexpr int ERR_CIRCULAR_BUFFER_MIRROR_FAILED = 17001;
 
 static std::unordered_map<int, std::string> error_messages = {
     // General
@@ -81,6 +91,7 @@ static std::unordered_map<int, std::string> error_messages = {
     { ERR_SOCKET_RECV_FAILED, "Socket: failed to receive incoming data." },
     { ERR_SOCKET_INVALID_SEND_ATTEMPT, "Socket: attempted to send on a closed or listening socket." },
     { ERR_SOCKET_SEND_FAILED, "Socket: failed to send data." },
+    { ERR_SOCKET_MALFORMED_FRAME, "Socket: received a malformed length prefix." },
 
     // SecureSocket
     { ERR_SECURE_SOCKET_HANDSHAKE_INIT_FAILED, "SecureSocket: failed to initialize handshake." },
@@ -103,6 +114,7 @@ static std::unordered_map<int, std::string> error_messages = {
     { ERR_CONTEXT_DO_ERROR_FAILED, "Context: failed to send error response to peer" },
     { ERR_CONTEXT_PING_FAILED, "Context: failed to send ping response to peer" },
     { ERR_CONTEXT_SEND_MESSAGE_FAILED, "Context: failed to send message to peer" },
+    { ERR_CONTEXT_EARLY_DATA_REJECTED, "Context: request to a path that is not idempotent sent as early data" },
 
     // Server
     { ERR_SERVER_ACCEPT_CONN_FAILED, "Server: failed to accept incoming connection" },
@@ -110,6 +122,14 @@ static std::unordered_map<int, std::string> error_messages = {
     // ThreadPool
     { ERR_THREAD_POOL_THREAD_LOOP_ERROR, "ThreadPool: error occurred in task loop" },
     { ERR_THREAD_POOL_DESTROY_POOL_ERROR, "ThreadPool: error occurred destroying pool" },
+    { ERR_THREAD_POOL_STRAND_TASK_ERROR, "ThreadPool: error occurred in strand task" },
+
+    // CompletionQueue
+    { ERR_COMPLETION_QUEUE_EVENTFD_FAILED, "CompletionQueue: failed to create or signal eventfd" },
+    { ERR_COMPLETION_QUEUE_TASK_ERROR, "CompletionQueue: error occurred in completion task" },
+
+    // CircularBuf
+    { ERR_CIRCULAR_BUFFER_MIRROR_FAILED, "CircularBuf: failed to map mirrored memory, falling back to the heap" },
 };
 
 #endif
\ No newline at end of file
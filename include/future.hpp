@@ -0,0 +1,331 @@
+#ifndef INCLUDE_FUTURE_H
+#define INCLUDE_FUTURE_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include "task.hpp"
+
+namespace serv {
+
+class ThreadPool;
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace detail {
+
+/**
+ * @brief Hands continuations over to the pool in one batch. Runs them inline if there is no pool.
+ */
+void schedule(ThreadPool* pool, std::vector<Task>& tasks);
+
+template <typename T>
+using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template <typename T>
+struct FutureState {
+    ThreadPool* pool;
+    std::mutex mutex;
+    std::condition_variable ready_condition;
+    bool ready = false;
+    std::optional<Stored<T>> value;
+    std::exception_ptr error;
+
+    /** Scheduled onto the pool once the result is set. */
+    std::vector<Task> continuations;
+
+    /** Run inline by whichever thread sets the result; must not block. */
+    std::vector<Task> callbacks;
+
+    FutureState(ThreadPool* pool): pool { pool } {}
+
+    template <typename... V>
+    void set(std::exception_ptr e, V&& ...v) {
+        std::vector<Task> scheduled;
+        std::vector<Task> inline_callbacks;
+
+        {
+            std::lock_guard lock { mutex };
+
+            if (ready) {
+                return;
+            }
+
+            if (e) {
+                error = e;
+            }
+            else {
+                value.emplace(std::forward<V>(v)...);
+            }
+
+            ready = true;
+            scheduled.swap(continuations);
+            inline_callbacks.swap(callbacks);
+        }
+
+        ready_condition.notify_all();
+
+        for (auto& cb : inline_callbacks) {
+            cb();
+        }
+
+        schedule(pool, scheduled);
+    }
+
+    /**
+     * @brief Registers work to run once the result is set; if it already is, the work is dispatched straight away.
+     */
+    void on_ready(Task&& task, bool run_inline) {
+        {
+            std::lock_guard lock { mutex };
+
+            if (!ready) {
+                (run_inline ? callbacks : continuations).emplace_back(std::move(task));
+                return;
+            }
+        }
+
+        if (run_inline) {
+            task();
+            return;
+        }
+
+        std::vector<Task> tasks;
+        tasks.emplace_back(std::move(task));
+        schedule(pool, tasks);
+    }
+};
+
+template <typename F, typename T>
+struct ContinuationResult {
+    using type = std::invoke_result_t<F, T>;
+};
+
+template <typename F>
+struct ContinuationResult<F, void> {
+    using type = std::invoke_result_t<F>;
+};
+
+}
+
+/**
+ * @brief The write end of a Future.
+ */
+template <typename T>
+class Promise {
+    private:
+        std::shared_ptr<detail::FutureState<T>> state;
+
+    public:
+        Promise(ThreadPool* pool = nullptr):
+            state { std::make_shared<detail::FutureState<T>>(pool) }
+        {}
+
+        Future<T> get_future() const {
+            return Future<T> { state };
+        }
+
+        template <typename... V>
+        void set_value(V&& ...v) const {
+            state->set(nullptr, std::forward<V>(v)...);
+        }
+
+        void set_exception(std::exception_ptr e) const {
+            state->set(e);
+        }
+
+        /**
+         * @brief Fails the promise with a std::future_error holding std::future_errc::broken_promise, for when the work that
+         * was to fulfill it is dropped.
+         */
+        void abandon() const {
+            set_exception(std::make_exception_ptr(std::future_error { std::future_errc::broken_promise }));
+        }
+
+        /**
+         * @brief Invokes `f` with `args` and fulfills the promise with the result, or with any exception thrown.
+         */
+        template <typename F, typename... Args>
+        void fulfill(F&& f, Args&& ...args) const {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+                    set_value();
+                }
+                else {
+                    set_value(std::invoke(std::forward<F>(f), std::forward<Args>(args)...));
+                }
+            }
+            catch (...) {
+                set_exception(std::current_exception());
+            }
+        }
+};
+
+/**
+ * @brief A lightweight handle to the result of work submitted to a ThreadPool.
+ *
+ * Continuations attached with then() or when_all() are scheduled onto the pool once the result is ready, so that joining
+ * on parallel work never parks a pool thread. The result is consumed by exactly one of get(), then() or when_all().
+ */
+template <typename T>
+class Future {
+    private:
+        std::shared_ptr<detail::FutureState<T>> state;
+
+        template <typename U>
+        friend class Promise;
+
+        template <typename U>
+        friend class Future;
+
+        template <typename U>
+        friend Future<std::conditional_t<std::is_void_v<U>, void, std::vector<U>>> when_all(std::vector<Future<U>> futures);
+
+        Future(std::shared_ptr<detail::FutureState<T>> state): state { std::move(state) } {}
+
+    public:
+        Future() = default;
+
+        bool valid() const noexcept {
+            return state != nullptr;
+        }
+
+        bool is_ready() const {
+            std::lock_guard lock { state->mutex };
+            return state->ready;
+        }
+
+        /**
+         * @brief Blocks until the result is ready, then returns it, rethrowing any exception the work threw.
+         * Prefer then() from within pool threads.
+         */
+        T get() {
+            std::unique_lock lock { state->mutex };
+
+            state->ready_condition.wait(lock, [this] () {
+                return state->ready;
+            });
+
+            if (state->error) {
+                std::rethrow_exception(state->error);
+            }
+
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(*state->value);
+            }
+        }
+
+        /**
+         * @brief Schedules `f` onto the pool once the result is ready, passing it the result (if any).
+         * If this future holds an exception, `f` is skipped and the exception is passed on to the returned future.
+         *
+         * @tparam F
+         * @param f
+         * @return Future of the result of `f`.
+         */
+        template <typename F>
+        auto then(F&& f) -> Future<typename detail::ContinuationResult<std::decay_t<F>, T>::type> {
+            using R = typename detail::ContinuationResult<std::decay_t<F>, T>::type;
+
+            Promise<R> next { state->pool };
+            auto future = next.get_future();
+
+            state->on_ready([state = state, next, f = std::forward<F>(f)] () mutable {
+                if (state->error) {
+                    next.set_exception(state->error);
+                }
+                else if constexpr (std::is_void_v<T>) {
+                    next.fulfill(std::move(f));
+                }
+                else {
+                    next.fulfill(std::move(f), std::move(*state->value));
+                }
+            }, false);
+
+            return future;
+        }
+};
+
+/**
+ * @brief Combines futures into one that is ready once all of them are, holding their results in order.
+ * If any of them fails, the combined future holds the first exception.
+ *
+ * @tparam T
+ * @param futures
+ * @return Future<std::vector<T>>, or Future<void> for void futures.
+ */
+template <typename T>
+Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all(std::vector<Future<T>> futures) {
+    using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+    struct Join {
+        Promise<R> promise;
+        std::atomic<size_t> remaining;
+        std::vector<std::shared_ptr<detail::FutureState<T>>> states;
+
+        Join(ThreadPool* pool, size_t n): promise { pool }, remaining { n } {}
+    };
+
+    auto pool = futures.empty() ? nullptr : futures.front().state->pool;
+    auto join = std::make_shared<Join>(pool, futures.size());
+    auto future = join->promise.get_future();
+
+    if (futures.empty()) {
+        join->promise.set_value();
+        return future;
+    }
+
+    for (auto& f : futures) {
+        join->states.emplace_back(f.state);
+    }
+
+    for (auto& state : join->states) {
+        // Cheap bookkeeping only: the combined future's own continuations are what get scheduled onto the pool.
+        state->on_ready([join] () {
+            if (--join->remaining) {
+                return;
+            }
+
+            for (auto& s : join->states) {
+                if (s->error) {
+                    join->promise.set_exception(s->error);
+                    return;
+                }
+            }
+
+            if constexpr (std::is_void_v<T>) {
+                join->promise.set_value();
+            }
+            else {
+                std::vector<T> values;
+                values.reserve(join->states.size());
+
+                for (auto& s : join->states) {
+                    values.emplace_back(std::move(*s->value));
+                }
+
+                join->promise.set_value(std::move(values));
+            }
+        }, true);
+    }
+
+    return future;
+}
+
+}
+
+#endif
\ No newline at end of file
@@ -17,14 +17,22 @@ class Handler {
         Server* s;
         std::string path;
         HandlerFunc cb;
+        bool idempotent;
 
     public:
-        Handler(Server* s, std::string path, HandlerFunc cb);
+        Handler(Server* s, std::string path, HandlerFunc cb, bool idempotent = false);
         Handler(Handler& h) = default;
         Handler(Handler&& h) = default;
         ~Handler() = default;
 
         void exec(Context* c) const;
+
+        /**
+         * @brief Whether a request to this handler is safe to repeat, and so may be served from early data.
+         */
+        inline bool is_idempotent() const noexcept {
+            return idempotent;
+        }
 };  
 
 }
@@ -0,0 +1,74 @@
+#ifndef INCLUDE_KEY_EXCHANGE_H
+#define INCLUDE_KEY_EXCHANGE_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief The groups a handshake can agree a key over.
+ *
+ *  - FFDHE2048: finite-field Diffie-Hellman over the RFC 7919 2048-bit group. Understood by every peer; public keys are
+ *  DER-encoded and several hundred bytes long.
+ *
+ *  - X25519: elliptic-curve Diffie-Hellman over Curve25519. Much cheaper to generate and derive, with 32-byte public keys.
+ */
+enum class KeyGroup : uint32_t {
+    FFDHE2048 = 0,
+    X25519 = 1,
+};
+
+/**
+ * @brief Get the bit representing `group` in a bitmask of groups.
+ */
+constexpr uint32_t key_group_bit(KeyGroup group) {
+    return static_cast<uint32_t>(group) < 32 ? 1u << static_cast<uint32_t>(group) : 0;
+}
+
+constexpr uint32_t ALL_KEY_GROUPS = key_group_bit(KeyGroup::FFDHE2048) | key_group_bit(KeyGroup::X25519);
+
+/**
+ * @brief An ephemeral key pair for one Diffie-Hellman exchange, in any KeyGroup.
+ */
+class KeyExchange {
+    public:
+        virtual ~KeyExchange() = default;
+
+        /**
+         * @brief Generate a key pair in `group`.
+         *
+         * @param group
+         * @return std::unique_ptr<KeyExchange> The key pair, or nullptr if it could not be generated.
+         */
+        static std::unique_ptr<KeyExchange> create(KeyGroup group);
+
+        virtual KeyGroup get_group() const noexcept = 0;
+
+        /**
+         * @brief Get the public key, encoded to send to the peer.
+         *
+         * @return std::vector<char>
+         */
+        virtual std::vector<char> get_public_key() const = 0;
+
+        /**
+         * @brief Derive the shared secret from the peer's encoded public key.
+         *
+         * @param peer_key
+         * @return bool The success or failure of the derivation, e.g. false if the key is malformed.
+         */
+        virtual bool derive_secret(const std::vector<char>& peer_key) = 0;
+
+        /**
+         * @brief Get the shared secret, once derived.
+         *
+         * @return std::vector<char>
+         */
+        virtual std::vector<char> get_secret() const = 0;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef INCLUDE_KEY_FACTORY_H
+#define INCLUDE_KEY_FACTORY_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "key-exchange.hpp"
+
+namespace serv {
+
+/**
+ * @brief Keeps a bounded pool of pre-generated ephemeral key pairs for one KeyGroup, so that handshakes take a
+ * key pair in O(1) rather than generating one inline.
+ *
+ * A background thread, started on first use, refills the pool whenever it drops below capacity. If the pool runs dry the
+ * key pair is generated on the calling thread instead, and counted as a miss.
+ */
+class KeyFactory {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 64;
+
+        /**
+         * @brief Counters describing how well the pool is keeping up with demand.
+         */
+        struct Stats {
+            size_t available = 0;    // Key pairs waiting in the pool.
+            size_t capacity = 0;     // The most key pairs the pool holds.
+            uint64_t generated = 0;  // Key pairs generated for the pool.
+            uint64_t hits = 0;       // Key pairs handed out from the pool.
+            uint64_t misses = 0;     // Key pairs generated inline because the pool was empty.
+            double refill_rate = 0;  // Key pairs generated for the pool per second of work.
+        };
+
+    private:
+        const KeyGroup group;
+        mutable std::mutex pool_mutex;
+        std::condition_variable refill;
+        std::vector<std::unique_ptr<KeyExchange>> pool;
+        size_t capacity;
+        bool stopping;
+        std::thread thread;
+        std::atomic<uint64_t> generated;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> refill_ns;
+
+        /**
+         * @brief The refill thread: generates key pairs until the pool is full, then sleeps until one is taken.
+         */
+        void run();
+
+        /**
+         * @brief Generates a key pair for the pool, timing it for the refill rate.
+         */
+        std::unique_ptr<KeyExchange> generate();
+
+        /**
+         * @brief Starts the refill thread, if not yet started. Requires pool_mutex.
+         */
+        void start();
+
+    public:
+        /**
+         * @brief Create a factory of key pairs for `group`.
+         *
+         * @param group
+         * @param capacity The most key pairs to keep ready.
+         */
+        KeyFactory(KeyGroup group, size_t capacity = DEFAULT_CAPACITY);
+        KeyFactory(KeyFactory& f) = delete;
+        KeyFactory(KeyFactory&& f) = delete;
+        ~KeyFactory();
+
+        /**
+         * @brief Take a key pair from the pool, generating one inline if it is empty. Each key pair is handed out once.
+         *
+         * @return std::unique_ptr<KeyExchange> The key pair, or nullptr if it could not be generated.
+         */
+        std::unique_ptr<KeyExchange> acquire();
+
+        /**
+         * @brief Sets the most key pairs to keep ready. 0 disables the pool, so that every key pair is generated inline.
+         *
+         * @param n
+         */
+        void set_capacity(size_t n);
+
+        /**
+         * @brief Blocks until the pool is full, e.g. to warm it up before accepting connections.
+         *
+         * @param timeout The longest to wait.
+         * @return bool Whether the pool was filled in time.
+         */
+        bool wait_until_full(std::chrono::milliseconds timeout);
+
+        /**
+         * @brief Get a snapshot of the pool's counters.
+         *
+         * @return Stats
+         */
+        Stats get_stats() const;
+
+        inline KeyGroup get_group() const noexcept {
+            return group;
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef INCLUDE_LATENCY_HISTOGRAM_H
+#define INCLUDE_LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief A fixed-size, lock-free histogram of latencies in microseconds, for percentiles over an unbounded number of samples.
+ *
+ * Each power of two is split into SUB_BUCKETS linear buckets, so that a percentile is accurate to within a quarter of its
+ * value whatever its magnitude. Any thread may record; reads are approximate while samples are still being recorded.
+ */
+class LatencyHistogram {
+    public:
+        static constexpr unsigned SUB_BUCKET_BITS = 2;
+        static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+        static constexpr unsigned BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        /**
+         * @brief A summary of the samples recorded, in microseconds.
+         */
+        struct Summary {
+            uint64_t samples = 0;
+            uint64_t p50 = 0;
+            uint64_t p99 = 0;
+            uint64_t max = 0;
+        };
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets {};
+        std::atomic<uint64_t> samples { 0 };
+        std::atomic<uint64_t> max { 0 };
+
+        static unsigned bucket_of(uint64_t us) noexcept;
+
+        static uint64_t upper_bound_of(unsigned bucket) noexcept;
+
+    public:
+        LatencyHistogram() = default;
+        LatencyHistogram(LatencyHistogram& h) = delete;
+        LatencyHistogram(LatencyHistogram&& h) = delete;
+
+        /**
+         * @brief Record a sample.
+         *
+         * @param us The latency in microseconds.
+         */
+        void record(uint64_t us) noexcept;
+
+        /**
+         * @brief Adds every sample recorded by `h` to this histogram, e.g. to combine those of several reactors.
+         *
+         * @param h
+         */
+        void merge(const LatencyHistogram& h) noexcept;
+
+        /**
+         * @brief Discards every sample recorded so far.
+         */
+        void reset() noexcept;
+
+        /**
+         * @brief Get the latency that `p` of the samples were at or below, rounded up to the bound of its bucket.
+         *
+         * @param p The fraction of samples, between 0 and 1.
+         * @return uint64_t The latency in microseconds, or 0 if there are no samples.
+         */
+        uint64_t percentile(double p) const noexcept;
+
+        /**
+         * @brief Get the sample count, median, 99th percentile and maximum.
+         *
+         * @return Summary
+         */
+        Summary summarize() const noexcept;
+
+        inline uint64_t get_samples() const noexcept {
+            return samples;
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#ifndef INCLUDE_REACTOR_H
+#define INCLUDE_REACTOR_H
+
+#include <event-base.hpp>
+#include <event.hpp>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "socket.hpp"
+#include "completion-queue.hpp"
+#include "connection-table.hpp"
+#include "latency-histogram.hpp"
+
+using namespace libev;
+
+namespace serv {
+
+class Server;
+class Context;
+
+/**
+ * @brief A single event loop, owning its own listening socket and its own shard of accepted connections.
+ *
+ * A Server runs one or more reactors. Connections accepted by a reactor are registered on its event base only,
+ * so that every subsequent read and handshake callback for that connection runs on the same loop for life.
+ */
+class Reactor {
+    public:
+        static constexpr unsigned DEFAULT_ACCEPT_BATCH = 64;
+        static constexpr long RECLAIM_INTERVAL_US = 10000;
+
+        /**
+         * @brief Counters describing how connections have been accepted.
+         */
+        struct AcceptStats {
+            uint64_t accepted = 0;   // Connections accepted.
+            uint64_t wakeups = 0;    // Readiness events on the listening socket, each draining up to a batch of connections.
+            uint64_t capped = 0;     // Wakeups that stopped at the batch limit, with connections possibly still waiting.
+            uint64_t overflows = 0;  // Wakeups that found the accept queue full, so the kernel may have dropped connections.
+            uint32_t peak_queue = 0; // The longest accept queue seen at a wakeup.
+        };
+
+    private:
+        Server* server;
+        EventBase base;
+        CompletionQueue completions;
+        Socket listen_sock;
+        std::unique_ptr<Event> listen_event;
+        std::unique_ptr<Event> reclaim_event;
+        std::unique_ptr<Event> probe_event;
+        ConnectionTable connections;
+        LatencyHistogram loop_latency;
+        std::chrono::steady_clock::time_point probe_due;
+        long probe_interval_us = 0;
+        std::thread thread;
+        std::mutex stop_mutex;
+        int status = 0;
+        std::atomic<uint64_t> accepted = 0;
+        std::atomic<uint64_t> wakeups = 0;
+        std::atomic<uint64_t> capped = 0;
+        std::atomic<uint64_t> overflows = 0;
+        std::atomic<uint32_t> peak_queue = 0;
+        static event_callback_fn accept_callback;
+        static event_callback_fn reclaim_callback;
+        static event_callback_fn probe_callback;
+
+        /**
+         * @brief Records how late the probe timer fired, i.e. how long the loop was kept from its events, then re-arms it.
+         */
+        void probe();
+
+        /**
+         * @brief Arms the probe timer to fire after probe_interval_us.
+         */
+        void arm_probe();
+
+        /**
+         * @brief Reclaims closed connections that no thread still references, retrying every RECLAIM_INTERVAL_US while any
+         * are left, so that the loop never blocks on work still running for them.
+         */
+        void reclaim();
+
+    public:
+        Reactor(Server* server);
+        Reactor(Reactor& r) = delete;
+        Reactor(Reactor&& r) = delete;
+        ~Reactor();
+
+        /**
+         * @brief Get the exit status of the reactor loop. 0 indicates no error.
+         *
+         * @return int
+         */
+        inline int get_status() const {
+            return status;
+        }
+
+        /**
+         * @brief Binds the reactor's listening socket and adds a persistent event to accept connections from it.
+         *
+         * @param port The port to listen to connections on
+         * @param reuseport Whether to set SO_REUSEPORT, allowing other reactors to bind the same port.
+         * @param backlog The length of the listening socket's accept queue.
+         * @return bool The success or failure of the attempt to listen.
+         */
+        bool listen(const std::string& port, bool reuseport, int backlog = Socket::DEFAULT_BACKLOG);
+
+        /**
+         * @brief Runs the event base loop on the calling thread, blocking until the loop exits.
+         *
+         * @return int The exit status of the loop.
+         */
+        int run();
+
+        /**
+         * @brief Runs the event base loop on a dedicated thread.
+         */
+        void start();
+
+        /**
+         * @brief Called by accept_callback; accepts incoming connections until none are left waiting, or until the server's
+         * accept batch limit is reached, so that one busy listener cannot starve the loop's other events. Any connections left
+         * over keep the listening socket readable, so the loop returns to them on its next iteration.
+         */
+        void accept_connection();
+
+        /**
+         * @brief Get a snapshot of this reactor's accept counters.
+         *
+         * @return AcceptStats
+         */
+        AcceptStats get_accept_stats() const;
+
+        /**
+         * @brief Starts or stops measuring the loop's latency: a timer due every `us` microseconds records how late it
+         * actually fires, which is how long any event that became ready alongside it had to wait. Called off the loop thread,
+         * the change is queued for the loop.
+         *
+         * @param us The interval between probes; 0 stops probing.
+         */
+        void set_probe_interval(long us);
+
+        /**
+         * @brief Get the latencies measured by the probe since it started, or since the last reset.
+         *
+         * @return const LatencyHistogram&
+         */
+        inline const LatencyHistogram& get_loop_latency() const noexcept {
+            return loop_latency;
+        }
+
+        inline void reset_loop_latency() noexcept {
+            loop_latency.reset();
+        }
+
+        /**
+         * @brief Removes a context from this reactor's shard, if it was accepted here. Called off the loop thread, the removal
+         * is queued for the loop. The context is closed at once, but only freed once no pool thread can still be using it.
+         */
+        void close_connection(evutil_socket_t fd);
+
+        /**
+         * @brief Like close_connection(evutil_socket_t), but only removes the connection the handle refers to, leaving alone
+         * any newer connection that has since been accepted on the same fd.
+         */
+        void close_connection(ConnectionTable::Handle handle);
+
+        /**
+         * @brief Get the context a handle refers to. Loop thread only.
+         *
+         * @return Context* The context, or nullptr if the connection has been closed.
+         */
+        inline Context* get_connection(ConnectionTable::Handle handle) const noexcept {
+            return connections.get(handle);
+        }
+
+        /**
+         * @brief Gracefully terminates the event base loop and, if running on a dedicated thread, joins it. Safe to call from
+         * several threads at once.
+         */
+        void stop();
+
+        /**
+         * @brief Get a pointer to the event base.
+         *
+         * @return EventBase* const
+         */
+        EventBase* const get_base();
+
+        /**
+         * @brief Get a pointer to the queue that carries work from other threads back to this reactor's loop.
+         *
+         * @return CompletionQueue* const
+         */
+        CompletionQueue* const get_completions();
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#ifndef INCLUDE_RECORD_CIPHER_H
+#define INCLUDE_RECORD_CIPHER_H
+
+#include <openssl/evp.h>
+#include <sys/uio.h>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+namespace serv {
+
+/**
+ * @brief The ciphers a secure channel can encrypt its traffic with, once the handshake has agreed a key.
+ *
+ *  - AES_256_CBC: each message is padded and encrypted on its own. Understood by every peer. Peers that support records
+ *  send each message in a length-prefixed record, authenticated by an HMAC over the cipher text; older peers send the bare,
+ *  unauthenticated cipher text.
+ *
+ *  - AES_256_GCM, CHACHA20_POLY1305: AEAD ciphers. Messages are always sealed into length-prefixed records, with an
+ *  authentication tag that covers both the length and the message.
+ */
+enum class ChannelCipher : uint32_t {
+    AES_256_CBC = 0,
+    AES_256_GCM = 1,
+    CHACHA20_POLY1305 = 2,
+};
+
+/**
+ * @brief Get the bit representing `cipher` in a bitmask of ciphers.
+ */
+constexpr uint32_t channel_cipher_bit(ChannelCipher cipher) {
+    return static_cast<uint32_t>(cipher) < 32 ? 1u << static_cast<uint32_t>(cipher) : 0;
+}
+
+constexpr uint32_t ALL_CHANNEL_CIPHERS = channel_cipher_bit(ChannelCipher::AES_256_CBC)
+    | channel_cipher_bit(ChannelCipher::AES_256_GCM)
+    | channel_cipher_bit(ChannelCipher::CHACHA20_POLY1305);
+
+/**
+ * @brief Seals outgoing messages into, and opens incoming messages from, the records of a secure channel.
+ *
+ * A record is the length of its body as a 4-byte big-endian integer, then the body: for an AEAD cipher, the encrypted message
+ * followed by the 16-byte tag; for AES-256-CBC, the padded and encrypted message followed by a 16-byte HMAC-SHA256 tag
+ * over the nonce, the length and the cipher text. The length tells the receiver how much to wait for before opening a
+ * record, however the stream was split.
+ *
+ * The nonce of each record is the IV agreed by the handshake XORed with the record's sequence number, so that it is never
+ * sent and never repeats; host and peer each flip a different bit of it, so that the two directions never share one. A CBC
+ * record's IV is an HMAC of its nonce, so that it cannot be predicted, and its tag is checked before any block is decrypted,
+ * so that a forged record is rejected the same way whatever its padding. Records must be opened in the order they were
+ * sealed.
+ */
+class RecordCipher {
+    public:
+        static constexpr size_t KEY_SIZE = 32;
+        static constexpr size_t NONCE_SIZE = 12;
+        static constexpr size_t BLOCK_SIZE = 16;
+        static constexpr size_t LENGTH_SIZE = 4;
+        static constexpr size_t TAG_SIZE = 16;
+        static constexpr size_t OVERHEAD = LENGTH_SIZE + TAG_SIZE;
+        static constexpr uint32_t MAX_RECORD_SIZE = 1 << 24;
+
+    private:
+        using CipherCtx = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+        using MacCtx = std::unique_ptr<EVP_MAC_CTX, decltype(&EVP_MAC_CTX_free)>;
+
+        ChannelCipher cipher;
+        CipherCtx sealer;
+        CipherCtx opener;
+        MacCtx seal_mac;
+        MacCtx open_mac;
+        std::array<unsigned char, BLOCK_SIZE> seal_nonce {};
+        std::array<unsigned char, BLOCK_SIZE> open_nonce {};
+        size_t nonce_size = NONCE_SIZE;
+        uint64_t seal_seq = 0;
+        uint64_t open_seq = 0;
+        bool valid = false;
+
+        /**
+         * @brief Computes the nonce of record `seq` from a direction's base nonce.
+         */
+        void nonce_of(const std::array<unsigned char, BLOCK_SIZE>& base, uint64_t seq, unsigned char* nonce) const noexcept;
+
+        /**
+         * @brief Whether the cipher authenticates records itself, rather than by HMAC.
+         */
+        inline bool is_aead() const noexcept {
+            return cipher != ChannelCipher::AES_256_CBC;
+        }
+
+        /**
+         * @brief Decrypts the CBC blocks of a record's body in place, and strips their padding.
+         *
+         * @return int64_t The length of the message, or -1 if the body is not whole blocks or its padding is malformed, which
+         * only a broken peer can cause, since the tag has already been checked.
+         */
+        int64_t open_blocks(const iovec* iov, int iovcnt, size_t len, const unsigned char* iv);
+
+    public:
+        /**
+         * @brief Create the cipher for one end of a channel. The key schedule is set up once, here, for every record.
+         *
+         * @param cipher Any ChannelCipher; an unknown one leaves the cipher invalid.
+         * @param key The key agreed by the handshake, KEY_SIZE bytes.
+         * @param iv The IV agreed by the handshake, at least NONCE_SIZE bytes for an AEAD cipher or BLOCK_SIZE for CBC.
+         * @param is_host Whether this end initialized the handshake.
+         */
+        RecordCipher(ChannelCipher cipher, const std::vector<char>& key, const std::vector<char>& iv, bool is_host);
+        RecordCipher(RecordCipher& c) = delete;
+        RecordCipher(RecordCipher&& c) = delete;
+
+        /**
+         * @brief Whether the cipher was set up, i.e. whether records can be sealed and opened.
+         */
+        inline bool is_valid() const noexcept {
+            return valid;
+        }
+
+        inline ChannelCipher get_cipher() const noexcept {
+            return cipher;
+        }
+
+        /**
+         * @brief Get the size of the tag at the end of each record's body.
+         */
+        inline size_t get_tag_size() const noexcept {
+            return TAG_SIZE;
+        }
+
+        /**
+         * @brief Get the size of the record that a message of `len` bytes is sealed into.
+         */
+        inline size_t sealed_size(size_t len) const noexcept {
+            return OVERHEAD + (is_aead() ? len : (len / BLOCK_SIZE + 1) * BLOCK_SIZE);
+        }
+
+        /**
+         * @brief Seals a message into the next record, appending the record to `out`.
+         *
+         * @param data The message
+         * @param len The length of the message, sealed into a body of at most MAX_RECORD_SIZE.
+         * @param out
+         * @return bool The success or failure of the encryption, in which case `out` is left as it was.
+         */
+        bool seal(const char* data, size_t len, std::vector<char>& out);
+
+        /**
+         * @brief Like seal(data, len, out), but gathers the message from several parts, e.g. a framing prefix, the message
+         * itself and a terminator, encrypting each straight into the record without first joining them.
+         *
+         * @param iov The parts of the message, in order.
+         * @param iovcnt
+         * @param out
+         * @return bool The success or failure of the encryption, in which case `out` is left as it was.
+         */
+        bool seal(const iovec* iov, int iovcnt, std::vector<char>& out);
+
+        /**
+         * @brief Opens the record at the front of `data`, if it is complete, appending its message to `out`.
+         *
+         * @param data
+         * @param n The number of bytes available at `data`.
+         * @param out
+         * @return int64_t The size of the record consumed, 0 if it is not yet complete, or -1 if it is malformed or fails
+         * authentication, after which no further records can be opened.
+         */
+        int64_t open(const char* data, size_t n, std::vector<char>& out);
+
+        /**
+         * @brief Opens the next record where it lies, decrypting its message over its cipher text. The cipher text may be
+         * split, e.g. where a record wraps round the end of a CircularBuf. The message starts where the cipher text did.
+         *
+         * @param length The record's length prefix, LENGTH_SIZE bytes.
+         * @param iov The record's body up to its tag, decrypted in place.
+         * @param iovcnt
+         * @param tag The record's tag, get_tag_size() bytes.
+         * @return int64_t The length of the message, or -1 if the record was malformed or not authentic, in which case the
+         * decrypted bytes are zeroed, and no further records can be opened.
+         */
+        int64_t open_in_place(const char* length, const iovec* iov, int iovcnt, const char* tag);
+
+        /**
+         * @brief Decode the length prefix at the front of a record.
+         *
+         * @param length LENGTH_SIZE bytes.
+         * @return uint32_t The length of the record's body.
+         */
+        static uint32_t read_length(const char* length) noexcept;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -2,21 +2,193 @@
 #define INCLUDE_SECURE_SOCKET_H
 
 #include <crypt/crypt.hpp>
-#include <crypt/exchange.hpp>
+#include <memory>
+#include <optional>
 #include "socket.hpp"
+#include "key-factory.hpp"
+#include "record-cipher.hpp"
+#include "session-ticket.hpp"
+#include "session-cache.hpp"
 
 namespace serv {
 
+/**
+ * @brief A socket that encrypts its traffic with a key agreed by Diffie-Hellman exchange during a handshake.
+ *
+ * Crypto state is only held while it is needed: the key exchange from handshake_init() or handshake_accept() until the key
+ * is derived, and the cipher from then on. A socket that is yet to handshake, e.g. one waiting on accept, holds neither.
+ * Key pairs are taken from a shared KeyFactory per group, so that handshakes do not wait on key generation.
+ *
+ * The host offers a key for each of its key groups; the peer picks the cheapest it also supports, preferring X25519 and
+ * falling back to ffdhe2048, which is the only group older peers know of.
+ *
+ * The peer likewise picks the channel cipher, from those the host supports. Each message travels in its own length-prefixed
+ * record, see RecordCipher, so that the receiver knows where one ends however TCP splits or coalesces them; with an AEAD
+ * cipher the record's tag also stands in for a digest of the message. Older peers, which know of nothing but AES-256-CBC,
+ * send each message as a bare cipher text instead.
+ *
+ * Over a record channel, the host also issues the peer a session ticket, see SessionTickets, in the first record it sends. A
+ * peer that returns with the ticket, see handshake_resume(), skips the key exchange: both sides derive the channel's keys
+ * from the ticket's secret and a fresh nonce from each of them instead, the host's travelling in its confirmation, so that a
+ * replayed resumption never brings back keys that were used before. The peer's first requests may travel with the ticket,
+ * as early data, sealed under keys of their own derived from the secret and the peer's nonce alone; should the host turn
+ * the ticket down, the handshake carries on in full over the key share sent alongside it, and the early data is dropped.
+ *
+ * The host also holds each session it issues a ticket for in its SessionCache, naming it to the peer by a session id that
+ * travels alongside the ticket. A returning peer presents both; the host looks the id up first, and only opens the ticket
+ * if the id is not one its cache issued, as when another host, or this one before a restart, issued the session. An id the
+ * cache issued but no longer holds, having been resumed, expired or evicted, turns the session down, so that a replayed
+ * resumption is not honored by its ticket instead.
+ */
 class SecureSocket : public Socket {
+    public:
+        static constexpr const char* CIPHER = "AES-256-CBC";
+
+        /**
+         * @brief The largest record buffer kept from one send to the next. A larger one is freed once its record is sent, so
+         * that one large message does not pin its memory to the connection.
+         */
+        static constexpr size_t MAX_RETAINED_RECORD = 64 * 1024;
+
+        static constexpr size_t RESUME_NONCE_SIZE = 16;
+
+        /**
+         * @brief The most early data a peer may send with a ticket, so that the whole flight arrives in one read.
+         */
+        static constexpr size_t MAX_EARLY_DATA = 4 * 1024;
+
     private:
-        crpt::Crypt aes { "AES-256-CBC" };
-        crpt::Exchange dh { "ffdhe2048" };
-        std::vector<char> shared_secret;
+        std::unique_ptr<crpt::Crypt> aes;
+        std::unique_ptr<RecordCipher> records;
+        std::unique_ptr<RecordCipher> early;
+        std::vector<char> sealed;
+        std::mutex seal_mux;
+        std::vector<std::unique_ptr<KeyExchange>> exchanges;
         std::vector<char> key;
         std::vector<char> iv;
         bool is_secure = false;
+        Framing preferred_framing = Framing::NULL_DELIMITED;
+        Framing negotiated_framing = Framing::NULL_DELIMITED;
+        uint32_t key_groups = ALL_KEY_GROUPS;
+        KeyGroup key_group = KeyGroup::FFDHE2048;
+        std::vector<char> peer_key;
+        KeyGroup peer_group = KeyGroup::FFDHE2048;
+        Framing peer_framing = Framing::NULL_DELIMITED;
+        ChannelCipher preferred_cipher = ChannelCipher::AES_256_GCM;
+        ChannelCipher channel_cipher = ChannelCipher::AES_256_CBC;
+        bool cbc_records = false;
+        std::optional<Session> session;
+        std::vector<char> resumption;
+        std::vector<char> resume_nonce;
+        std::vector<char> early_data;
+        bool tickets = false;
+        bool wants_tickets = true;
+        bool resuming = false;
+        bool resumed = false;
+
+        /**
+         * @brief Get the cipher for bare AES-256-CBC messages, creating it on first use.
+         */
+        crpt::Crypt& cipher();
+
+        /**
+         * @brief Derives the key from the secret agreed by a key exchange, then releases every exchange.
+         * 
+         * @param kx The exchange the secret was derived with.
+         * @return bool The success or failure of hashing the secret.
+         */
+        bool derive_key(KeyExchange& kx);
+
+        /**
+         * @brief Sets up the negotiated channel cipher with the derived key, once the handshake is complete.
+         * 
+         * @param is_host Whether this socket initialized the handshake.
+         * @return bool The success or failure of setting up the cipher.
+         */
+        bool start_channel(bool is_host);
+
+        /**
+         * @brief Derives a key and IV of a resumed session from its secret: for the channel, from the nonces of both peer
+         * and host; for the early data, which the peer seals before it knows the host's nonce, from the peer's alone.
+         * 
+         * @return bool The success or failure of the derivation.
+         */
+        bool resume_keys(const std::vector<char>& secret, const std::vector<char>& nonce, bool for_early_data, std::vector<char>& k, std::vector<char>& v) const;
+
+        /**
+         * @brief Accepts a handshake initialization, resuming `resume` if given and the host supports its cipher and framing.
+         * See handshake_accept() and handshake_resume()
+         */
+        bool accept(const Session* resume, const std::vector<std::string>& early);
+
+        /**
+         * @brief Seals the ticket for this session into the first record of the channel, appending it to `out`, then forgets
+         * the session's secret.
+         * 
+         * @return bool The success or failure of sealing the ticket. Failing to issue one is not an error: the peer is sent an
+         * empty ticket instead.
+         */
+        bool seal_ticket(std::vector<char>& out);
+
+        /**
+         * @brief Reads the ticket out of the first record the host sent.
+         * 
+         * @param at Where the opened record lies in the buffer.
+         * @param len The length of the ticket.
+         */
+        void read_ticket(uint32_t at, size_t len);
+
+        /**
+         * @brief Frames a message and seals it as a record, appending the record to `out`.
+         */
+        bool seal_message(const char* data, size_t len, bool terminate, std::vector<char>& out);
+
+        /**
+         * @brief Opens every complete record in the buffer from `offset` in place under `cipher`, leaving only their messages. The start of a
+         * record still on its way is held back in the buffer, out of sight of readers, until the rest of it arrives. Expects
+         * buf_mux to be held.
+         * 
+         * @return int64_t The number of bytes of messages opened, or -1 if a record could not be opened.
+         */
+        int64_t open_records(RecordCipher& cipher, uint32_t offset);
+
+        /**
+         * @brief Receives into the buffer, then opens every complete record there in place, leaving only their messages.
+         * However many records arrived together, they are all opened in one pass. Expects buf_mux to be held.
+         * 
+         * @return std::pair<int32_t, uint32_t> See try_recv()
+         */
+        std::pair<int32_t, uint32_t> recv_records();
+
+        /**
+         * @brief Get the pending exchange in `group`, if one was started.
+         * 
+         * @return KeyExchange* The exchange, or nullptr.
+         */
+        KeyExchange* find_exchange(KeyGroup group) noexcept;
     
     public:
+        /**
+         * @brief Get the factory that pre-generates key pairs in `group` for every socket's handshakes.
+         * 
+         * @return KeyFactory& 
+         */
+        static KeyFactory& get_key_factory(KeyGroup group = KeyGroup::FFDHE2048);
+
+        /**
+         * @brief Get the issuer of every host socket's session tickets.
+         * 
+         * @return SessionTickets& 
+         */
+        static SessionTickets& get_session_tickets();
+
+        /**
+         * @brief Get the cache of the sessions every host socket has issued tickets for.
+         * 
+         * @return SessionCache& 
+         */
+        static SessionCache& get_session_cache();
+
         SecureSocket() = default;
         SecureSocket(Socket&& s);
         SecureSocket(SecureSocket& sock);
@@ -25,28 +197,156 @@ class SecureSocket : public Socket {
         SecureSocket& operator=(SecureSocket&& sock);
 
         /**
-         * @brief Initialize a handshake from the host, passing the public key & IV to the peer.
+         * @brief Sets the framing mode to ask the host for when accepting a handshake. Falls back to null-delimited
+         * messages if the host does not support it.
+         * 
+         * @param f See Framing
+         */
+        inline void set_preferred_framing(Framing f) noexcept {
+            preferred_framing = f;
+        }
+
+        /**
+         * @brief Sets the channel cipher to ask the host for when accepting a handshake. Defaults to AES-256-GCM; falls back
+         * to AES-256-CBC if the host does not support it.
+         * 
+         * @param c See ChannelCipher
+         */
+        inline void set_preferred_cipher(ChannelCipher c) noexcept {
+            preferred_cipher = c;
+        }
+
+        /**
+         * @brief Sets whether to ask the host for a session ticket when accepting a handshake. Defaults to true; a peer that
+         * will not read from the channel before its next handshake should not ask for one.
+         * 
+         * @param b
+         */
+        inline void set_tickets(bool b) noexcept {
+            wants_tickets = b;
+        }
+
+        /**
+         * @brief Get the channel cipher the last handshake agreed on.
+         * 
+         * @return ChannelCipher 
+         */
+        inline ChannelCipher get_cipher() const noexcept {
+            return channel_cipher;
+        }
+
+        /**
+         * @brief Sets the key groups to offer when initializing a handshake, or to choose from when accepting one. Defaults to
+         * every group; leave out ffdhe2048 to refuse peers that know of nothing else.
+         * 
+         * @param groups A bitmask of key_group_bit() values.
+         */
+        inline void set_key_groups(uint32_t groups) noexcept {
+            key_groups = groups;
+        }
+
+        /**
+         * @brief Get the key group the last completed handshake agreed its key over.
+         * 
+         * @return KeyGroup 
+         */
+        inline KeyGroup get_key_group() const noexcept {
+            return key_group;
+        }
+
+        /**
+         * @brief Get the session the host issued this peer a ticket for, if any, to resume on a later connection. The ticket
+         * arrives in the first record after the handshake, so is only here once something has been received.
+         * 
+         * @return const std::optional<Session>& 
+         */
+        inline const std::optional<Session>& get_session() const noexcept {
+            return session;
+        }
+
+        /**
+         * @brief Whether the last handshake resumed a session, rather than exchanging keys.
+         * 
+         * @return bool 
+         */
+        inline bool is_resumed() const noexcept {
+            return resumed;
+        }
+
+        /**
+         * @brief Initialize a handshake from the host, passing a public key per key group, the IV and supported framing modes and
+         * channel ciphers to the peer.
+         * Handshake messages themselves are always null-delimited.
          * 
          * @return bool The success or failure of the initialization attempt.
          */
         bool handshake_init();
 
         /**
-         * @brief Accepts a handshake initializtion and returns its own public key to the requestor.
+         * @brief Accepts a handshake initializtion and returns its own public key, with the chosen key group, framing mode and
+         * channel cipher, to the requestor.
          *
          * @return bool The success or failure of the accept attempt.
          */
         bool handshake_accept();
 
         /**
-         * @brief Retrieve the public key from the peer and attempt to derive a shared secret & 256-bit key.
+         * @brief Accepts a handshake initialization by presenting the ticket of an earlier session, with the key share of a full
+         * handshake in case the host turns it down. `early` messages are sealed under the resumed session's keys and sent
+         * along in the same flight; the host only acts on them if it resumes the session, see is_resumed() once confirmed.
+         * 
+         * @param resume A session from get_session() on an earlier connection.
+         * @param early Messages to send before the handshake is confirmed, at most MAX_EARLY_DATA bytes once sealed.
+         * @return bool The success or failure of the accept attempt. Fails without sending anything if the session has expired,
+         * or has neither a ticket nor a session id.
+         */
+        bool handshake_resume(const Session& resume, const std::vector<std::string>& early = {});
+
+        /**
+         * @brief Retrieve the public key from the peer and attempt to derive a shared secret & 256-bit key. Adopts the framing
+         * mode chosen by the peer.
+         * 
+         * Runs handshake_read(), handshake_derive() and handshake_complete() in turn; callers that cannot afford to block on
+         * the key derivation can run the phases separately instead.
          * 
          * @return bool The success or failure of the retrieval & derivation attempt.
          */
         bool handshake_final();
 
         /**
-         * @brief Confirms that a handshake has been completed by the host and derives the shared secret + key.
+         * @brief The first phase of handshake_final(): receives and parses the peer's reply, holding on to its public key.
+         * 
+         * @return bool The success or failure of the retrieval, e.g. false if the reply names a group that was not offered.
+         */
+        bool handshake_read();
+
+        /**
+         * @brief The second phase of handshake_final(): derives the shared secret & key from the public key kept by
+         * handshake_read(). Does no socket I/O, so it may run on another thread provided nothing else uses the socket meanwhile.
+         * 
+         * @return bool The success or failure of the derivation attempt.
+         */
+        bool handshake_derive();
+
+        /**
+         * @brief The last phase of handshake_final(): confirms the handshake to the peer and adopts the framing mode and channel
+         * cipher it chose.
+         * 
+         * @return bool The success or failure of the confirmation.
+         */
+        bool handshake_complete();
+
+        /**
+         * @brief Opens the early data that came with a resumed session's ticket, leaving its messages in the buffer for
+         * read_buffer(). Does no socket I/O, so that the messages are found without waiting for the peer to send more.
+         * 
+         * @return int64_t The number of bytes of messages opened, or -1 if the early data could not be opened.
+         */
+        int64_t open_early_data();
+
+        /**
+         * @brief Confirms that a handshake has been completed by the host and derives the shared secret + key, unless the host
+         * resumed the session.
          * 
          * @return bool The success or failure of the derivation attempt.
          */
@@ -54,6 +354,8 @@ class SecureSocket : public Socket {
 
         /**
          * @brief If secure, retrieves and decrypts sock data. See Socket::try_rev()
+         * Complete records are decrypted in place in the buffer; the start of a record still on its way is kept aside until
+         * the rest arrives, so a message split by TCP is never decrypted in pieces.
          * 
          * @return std::pair<int, bool> The number of bytes read (-2 indicates socket is not secure, -1 indicates error) and the remaining buffer space.
          */
@@ -61,12 +363,14 @@ class SecureSocket : public Socket {
 
         /**
          * @brief If secure, encrypts and sends sock data. See Socket::try_send()
+         * The data is framed and encrypted straight into a record buffer kept by the socket, so that sending costs no
+         * allocation unless the record has to be queued.
          * 
          * @param data The data to encrypt and send.
-         * @param terminate Whether to include the null-terminator, default is true.
+         * @param terminate Whether to include the null-terminator, if null-delimited. Default is true.
          * @return bool The success or failure of the attempt to ancrypt and send.
          */
-        bool try_send(std::string data, bool terminate=true);
+        bool try_send(const std::string& data, bool terminate=true);
 };
 
 }
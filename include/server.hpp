@@ -4,11 +4,18 @@
 #include <event-base.hpp>
 #include <event.hpp>
 #include <map>
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include "socket.hpp"
 #include "thread-pool.hpp"
 #include "handler.hpp"
+#include "reactor.hpp"
 
 using namespace libev;
 
@@ -21,16 +28,32 @@ class Server {
     private:
         int status = 0;
         std::string port;
-        Socket listen_sock;
-        EventBase base;
         std::unordered_map<std::string, std::unique_ptr<Handler>> api;
-        static event_callback_fn accept_callback;
         ThreadPool thread_pool;
-        std::unordered_map<evutil_socket_t, std::shared_ptr<Context>> ctx_pool;
+        std::vector<std::unique_ptr<Reactor>> reactors;
+        std::mutex run_mutex;
+        std::condition_variable run_condition;
+        bool running = false;
+        std::thread::id run_thread;
+        std::atomic<uint32_t> buffer_limit;
+        std::atomic<int> backlog;
+        std::atomic<unsigned> accept_batch;
+        std::atomic<bool> handshake_offload;
 
     public:
         Server();
-        Server(std::string port);
+
+        /**
+         * @brief Create a server listening on `port`, driven by `n_reactors` event loops.
+         * 
+         * With more than one reactor, each loop binds its own SO_REUSEPORT listening socket so that the kernel
+         * balances incoming connections between them. Passing 0 starts one reactor per hardware thread.
+         * 
+         * @param port The port to listen to connections on
+         * @param n_reactors The number of event loops to run, default is 1.
+         * @param scheduler How the thread pool distributes work between its threads. See ThreadPool::Scheduler
+         */
+        Server(std::string port, unsigned n_reactors = 1, ThreadPool::Scheduler scheduler = ThreadPool::Scheduler::SHARED_QUEUE);
         Server(Server &s) = delete;
         Server(Server &&s) = delete;
         ~Server();
@@ -49,8 +72,18 @@ class Server {
          * 
          * @param path The path to assign the callback to. Corresponds to the proto::Header 'path' field.
          * @param cb The callback to execute when this path is requested.
+         * @param idempotent Whether a request to the path is safe to repeat. Only idempotent paths are served from the early
+         * data of a resumed session, which an eavesdropper could replay. Default is false.
          */
-        void set_endpoint(std::string path, HandlerFunc cb);
+        void set_endpoint(std::string path, HandlerFunc cb, bool idempotent = false);
+
+        /**
+         * @brief Whether the path was assigned a callback as idempotent. See set_endpoint()
+         * 
+         * @param path
+         * @return bool False if the path does not exist.
+         */
+        bool is_idempotent(const std::string& path) const;
 
         /**
          * @brief If a callback has been assigned to the 'path' requested, exec_endpoints passes the context to the callback and executes; else returns false.
@@ -63,34 +96,154 @@ class Server {
         bool exec_endpoint(std::string path, Context* c);
 
         /**
-         * @brief Calls try_listen() and adds a persistent event to listen to & accept connections from the bound sock.
-         * Then runs the event base loop. The exit status of the loop will be set on the Server.
+         * @brief Calls Reactor::listen() on every reactor, then runs their event base loops.
+         * The first reactor runs on the calling thread, which blocks until it exits; the rest run on dedicated threads.
+         * The exit status of the loops will be set on the Server.
         */
         void run();
 
         /**
-         * @brief Called by accept_callback; attempts to accept an incoming connection attempt.
-         */
-        void accept_connection();
-
-        /**
-         * @brief Removes a context from the server whenever the peer closes the socket connection.
+         * @brief Removes a context from the server whenever the peer closes the socket connection. The removal goes to the
+         * reactor that accepted the connection only, see Reactor::close_connection(ConnectionTable::Handle)
          * 
+         * @param ctx
          */
-        void close_connection(evutil_socket_t fd);
+        void close_connection(const Context& ctx);
 
         /**
-         * @brief Gracefully terminates the event base loop.
+         * @brief Gracefully terminates every event base loop. Called from any thread other than the one in run(), blocks until
+         * run() has returned, so that the server can then be safely destroyed.
         */
         void stop();
 
         /**
-         * @brief Get a pointer to the event bae.
+         * @brief Get a pointer to the event base of the first reactor.
          * 
          * @return const EventBase* const 
          */
         EventBase* const get_base();
 
+        /**
+         * @brief Get a pointer to the thread pool that request handling is dispatched to.
+         * 
+         * @return ThreadPool* const 
+         */
+        inline ThreadPool* const get_thread_pool() {
+            return &thread_pool;
+        }
+
+        /**
+         * @brief Get the number of reactors (event loops) driving the server.
+         * 
+         * @return size_t 
+         */
+        inline size_t get_reactor_count() const {
+            return reactors.size();
+        }
+
+        /**
+         * @brief Get the most each connection's receive buffer may grow to.
+         * 
+         * @return uint32_t 
+         */
+        inline uint32_t get_buffer_limit() const {
+            return buffer_limit;
+        }
+
+        /**
+         * @brief Sets the most each connection's receive buffer may grow to, for connections accepted from now on.
+         * Messages larger than this are rejected with ERR_CONTEXT_BUFFER_FULL. See Socket::set_buffer_limit()
+         * 
+         * @param limit Must be a power of 2
+         */
+        inline void set_buffer_limit(uint32_t limit) {
+            buffer_limit = limit;
+        }
+
+        /**
+         * @brief Get the length of each reactor's accept queue.
+         * 
+         * @return int 
+         */
+        inline int get_backlog() const {
+            return backlog;
+        }
+
+        /**
+         * @brief Sets the length of each reactor's accept queue, i.e. how many connections the kernel holds while the reactors
+         * are busy before it starts dropping them. Takes effect the next time run() is called; the kernel caps it at
+         * net.core.somaxconn.
+         * 
+         * @param n 
+         */
+        inline void set_backlog(int n) {
+            backlog = n;
+        }
+
+        /**
+         * @brief Get the most connections a reactor accepts per wakeup of its listening socket.
+         * 
+         * @return unsigned 
+         */
+        inline unsigned get_accept_batch() const {
+            return accept_batch;
+        }
+
+        /**
+         * @brief Sets the most connections a reactor accepts per wakeup of its listening socket. Larger batches save
+         * wakeups during connection storms, smaller ones let reads on existing connections interleave with the accepts.
+         * 
+         * @param n Must be at least 1.
+         */
+        inline void set_accept_batch(unsigned n) {
+            accept_batch = std::max(n, 1u);
+        }
+
+        /**
+         * @brief Get the accept counters of every reactor, summed; peak_queue is the largest of them.
+         * 
+         * @return Reactor::AcceptStats 
+         */
+        Reactor::AcceptStats get_accept_stats() const;
+
+        /**
+         * @brief Whether handshake key derivation runs on the thread pool rather than on the reactor loops.
+         * 
+         * @return bool 
+         */
+        inline bool get_handshake_offload() const {
+            return handshake_offload;
+        }
+
+        /**
+         * @brief Sets whether handshake key derivation runs on the thread pool. On by default, so that a burst of handshakes
+         * does not hold up the other connections on a loop; off, each handshake completes inline in its read callback.
+         * 
+         * @param offload 
+         */
+        inline void set_handshake_offload(bool offload) {
+            handshake_offload = offload;
+        }
+
+        /**
+         * @brief Starts or stops measuring the latency of every reactor loop. See Reactor::set_probe_interval()
+         * 
+         * @param us The interval between probes; 0 stops probing.
+         */
+        void set_loop_probe_interval(long us);
+
+        /**
+         * @brief Get the loop latencies measured across every reactor.
+         * 
+         * @return LatencyHistogram::Summary 
+         */
+        LatencyHistogram::Summary get_loop_latency() const;
+
+        /**
+         * @brief Discards the loop latencies measured so far, e.g. before a run worth measuring on its own.
+         */
+        void reset_loop_latency();
+
         /**
          * @brief Pass any generic function to the thread pool, to later be executed by a thread, passing in the args given.
          * 
@@ -98,10 +251,26 @@ class Server {
          * @tparam Args The function arguments
          * @param f The function
          * @param args The arguments to execute the function with.
+         * @return bool False if the thread pool has been stopped, in which case the function is dropped.
+         */
+        template <typename F, typename... Args>
+        bool allocate_work(F&& f, Args&& ...args) {
+            return thread_pool.enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+        }
+
+        /**
+         * @brief Like allocate_work(), but returns a Future of the function's result, so that handlers can fan out work
+         * and join it with Future::then() / when_all() without blocking a pool thread. See ThreadPool::submit()
+         * 
+         * @tparam F The function type
+         * @tparam Args The function arguments
+         * @param f The function
+         * @param args The arguments to execute the function with.
+         * @return Future of the function's result.
          */
         template <typename F, typename... Args>
-        void allocate_work(F&& f, Args&& ...args) {
-            thread_pool.enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+        auto submit_work(F&& f, Args&& ...args) {
+            return thread_pool.submit(std::forward<F>(f), std::forward<Args>(args)...);
         }
 };
 
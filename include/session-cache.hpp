@@ -0,0 +1,146 @@
+#ifndef INCLUDE_SESSION_CACHE_H
+#define INCLUDE_SESSION_CACHE_H
+
+#include <array>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include "session-ticket.hpp"
+
+namespace serv {
+
+/**
+ * @brief Keeps the sessions a host has handed out, keyed by a random session id, so that a returning peer is resumed by
+ * looking its session up rather than by opening a ticket.
+ *
+ * The cache is bounded and split into shards, each under its own lock, so that concurrent handshakes rarely contend. Each
+ * shard keeps its sessions in the order they expire, which is the order they were added unless the time-to-live has since
+ * been shortened: expired sessions are dropped from the front as new ones arrive, and once a shard is full the session
+ * soonest to expire makes way for the next.
+ *
+ * Each id is redeemed once: take() removes the session, and the handshake that resumes it is issued a new id. Every id ends
+ * in a MAC under a key of the cache's own, so that the cache can tell the ids it issued, which are never to be honored again
+ * once they are gone, from those issued elsewhere, e.g. by another host or before a restart.
+ */
+class SessionCache {
+    public:
+        static constexpr size_t SHARDS = 16;
+        static constexpr size_t ID_SIZE = 16;
+        static constexpr size_t ID_TAG_SIZE = 8;
+        static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+        static constexpr std::chrono::seconds DEFAULT_TTL = SessionTickets::DEFAULT_LIFETIME;
+
+        /**
+         * @brief Counters describing how the cache is used.
+         */
+        struct Stats {
+            size_t size = 0;        // Sessions held, some of which may have expired since.
+            size_t capacity = 0;    // The most sessions held.
+            uint64_t hits = 0;      // Ids redeemed for their session.
+            uint64_t misses = 0;    // Ids that were unknown, already redeemed, or expired.
+            uint64_t evicted = 0;   // Sessions dropped to make room before they expired.
+        };
+
+    private:
+        struct Entry {
+            std::string id;
+            Session session;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            std::list<Entry> entries;       // Soonest to expire first.
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        };
+
+        std::array<Shard, SHARDS> shards;
+        std::array<unsigned char, 32> id_key;
+        std::atomic<size_t> shard_capacity;
+        std::atomic<int64_t> ttl;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> evicted;
+
+        Shard& shard_of(const std::string& id);
+
+        /**
+         * @brief Computes the MAC that ends an id from the random bytes that start it.
+         */
+        void tag_id(const char* id, unsigned char* tag) const;
+
+        /**
+         * @brief Drops a shard's expired sessions, then those soonest to expire until there is room for `room` more. Requires
+         * the shard's mutex.
+         */
+        void trim(Shard& shard, size_t room);
+
+        /**
+         * @brief Zeroes the entry's secret, then removes it. Requires the shard's mutex.
+         */
+        static void erase(Shard& shard, std::list<Entry>::iterator it);
+
+    public:
+        /**
+         * @brief Create a cache of sessions.
+         *
+         * @param capacity The most sessions to hold, spread evenly over the shards.
+         * @param ttl How long a session is held for.
+         */
+        SessionCache(size_t capacity = DEFAULT_CAPACITY, std::chrono::seconds ttl = DEFAULT_TTL);
+        SessionCache(SessionCache& c) = delete;
+        SessionCache(SessionCache&& c) = delete;
+        ~SessionCache();
+
+        /**
+         * @brief Holds a copy of `session` for the time-to-live from now, under a new random id.
+         *
+         * @param session
+         * @return std::string The id, or an empty string if the cache holds nothing or the session has no secret.
+         */
+        std::string insert(const Session& session);
+
+        /**
+         * @brief Removes and returns the session held under `id`.
+         *
+         * @param id
+         * @param issued If given, set to whether this cache issued the id, whether or not its session is still held.
+         * @return std::optional<Session> The session, or nothing if the id is unknown, already redeemed, or has expired.
+         */
+        std::optional<Session> take(const std::string& id, bool* issued = nullptr);
+
+        /**
+         * @brief Sets the most sessions to hold. 0 disables the cache. Shrinking it evicts sessions as they are next added.
+         *
+         * @param n
+         */
+        void set_capacity(size_t n);
+
+        /**
+         * @brief Sets how long sessions added from now on are held for.
+         *
+         * @param s
+         */
+        void set_ttl(std::chrono::seconds s);
+
+        std::chrono::seconds get_ttl() const;
+
+        /**
+         * @brief Removes every session.
+         */
+        void clear();
+
+        /**
+         * @brief Get a snapshot of the cache's counters.
+         *
+         * @return Stats
+         */
+        Stats get_stats();
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef INCLUDE_SESSION_TICKET_H
+#define INCLUDE_SESSION_TICKET_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <optional>
+#include "record-cipher.hpp"
+#include "socket.hpp"
+
+namespace serv {
+
+/**
+ * @brief Derives `len` bytes from `secret` with HKDF-SHA256, binding them to `label`.
+ *
+ * @param secret The input keying material.
+ * @param salt Optional; may be empty.
+ * @param label What the bytes are for, so that keys derived for different uses never coincide.
+ * @param len
+ * @return std::vector<char> The derived bytes, or an empty vector on failure.
+ */
+std::vector<char> hkdf(const std::vector<char>& secret, const std::vector<char>& salt, const std::string& label, size_t len);
+
+/**
+ * @brief What a peer keeps of a completed handshake so that it can resume the session on a later connection, skipping the
+ * key exchange.
+ */
+struct Session {
+    std::vector<char> secret;                           // The resumption secret, from which each connection's keys are derived.
+    ChannelCipher cipher = ChannelCipher::AES_256_CBC;
+    Framing framing = Framing::NULL_DELIMITED;
+    std::chrono::system_clock::time_point expires;      // After which the host no longer accepts the ticket.
+    std::string ticket;                                 // Opaque; presented to the host to resume the session.
+    std::string id;                                     // Names the session in the host's SessionCache, if it has one.
+
+    inline bool is_expired() const noexcept {
+        return std::chrono::system_clock::now() >= expires;
+    }
+};
+
+/**
+ * @brief Issues and redeems the session tickets of a host, so that it keeps no state per session.
+ *
+ * A ticket is the session's state sealed with AES-256-GCM under a key only the host knows: a random nonce, the cipher text
+ * and the tag. Keys are generated at random on construction and by rotate(); tickets sealed under the key before the last
+ * rotation are still redeemed, so that rotating does not cut off every session at once.
+ */
+class SessionTickets {
+    public:
+        static constexpr size_t KEY_SIZE = 32;
+        static constexpr size_t NONCE_SIZE = 12;
+        static constexpr size_t TAG_SIZE = 16;
+        static constexpr std::chrono::seconds DEFAULT_LIFETIME { 3600 };
+
+    private:
+        mutable std::mutex key_mutex;
+        std::vector<char> key;
+        std::vector<char> prev_key;
+        std::chrono::seconds lifetime;
+
+        /**
+         * @brief Opens a ticket sealed under `k`.
+         *
+         * @return std::optional<std::string> The serialized state, or nothing if the ticket was not sealed under `k`.
+         */
+        static std::optional<std::string> open(const std::vector<char>& k, const std::string& ticket);
+
+    public:
+        SessionTickets(std::chrono::seconds lifetime = DEFAULT_LIFETIME);
+        SessionTickets(SessionTickets& t) = delete;
+        SessionTickets(SessionTickets&& t) = delete;
+
+        /**
+         * @brief Seals the secret, cipher and framing of `session` into a ticket, valid for the lifetime from now.
+         *
+         * @param session
+         * @return std::string The ticket, or an empty string on failure.
+         */
+        std::string issue(const Session& session) const;
+
+        /**
+         * @brief Opens a ticket issued by this host.
+         *
+         * @param ticket
+         * @return std::optional<Session> The session, without its ticket, or nothing if the ticket was tampered with, has
+         * expired, or was sealed under a key since rotated out.
+         */
+        std::optional<Session> redeem(const std::string& ticket) const;
+
+        /**
+         * @brief Replaces the ticket key with a new one. Tickets issued under the previous key are still redeemed; those issued
+         * under any older key are not.
+         */
+        void rotate();
+
+        /**
+         * @brief Sets how long tickets issued from now on are accepted for.
+         *
+         * @param s
+         */
+        void set_lifetime(std::chrono::seconds s);
+
+        std::chrono::seconds get_lifetime() const;
+};
+
+}
+
+#endif
\ No newline at end of file
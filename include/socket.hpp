@@ -7,6 +7,8 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <vector>
+#include <deque>
+#include <utility>
 #include <cerrno>
 #include <mutex>
 #include "circular-buffer.hpp"
@@ -15,6 +17,18 @@ using namespace libev;
 
 namespace serv {
 
+/**
+ * @brief How messages are delimited on a connection's stream.
+ * 
+ *  - NULL_DELIMITED: each message is followed by a null byte. Messages cannot contain null bytes.
+ * 
+ *  - LENGTH_PREFIXED: each message is preceded by its length, as a base-128 varint. Messages may hold arbitrary bytes.
+ */
+enum class Framing : uint32_t {
+    NULL_DELIMITED = 0,
+    LENGTH_PREFIXED = 1,
+};
+
 /**
  * @brief Manages a Berkeley socket. 
  * [This should probably have been encapsulated in its own wrapper library, but it works, and there's not much memory-management going on]
@@ -28,11 +42,81 @@ class Socket {
         sockaddr_storage addr;
         socklen_t addr_len;
         CircularBuf buf;
-        std::mutex recv_mux;
+        std::recursive_mutex recv_mux;  // Always taken before buf_mux, never after it.
         std::mutex send_mux;
-        std::mutex buf_mux;
+        std::recursive_mutex buf_mux;
+        std::deque<std::vector<char>> outbound;
+        size_t outbound_offset;
+        size_t outbound_bytes;
+        size_t low_watermark;
+        size_t high_watermark;
+        bool congested;
+        Framing framing;
+        uint32_t frame_size;
+        bool frame_pending;
+
+        /**
+         * @brief Writes as much of the outbound queue as the socket will take, gathering queued buffers into each call.
+         * Expects send_mux to be held.
+         *
+         * @return bool False if the socket reported an error other than EAGAIN.
+         */
+        bool flush_outbound();
+
+        /**
+         * @brief Updates the congestion state from the number of bytes pending. Expects send_mux to be held.
+         */
+        void update_congestion() noexcept;
+
+        /**
+         * @brief Wraps a message for the wire according to the socket's framing mode.
+         * 
+         * @param data The message
+         * @param len The length of the message
+         * @param terminate Whether to null-terminate the message, if null-delimited.
+         * @return std::vector<char> The framed message.
+         */
+        std::vector<char> frame(const char* data, size_t len, bool terminate) const;
+
+        /**
+         * @brief Writes the bytes that go before a message of `len` bytes according to the socket's framing mode, so that
+         * callers can frame a message without copying it. See frame()
+         * 
+         * @param len The length of the message
+         * @param prefix Where to write the prefix, at least MAX_FRAME_PREFIX bytes.
+         * @return uint32_t The length of the prefix; 0 if null-delimited.
+         */
+        uint32_t frame_prefix(size_t len, char* prefix) const noexcept;
+
+        /**
+         * @brief Locates the next length-prefixed message in the buffer. The prefix is decoded (and released) once; until
+         * the rest of the message arrives, each call only compares the buffered size to the length still needed.
+         * A prefix announcing more than the buffer can ever hold is rejected as malformed, and the buffer cleared.
+         * Expects buf_mux to be held.
+         * 
+         * @param view Set to the message, in place.
+         * @return bool Whether the message is complete. It may be empty.
+         */
+        bool next_frame(CircularBuf::View& view);
+
+        /**
+         * @brief Locates the next message in the buffer, according to the socket's framing mode, without copying it.
+         * Expects buf_mux to be held.
+         * 
+         * @param view Set to the message, in place.
+         * @param n Set to the number of bytes to consume once the message is processed; may be 0 for an empty frame, whose
+         * prefix has already been released.
+         * @return bool Whether a complete message was found. It may be empty.
+         */
+        bool next_message(CircularBuf::View& view, uint32_t& n);
 
     public:
+        static constexpr size_t DEFAULT_LOW_WATERMARK = 64 * 1024;
+        static constexpr size_t DEFAULT_HIGH_WATERMARK = 256 * 1024;
+        static constexpr uint32_t DEFAULT_BUFFER_LIMIT = 1024 * 1024;
+        static constexpr int DEFAULT_BACKLOG = SOMAXCONN;
+        static constexpr size_t MAX_FRAME_PREFIX = 5;
+
         Socket();
         Socket(Socket& sock);
         Socket(Socket&& sock);
@@ -52,9 +136,11 @@ class Socket {
          * @param family Protocol family for socket
          * @param socktype Socket type
          * @param flags Input flags
+         * @param reuseport Whether to set SO_REUSEPORT, so that several sockets may bind and listen on the same port.
+         * @param backlog The length of the queue of connections waiting to be accepted. The kernel may cap it.
          * @return bool The success or failure of the attempt to bind to the port. 
          */
-        bool try_listen(const std::string& port, int family, int socktype, int flags);
+        bool try_listen(const std::string& port, int family, int socktype, int flags, bool reuseport = false, int backlog = DEFAULT_BACKLOG);
 
         /**
          * @brief Attempts to listen for TCP IPv4 & IPv6 connections. 
@@ -76,12 +162,21 @@ class Socket {
         bool try_connect(const std::string& host, const std::string& port, bool nonblocking = true);
 
         /**
-         * @brief Attempts to accept a new connection. See man accept.
+         * @brief Attempts to accept a new connection, non-blocking and close-on-exec. See man accept4.
          * 
-         * @return bool The success or failure of the call to accept().
+         * @return bool The success or failure of the call to accept4(). Fails silently, with errno set to EAGAIN, once no
+         * connections are left waiting.
          */
         bool try_accept(Socket& socket);
 
+        /**
+         * @brief For a listening socket, get the number of connections waiting to be accepted and the most the kernel will
+         * queue before it starts dropping them. See man tcp, TCP_INFO.
+         * 
+         * @return std::pair<uint32_t, uint32_t> { pending, backlog }, or { 0, 0 } if the socket is not listening.
+         */
+        std::pair<uint32_t, uint32_t> get_accept_queue() const;
+
         /**
          * @brief Returns address host information, if the socket is managing an accepted connection.
          * See man getaddrinfo
@@ -102,43 +197,122 @@ class Socket {
          * 
          * @param write_cb The callback to pass to the buffer's write function. See Buffer<T>::write()
          * @param arg The arg to pass in for access within the callback
-         * @param len If non-zero, recvfrom will block until len bytes are read.
+         * @param len If non-zero, the most bytes to pass to the callback.
          * 
          * @return std::pair<int, bool> The number of bytes read (-1 indicates an error) and whether the buffer has space remaining.
          */
         std::pair<int32_t, uint32_t> try_recv(uint32_t (*write_cb) (char* dest, uint32_t n, void* data) noexcept, void* arg, uint32_t len = 0);
 
         /**
-         * @brief Attempts to read available data from the socket stream into a buffer. Uses a default zero-copy callback to write to the buffer
-         * See man recvfrom
+         * @brief Attempts to read available data from the socket stream into a buffer, passing all of the buffer's free
+         * segments to the callback at once. See CircularBuf::write_vectored()
          * 
-         * @param len If non-zero, recvfrom will block until len bytes are read.
+         * @param read_cb The callback to pass to the buffer's write_vectored function.
+         * @param arg The arg to pass in for access within the callback
+         * @param len If non-zero, the most bytes to read.
+         * 
+         * @return std::pair<int, bool> The number of bytes read (-1 indicates an error) and the remaining space in the buffer.
+         */
+        std::pair<int32_t, uint32_t> try_recv(uint32_t (*read_cb) (iovec* iov, int iovcnt, void* data) noexcept, void* arg, uint32_t len = 0);
+
+        /**
+         * @brief Attempts to read available data from the socket stream into a buffer. Uses a default zero-copy callback
+         * that fills both of the buffer's free segments with a single recvmsg.
+         * See man recvmsg
+         * 
+         * @param len If non-zero, the most bytes to read. recvmsg returns whatever is available up to len, and does not wait
+         * for all of it.
          * 
          * @return std::pair<int, bool> The number of bytes read (-1 indicates an error) and the remaining space in the buffer.
          */
         std::pair<int32_t, uint32_t> try_recv(uint32_t len = 0);
         
         /**
-         * @brief Attempts to send the bytes stored in data over the network.
+         * @brief Get the framing mode used by read_buffer() and try_send(const std::string&).
+         */
+        inline Framing get_framing() const noexcept {
+            return framing;
+        }
+
+        /**
+         * @brief Sets the framing mode used by read_buffer() and try_send(const std::string&). See Framing
+         */
+        void set_framing(Framing f);
+
+        /**
+         * @brief Replaces the receive buffer with one of the same capacity, laid out according to `backend`.
+         * With CircularBuf::Backend::MIRRORED, each receive is a single syscall and every message is contiguous in memory.
+         * 
+         * @param backend 
+         * @return bool False if the buffer still holds unread data, in which case it is left as is.
+         */
+        bool set_buffer_backend(CircularBuf::Backend backend);
+
+        /**
+         * @brief Sets the most the receive buffer may hold. By default, the buffer is pooled: it holds no memory while
+         * empty and grows on demand up to this limit, DEFAULT_BUFFER_LIMIT unless set. Other backends allocate it up front.
+         * 
+         * @param limit Must be a power of 2
+         * @return bool False if the buffer still holds unread data, in which case it is left as is.
+         */
+        bool set_buffer_limit(uint32_t limit);
+
+        /**
+         * @brief Attempts to send the bytes stored in data over the network, framed according to the socket's framing mode.
          * See man send
          *
+         * If the socket would block, whatever could not be written is kept in the outbound queue, to be written by try_flush()
+         * once the socket is writable. Data is always sent in the order it was passed to try_send().
+         *
          * @param data The data to send 
-         * @param terminate Whether to include the null-terminator, default is true.
-         * @return bool The success or failure of the attempt to send all the data. 
+         * @param terminate Whether to include the null-terminator, if null-delimited. Default is true.
+         * @return bool False if the data could not be sent or queued.
          */
         bool try_send(const std::string& data, bool terminate=true);
 
         /**
-         * @brief Attempts to send the bytes stored in data over the network.
+         * @brief Attempts to send the bytes stored in data over the network, as they are.
          * See man send
          * 
          * @param data The data to send
-         * @return bool The success or failure of the attempt to send all the data. 
+         * @return bool False if the data could not be sent or queued.
          */
         bool try_send(const std::vector<char>& data);
 
         bool try_send(const std::vector<char>& data, ssize_t send(int, const void *, size_t, int));
 
+        /**
+         * @brief Writes as much of the outbound queue as the socket will currently take.
+         * See man sendmsg
+         * 
+         * @return bool False if an error other than EAGAIN occurred.
+         */
+        bool try_flush();
+
+        /**
+         * @brief Whether any data is waiting in the outbound queue, i.e. whether to wait for the socket to become writable.
+         */
+        bool has_pending();
+
+        /**
+         * @brief The number of bytes waiting in the outbound queue.
+         */
+        size_t get_pending_bytes();
+
+        /**
+         * @brief Whether producers should hold off sending. Becomes true once more than the high watermark is pending,
+         * and stays true until the queue has drained to the low watermark.
+         */
+        bool is_congested();
+
+        /**
+         * @brief Sets the outbound queue watermarks. See is_congested()
+         * 
+         * @param low The number of pending bytes at or below which the socket stops being congested.
+         * @param high The number of pending bytes above which the socket becomes congested.
+         */
+        void set_watermarks(size_t low, size_t high);
+
         /**
          * @brief Retrieves data from the buffer (FIFO) up to the first instance of delim.
          * 
@@ -156,12 +330,44 @@ class Socket {
         std::vector<char> read_buffer(std::string delim);
 
         /**
-         * @brief Retrieves data from the buffer (FIFO) up to the first null-terminator.
+         * @brief Passes the next message to `f` as a view of the buffer, without copying it, then releases the message.
+         * Lets callers parse or decrypt straight from the buffer. The view is only valid for the duration of the call.
          * 
-         * @return std::string The message, or an empty string if a null-terminator is not found.
+         * @tparam F (const CircularBuf::View& view)
+         * @param f 
+         * @return bool Whether a complete message was found.
+         */
+        template <typename F>
+        bool read_message(F&& f) {
+            std::lock_guard lock { buf_mux };
+            CircularBuf::View view {};
+            uint32_t n = 0;
+
+            if (!next_message(view, n)) {
+                return false;
+            }
+
+            f(static_cast<const CircularBuf::View&>(view));
+            buf.consume(n);
+
+            return true;
+        }
+
+        /**
+         * @brief Retrieves the next message from the buffer (FIFO), according to the socket's framing mode.
+         * 
+         * @return std::string The message, or an empty string if no complete message has been received.
          */
         std::string read_buffer();
 
+        /**
+         * @brief Like read_buffer(), but tells an empty message apart from no message at all.
+         * 
+         * @param data Set to the message.
+         * @return bool Whether a complete message was found.
+         */
+        bool try_read_buffer(std::string& data);
+
         /**
          * @brief Empties and returns the entire content of the buffer.
          * 
@@ -0,0 +1,127 @@
+#ifndef INCLUDE_TASK_H
+#define INCLUDE_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace serv {
+
+/**
+ * @brief A move-only, type-erased `void()` callable.
+ *
+ * Callables of up to INLINE_SIZE bytes (e.g. a lambda capturing a few pointers, a shared_ptr and a string) are stored
+ * in place, so that wrapping them does not allocate. Larger callables fall back to the heap.
+ */
+class Task {
+    public:
+        static constexpr size_t INLINE_SIZE = 64;
+
+    private:
+        struct VTable {
+            void (*invoke)(void* storage);
+            void (*move)(void* dest, void* src) noexcept;
+            void (*destroy)(void* storage) noexcept;
+        };
+
+        template <typename F>
+        static constexpr bool is_inline = sizeof(F) <= INLINE_SIZE
+            && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<F>;
+
+        template <typename F>
+        static constexpr VTable inline_vtable {
+            [] (void* storage) {
+                (*static_cast<F*>(storage))();
+            },
+            [] (void* dest, void* src) noexcept {
+                new (dest) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            },
+            [] (void* storage) noexcept {
+                static_cast<F*>(storage)->~F();
+            },
+        };
+
+        template <typename F>
+        static constexpr VTable heap_vtable {
+            [] (void* storage) {
+                (**static_cast<F**>(storage))();
+            },
+            [] (void* dest, void* src) noexcept {
+                *static_cast<F**>(dest) = *static_cast<F**>(src);
+            },
+            [] (void* storage) noexcept {
+                delete *static_cast<F**>(storage);
+            },
+        };
+
+        alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+        const VTable* vtable = nullptr;
+
+        void reset() noexcept {
+            if (vtable != nullptr) {
+                vtable->destroy(storage);
+                vtable = nullptr;
+            }
+        }
+
+    public:
+        Task() noexcept = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+        Task(F&& f) {
+            using Fn = std::decay_t<F>;
+
+            if constexpr (is_inline<Fn>) {
+                new (storage) Fn(std::forward<F>(f));
+                vtable = &inline_vtable<Fn>;
+            }
+            else {
+                *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+                vtable = &heap_vtable<Fn>;
+            }
+        }
+
+        Task(Task&& task) noexcept:
+            vtable { task.vtable }
+        {
+            if (vtable != nullptr) {
+                vtable->move(storage, task.storage);
+                task.vtable = nullptr;
+            }
+        }
+
+        Task& operator=(Task&& task) noexcept {
+            if (this != &task) {
+                reset();
+
+                if ((vtable = task.vtable) != nullptr) {
+                    vtable->move(storage, task.storage);
+                    task.vtable = nullptr;
+                }
+            }
+
+            return *this;
+        }
+
+        Task(const Task& task) = delete;
+        Task& operator=(const Task& task) = delete;
+
+        ~Task() {
+            reset();
+        }
+
+        void operator()() {
+            vtable->invoke(storage);
+        }
+
+        explicit operator bool() const noexcept {
+            return vtable != nullptr;
+        }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -3,29 +3,99 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <functional>
+#include <tuple>
 #include <thread>
 #include <future>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include "logger.hpp"
+#include "task.hpp"
+#include "future.hpp"
 
 namespace serv {
 
 class ThreadPool {
+    public:
+        /**
+         * @brief How queued work is distributed between the pool threads.
+         * 
+         *  - SHARED_QUEUE: a single FIFO queue behind a single lock, shared by every thread.
+         * 
+         *  - WORK_STEALING: each thread owns a local deque. Work enqueued from a pool thread goes to that thread's deque,
+         * work enqueued from outside is spread round-robin, and idle threads steal from the others.
+         */
+        enum class Scheduler {
+            SHARED_QUEUE,
+            WORK_STEALING,
+        };
+
     private:
+        /**
+         * @brief How long an idle thread waits for work that is counted as pending but is yet to land in a deque.
+         */
+        static constexpr std::chrono::microseconds STEAL_BACKOFF { 50 };
+
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> deque;
+        };
+
+        static thread_local ThreadPool* current_pool;
+        static thread_local unsigned current_worker;
+
         std::mutex queue_mutex;
-        std::queue<std::function<void()>> queue;
+        std::queue<Task> queue;
         std::condition_variable condition;
         std::vector<std::future<void>> thread_futures;
         std::vector<std::thread> pool;
-        bool run;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> pending;
+        std::atomic<unsigned> sleepers;
+        std::atomic<unsigned> next_worker;
+        std::atomic<bool> run;
+        Scheduler scheduler;
         unsigned n;
 
+        /**
+         * @brief Hands a task to the scheduler; wakes a sleeping thread if there is one.
+         * 
+         * @return bool False if the pool has been stopped, in which case the task is dropped.
+         */
+        bool push(Task&& task);
+
+        void shared_queue_loop(std::promise<void> p);
+
+        void work_stealing_loop(unsigned i, std::promise<void> p);
+
+        /**
+         * @brief Take a task from the back of the worker's own deque.
+         */
+        bool pop(unsigned i, Task& task);
+
+        /**
+         * @brief Take a task from the front of another worker's deque.
+         * 
+         * @param wait Whether to wait on a worker whose deque is locked, rather than pass it over.
+         */
+        bool steal(unsigned i, Task& task, bool wait);
+
     public:
         ThreadPool();
         ThreadPool(unsigned n);
+
+        /**
+         * @brief Create a thread pool of `n` threads using the given scheduler. If `n` is 0, sizes the pool to the hardware.
+         * 
+         * @param n 
+         * @param scheduler 
+         */
+        ThreadPool(unsigned n, Scheduler scheduler);
         ThreadPool(ThreadPool& pool) = delete;
         ThreadPool(ThreadPool&& pool) = delete;
         ~ThreadPool();
@@ -37,21 +107,73 @@ class ThreadPool {
          * @tparam Args The function arguments
          * @param f The function
          * @param args The arguments to execute the function with.
+         * @return bool False if the pool has been stopped, in which case the function is dropped without being executed.
          */
         template <typename F, typename... Args>
-        void enqueue(F&& f, Args&& ...args) {
-            {
-                std::lock_guard lock { queue_mutex };
+        bool enqueue(F&& f, Args&& ...args) {
+            return push(make_task(std::forward<F>(f), std::forward<Args>(args)...));
+        }
 
-                if (run) {
-                    queue.emplace([f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)] () mutable { 
-                        std::apply(std::move(f), std::move(args));
-                    });
-                }
+        /**
+         * @brief Like enqueue(), but returns a Future of the function's result. Continuations can be chained onto it with
+         * Future::then() and when_all(), which are scheduled onto this pool once the result is ready.
+         * 
+         * @tparam F The function type
+         * @tparam Args The function arguments
+         * @param f The function
+         * @param args The arguments to execute the function with.
+         * @return Future of the function's result. If the pool has been stopped, the function is dropped and the future
+         * holds a std::future_error with std::future_errc::broken_promise.
+         */
+        template <typename F, typename... Args>
+        auto submit(F&& f, Args&& ...args) -> Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+            using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+
+            Promise<R> promise { this };
+            auto future = promise.get_future();
+
+            auto pushed = push(make_task([promise, f = std::forward<F>(f)] (auto&& ...args) mutable {
+                promise.fulfill(std::move(f), std::forward<decltype(args)>(args)...);
+            }, std::forward<Args>(args)...));
+
+            if (!pushed) {
+                promise.abandon();
             }
 
-            // Notify some waiting thread that there is available work in the queue.
-            condition.notify_one();
+            return future;
+        }
+
+        /**
+         * @brief Pass many tasks to the thread pool at once, under a single synchronization per queue touched.
+         * 
+         * The tasks are moved out and the vector is cleared, keeping its capacity so that it can be refilled without allocating.
+         * 
+         * @param tasks 
+         * @return bool False if the pool has been stopped, in which case the tasks are left in the vector, for the caller to
+         * run or drop.
+         */
+        bool enqueue_batch(std::vector<Task>& tasks);
+
+        /**
+         * @brief Bind a function and its arguments into a Task. Functions without arguments are stored as they are;
+         * otherwise the arguments are captured alongside them.
+         * 
+         * @tparam F The function type
+         * @tparam Args The function arguments
+         * @param f The function
+         * @param args The arguments to execute the function with.
+         * @return Task 
+         */
+        template <typename F, typename... Args>
+        static Task make_task(F&& f, Args&& ...args) {
+            if constexpr (sizeof...(Args) == 0) {
+                return Task(std::forward<F>(f));
+            }
+            else {
+                return Task([f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)] () mutable { 
+                    std::apply(std::move(f), std::move(args));
+                });
+            }
         }
 
         /**
@@ -69,6 +191,79 @@ class ThreadPool {
         inline int size() const {
             return n;
         }
+
+        inline bool is_running() const {
+            return run;
+        }
+
+        inline Scheduler get_scheduler() const {
+            return scheduler;
+        }
+};
+
+/**
+ * @brief Serializes work onto a ThreadPool. Tasks posted to the same strand run in the order they were posted and never
+ * concurrently, while tasks posted to different strands are free to run in parallel.
+ * 
+ * At most one task per strand is queued on the pool at a time; it drains a bounded batch of the strand's work before
+ * handing the thread back. If no pool is given, posted tasks run inline on the calling thread.
+ */
+class Strand {
+    private:
+        static constexpr int BATCH_SIZE = 16;
+        ThreadPool* pool;
+        std::mutex queue_mutex;
+        std::queue<Task> queue;
+        std::condition_variable idle;
+        bool running;
+
+        void schedule();
+
+        void drain();
+
+    public:
+        Strand(ThreadPool* pool = nullptr);
+        Strand(Strand& strand) = delete;
+        Strand(Strand&& strand) = delete;
+        ~Strand();
+
+        /**
+         * @brief Post a function to the strand, to later be executed on the pool after all previously posted work.
+         * 
+         * @tparam F The function type
+         * @tparam Args The function arguments
+         * @param f The function
+         * @param args The arguments to execute the function with.
+         */
+        template <typename F, typename... Args>
+        void post(F&& f, Args&& ...args) {
+            bool start = false;
+
+            {
+                std::lock_guard lock { queue_mutex };
+
+                queue.emplace(ThreadPool::make_task(std::forward<F>(f), std::forward<Args>(args)...));
+
+                if (!running) {
+                    running = start = true;
+                }
+            }
+
+            if (start) {
+                schedule();
+            }
+        }
+
+        /**
+         * @brief Blocks until all work posted to the strand so far has finished executing.
+         */
+        void join();
+
+        /**
+         * @brief Whether all work posted to the strand so far has finished executing, without blocking.
+         * The draining thread stays pinned to its Epoch until it has let go of the strand entirely.
+         */
+        bool is_idle();
 };
 
 }
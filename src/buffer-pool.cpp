@@ -0,0 +1,87 @@
+#include "buffer-pool.hpp"
+
+using namespace serv;
+
+BufferPool::BufferPool():
+    cached_bytes { 0 },
+    used_bytes { 0 }
+{}
+
+BufferPool::~BufferPool() {
+    for (uint32_t i = 0; i < classes.size(); ++i) {
+        if ((1ull << i) < SLAB_SIZE) {
+            continue;
+        }
+
+        for (auto block : classes[i].free) {
+            delete[] block;
+        }
+    }
+}
+
+BufferPool& BufferPool::get() {
+    // Never destroyed, so that buffers released during static destruction still have somewhere to go.
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+uint32_t BufferPool::block_size(uint32_t size) noexcept {
+    if (size <= MIN_BLOCK_SIZE) {
+        return MIN_BLOCK_SIZE;
+    }
+
+    return 1u << (32 - __builtin_clz(size - 1));
+}
+
+BufferPool::SizeClass& BufferPool::get_class(uint32_t size) noexcept {
+    return classes[__builtin_ctz(size)];
+}
+
+char* BufferPool::acquire(uint32_t size) {
+    auto& sc = get_class(size);
+    used_bytes += size;
+
+    {
+        std::lock_guard lock { sc.mutex };
+
+        if (!sc.free.empty()) {
+            auto block = sc.free.back();
+            sc.free.pop_back();
+            cached_bytes -= size;
+
+            return block;
+        }
+
+        if (size < SLAB_SIZE) {
+            auto& slab = sc.slabs.emplace_back(new char[SLAB_SIZE]);
+
+            for (uint32_t offset = size; offset < SLAB_SIZE; offset += size) {
+                sc.free.push_back(slab.get() + offset);
+            }
+
+            cached_bytes += SLAB_SIZE - size;
+            return slab.get();
+        }
+    }
+
+    return new char[size];
+}
+
+void BufferPool::release(char* block, uint32_t size) noexcept {
+    auto& sc = get_class(size);
+    used_bytes -= size;
+
+    {
+        std::lock_guard lock { sc.mutex };
+
+        // Slab blocks cannot be freed individually, so they are always kept.
+        if (size < SLAB_SIZE || (sc.free.size() + 1) * size <= MAX_CACHED_BYTES) {
+            sc.free.push_back(block);
+            cached_bytes += size;
+
+            return;
+        }
+    }
+
+    delete[] block;
+}
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include "byte-search.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERV_BYTE_SEARCH_X86
+#endif
+
+using namespace serv;
+
+namespace {
+
+using FindByte = const char* (*)(const char*, size_t, char) noexcept;
+using FindSeq = const char* (*)(const char*, size_t, const char*, size_t) noexcept;
+
+struct Impl {
+    FindByte find_byte;
+    FindSeq find_seq;
+};
+
+const char* find_byte_scalar(const char* data, size_t n, char c) noexcept {
+    return static_cast<const char*>(std::memchr(data, c, n));
+}
+
+const char* find_seq_scalar(const char* data, size_t n, const char* needle, size_t m) noexcept {
+    for (size_t i = 0; i + m <= n; ++i) {
+        auto p = find_byte_scalar(data + i, n - m + 1 - i, needle[0]);
+
+        if (p == nullptr) {
+            return nullptr;
+        }
+
+        i = p - data;
+
+        if (std::memcmp(p + 1, needle + 1, m - 1) == 0) {
+            return p;
+        }
+    }
+
+    return nullptr;
+}
+
+#ifdef SERV_BYTE_SEARCH_X86
+
+/**
+ * Both vector searches below compare a block of bytes against the delimiter in one instruction and collect the result
+ * as a bitmask, one bit per byte. Multi-byte delimiters compare the first and last bytes of the needle at once, against
+ * two overlapping loads, so that only positions where both match are verified with memcmp.
+ */
+
+__attribute__((target("sse2")))
+const char* find_byte_sse2(const char* data, size_t n, char c) noexcept {
+    const auto needle = _mm_set1_epi8(c);
+    size_t i = 0;
+
+    // Four blocks per iteration, combined so that the common case of no match costs a single branch.
+    for (; i + 64 <= n; i += 64) {
+        auto a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), needle);
+        auto b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16)), needle);
+        auto c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32)), needle);
+        auto d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48)), needle);
+
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) {
+            continue;
+        }
+
+        for (auto block : { a, b, c, d }) {
+            if (uint32_t mask = _mm_movemask_epi8(block)) {
+                return data + i + __builtin_ctz(mask);
+            }
+
+            i += 16;
+        }
+    }
+
+    for (; i + 16 <= n; i += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+
+        if (mask) {
+            return data + i + __builtin_ctz(mask);
+        }
+    }
+
+    for (; i < n; ++i) {
+        if (data[i] == c) {
+            return data + i;
+        }
+    }
+
+    return nullptr;
+}
+
+__attribute__((target("sse2")))
+const char* find_seq_sse2(const char* data, size_t n, const char* needle, size_t m) noexcept {
+    const auto first = _mm_set1_epi8(needle[0]);
+    const auto last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + m - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+        while (mask) {
+            auto p = data + i + __builtin_ctz(mask);
+
+            if (std::memcmp(p + 1, needle + 1, m - 2) == 0) {
+                return p;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return find_seq_scalar(data + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+const char* find_byte_avx2(const char* data, size_t n, char c) noexcept {
+    const auto needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+
+    // Four blocks per iteration, combined so that the common case of no match costs a single branch.
+    for (; i + 128 <= n; i += 128) {
+        auto a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), needle);
+        auto b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32)), needle);
+        auto c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 64)), needle);
+        auto d = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 96)), needle);
+
+        if (_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), _mm256_set1_epi8(-1))) {
+            continue;
+        }
+
+        for (auto block : { a, b, c, d }) {
+            if (uint32_t mask = _mm256_movemask_epi8(block)) {
+                return data + i + __builtin_ctz(mask);
+            }
+
+            i += 32;
+        }
+    }
+
+    for (; i + 32 <= n; i += 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+
+        if (mask) {
+            return data + i + __builtin_ctz(mask);
+        }
+    }
+
+    return find_byte_sse2(data + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+const char* find_seq_avx2(const char* data, size_t n, const char* needle, size_t m) noexcept {
+    const auto first = _mm256_set1_epi8(needle[0]);
+    const auto last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        auto block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + m - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+
+        while (mask) {
+            auto p = data + i + __builtin_ctz(mask);
+
+            if (std::memcmp(p + 1, needle + 1, m - 2) == 0) {
+                return p;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return find_seq_sse2(data + i, n - i, needle, m);
+}
+
+#endif
+
+const Impl impls[] = {
+    { find_byte_scalar, find_seq_scalar },
+#ifdef SERV_BYTE_SEARCH_X86
+    { find_byte_sse2, find_seq_sse2 },
+    { find_byte_avx2, find_seq_avx2 },
+#endif
+};
+
+ByteSearch::Level detect() noexcept {
+#ifdef SERV_BYTE_SEARCH_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return ByteSearch::Level::AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return ByteSearch::Level::SSE2;
+    }
+#endif
+
+    return ByteSearch::Level::SCALAR;
+}
+
+/**
+ * Function-local, so that searches made while other translation units are being initialized still dispatch correctly.
+ */
+std::atomic<const Impl*>& active() noexcept {
+    static std::atomic<const Impl*> impl { &impls[static_cast<size_t>(ByteSearch::get_supported_level())] };
+    return impl;
+}
+
+}
+
+ByteSearch::Level ByteSearch::get_supported_level() noexcept {
+    static const Level supported = detect();
+    return supported;
+}
+
+ByteSearch::Level ByteSearch::get_level() noexcept {
+    return static_cast<Level>(active().load(std::memory_order_relaxed) - impls);
+}
+
+ByteSearch::Level ByteSearch::set_level(Level level) noexcept {
+    level = std::min(level, get_supported_level());
+    active().store(&impls[static_cast<size_t>(level)], std::memory_order_relaxed);
+
+    return level;
+}
+
+const char* ByteSearch::find(const char* data, size_t n, char c) noexcept {
+    return active().load(std::memory_order_relaxed)->find_byte(data, n, c);
+}
+
+const char* ByteSearch::find(const char* data, size_t n, const char* needle, size_t m) noexcept {
+    if (m == 0 || m > n) {
+        return nullptr;
+    }
+
+    auto impl = active().load(std::memory_order_relaxed);
+
+    if (m == 1) {
+        return impl->find_byte(data, n, needle[0]);
+    }
+
+    return impl->find_seq(data, n, needle, m);
+}
\ No newline at end of file
@@ -1,8 +1,51 @@
+#include <sys/mman.h>
+#include <unistd.h>
 #include <cstring>
 #include "circular-buffer.hpp"
+#include "byte-search.hpp"
+#include "error-codes.hpp"
+#include "buffer-pool.hpp"
 
 namespace serv {
 
+namespace {
+
+/**
+ * @brief Maps a memfd twice, back to back, so that writing past the end of the first mapping lands at the start of it.
+ *
+ * @param capacity A multiple of the page size.
+ * @return char* The start of the first mapping, or nullptr on failure.
+ */
+char* map_mirrored(uint32_t capacity) noexcept {
+    auto fd = memfd_create("serv-circular-buffer", MFD_CLOEXEC);
+
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    char* base = nullptr;
+
+    if (ftruncate(fd, capacity) == 0) {
+        // Reserve the whole range first, so that nothing else can be mapped between the two halves.
+        auto reserved = mmap(nullptr, 2ull * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (reserved != MAP_FAILED) {
+            base = static_cast<char*>(reserved);
+
+            if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+                || mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(base, 2ull * capacity);
+                base = nullptr;
+            }
+        }
+    }
+
+    close(fd);
+    return base;
+}
+
+}
+
 uint32_t CircularBuf::get_capacity(uint32_t c) const noexcept {
     if (c & (c - 1)) {
         Logger::get().error("buffer: constructor: capacity not power of 2, defaulting to 1024");
@@ -16,30 +59,87 @@ uint32_t CircularBuf::mask(uint64_t i) const noexcept {
     return static_cast<uint32_t>(i & (capacity - 1));
 }
 
-bool CircularBuf::push(char b) noexcept {
-    if (full()) {
-        return false;
+void CircularBuf::allocate() {
+    if (backend == Backend::POOLED) {
+        buf = capacity ? BufferPool::get().acquire(capacity) : nullptr;
+        return;
+    }
+
+    if (backend == Backend::MIRRORED) {
+        capacity = std::max(capacity, static_cast<uint32_t>(sysconf(_SC_PAGESIZE)));
+
+        if ((buf = map_mirrored(capacity)) != nullptr) {
+            limit = capacity;
+            return;
+        }
+
+        Logger::get().error(ERR_CIRCULAR_BUFFER_MIRROR_FAILED);
+        Logger::get().error("buffer: mirror: " + std::string(strerror(errno)));
+        backend = Backend::HEAP;
     }
 
-    buf[mask(w++)] = b;
-    return true;
+    buf = new char[capacity];
+    limit = capacity;
 }
 
-bool CircularBuf::shift(char& b) noexcept {
-    if (empty()) {
-        return false;
+void CircularBuf::release() noexcept {
+    if (buf == nullptr) {
+        return;
     }
 
-    b = buf[mask(r++)];
-    return true;
+    if (backend == Backend::POOLED) {
+        BufferPool::get().release(buf, capacity);
+    }
+    else if (backend == Backend::MIRRORED) {
+        munmap(buf, 2ull * capacity);
+    }
+    else {
+        delete[] buf;
+    }
+
+    buf = nullptr;
+}
+
+void CircularBuf::grow(uint32_t n) {
+    if (backend != Backend::POOLED || n <= capacity) {
+        return;
+    }
+
+    // Double at least, so that the cost of copying into each new block is amortized.
+    auto next = BufferPool::block_size(static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(n, 2ull * capacity), limit)));
+    auto block = BufferPool::get().acquire(next);
+    auto n_bytes = size();
+
+    view().copy_to(block);
+    release();
+
+    buf = block;
+    capacity = next;
+    r = 0;
+    w = n_bytes;
+}
+
+void CircularBuf::settle() noexcept {
+    if (backend == Backend::POOLED && empty() && !held && buf != nullptr) {
+        release();
+        capacity = 0;
+        r = w = 0;
+    }
 }
 
-CircularBuf::CircularBuf(uint32_t capacity): 
+CircularBuf::CircularBuf(uint32_t capacity, Backend backend): 
     r { 0 },
     w { 0 },
-    capacity { get_capacity(capacity) }
+    held { 0 },
+    capacity { get_capacity(capacity) },
+    limit { this->capacity },
+    backend { backend }
 {   
-    buf = new char[capacity];
+    if (backend == Backend::POOLED) {
+        this->capacity = 0;
+    }
+
+    allocate();
 }
 
 CircularBuf::CircularBuf(std::vector<char>& data, uint32_t capacity):
@@ -57,50 +157,85 @@ CircularBuf::CircularBuf(std::string& data, uint32_t capacity):
 CircularBuf::CircularBuf(const CircularBuf& c):
     r { c.r },
     w { c.w },
+    held { c.held },
     capacity { c.capacity },
-    buf { new char[c.capacity] }
+    limit { c.limit },
+    backend { c.backend }
 {
-    std::memcpy(buf, c.buf, c.capacity);
+    allocate();
+
+    if (capacity) {
+        std::memcpy(buf, c.buf, capacity);
+    }
 }
 
 CircularBuf::CircularBuf(CircularBuf&& c):
+    buf { c.buf },
     r { c.r },
     w { c.w },
+    held { c.held },
     capacity { c.capacity },
-    buf { c.buf }
+    limit { c.limit },
+    backend { c.backend }
 {
     c.r = 0;
     c.w = 0;
+    c.held = 0;
     c.capacity = 0;
+    c.limit = 0;
     c.buf = nullptr;
 }
 
 CircularBuf& CircularBuf::operator=(const CircularBuf& c) {
+    if (this == &c) {
+        return *this;
+    }
+
+    release();
+
     r = c.r;
     w = c.w;
+    held = c.held;
     capacity = c.capacity;
-    buf = new char[c.capacity];
-    std::memcpy(buf, c.buf, c.capacity);
+    limit = c.limit;
+    backend = c.backend;
+
+    allocate();
+
+    if (capacity) {
+        std::memcpy(buf, c.buf, capacity);
+    }
 
     return *this;
 }
 
 CircularBuf& CircularBuf::operator=(CircularBuf&& c) {
+    if (this == &c) {
+        return *this;
+    }
+
+    release();
+
     r = c.r;
     w = c.w;
     capacity = c.capacity;
+    limit = c.limit;
+    backend = c.backend;
     buf = c.buf;
+    held = c.held;
 
     c.r = 0;
     c.w = 0;
+    c.held = 0;
     c.capacity = 0;
+    c.limit = 0;
     c.buf = nullptr;
 
     return *this;
 }
 
 CircularBuf::~CircularBuf() {
-    delete[] buf;
+    release();
 }
 
 uint32_t CircularBuf::size() const noexcept {
@@ -108,11 +243,11 @@ uint32_t CircularBuf::size() const noexcept {
 }
 
 uint32_t CircularBuf::space() const noexcept {
-    return capacity - size();
+    return limit - size() - held;
 }
 
 bool CircularBuf::full() const noexcept {
-    return capacity == size();
+    return !space();
 }
 
 bool CircularBuf::empty() const noexcept {
@@ -120,46 +255,170 @@ bool CircularBuf::empty() const noexcept {
 }
 
 std::vector<char> CircularBuf::read(uint32_t lim) noexcept {
-    if (lim < 0 || lim > size()) {
-        lim = size();
-    }
+    lim = std::min(lim, size());
 
     std::vector<char> data(lim);
-    uint32_t i = 0;
+    view(lim).copy_to(data.data());
+    r += lim;
+    settle();
 
-    while (i < lim && shift(data[i++]));
+    return data;
+}
 
-    return std::vector<char>(data.begin(), data.begin() + i);
+uint32_t CircularBuf::peek(char* dest, uint32_t n, uint32_t offset) const noexcept {
+    auto v = view(n, offset);
+    v.copy_to(dest);
+
+    return v.size();
 }
 
-std::vector<char> CircularBuf::read_to(char delim) noexcept {
-    std::vector<char> data(size());
-    uint32_t i = 0;
-    bool success;
+CircularBuf::View CircularBuf::view(uint32_t n, uint32_t offset) const noexcept {
+    if (offset >= size()) {
+        return { { buf, 0 }, { buf, 0 } };
+    }
 
-    while ((success = shift(data[i++])) && data[i-1] != delim);
+    n = std::min(n, size() - offset);
 
-    data.resize(i - !success);
-    return data;
+    uint32_t start = mask(r + offset);
+    uint32_t head = backend == Backend::MIRRORED ? n : std::min(n, capacity - start);
+
+    return { { buf + start, head }, { buf, n - head } };
 }
 
-std::vector<char> CircularBuf::read_to(const std::string& delim) noexcept {
-    std::vector<char> data(size());
-    uint32_t nbytes = delim.size(), lim = size(), i = 0;
-    bool success;
+int CircularBuf::span(uint32_t n, uint32_t offset, iovec iov[2]) noexcept {
+    auto v = view(n, offset);
+
+    if (v.empty()) {
+        return 0;
+    }
+
+    // The view only points into this buffer, so handing out its bytes as writable is safe.
+    iov[0] = { const_cast<char*>(v.first.data), v.first.size };
+    iov[1] = { const_cast<char*>(v.second.data), v.second.size };
+
+    return v.contiguous() ? 1 : 2;
+}
+
+void CircularBuf::shift(uint32_t from, uint32_t to, uint32_t n) noexcept {
+    if (from == to) {
+        return;
+    }
+
+    // Copying front to back never overwrites bytes still to be moved, since they only ever move backwards. Each chunk stops at
+    // the wrap point even when mirrored: past it, source and destination may share memory through different addresses, which
+    // memmove cannot see.
+    while (n) {
+        uint32_t src = mask(r + from);
+        uint32_t dst = mask(r + to);
+        uint32_t chunk = std::min({ n, capacity - src, capacity - dst });
+
+        std::memmove(buf + dst, buf + src, chunk);
+
+        from += chunk;
+        to += chunk;
+        n -= chunk;
+    }
+}
+
+void CircularBuf::truncate(uint32_t n) noexcept {
+    held = 0;
+
+    if (n < size()) {
+        w = r + n;
+    }
+
+    settle();
+}
+
+void CircularBuf::hold(uint32_t n) noexcept {
+    n = std::min(n, size());
+
+    w -= n;
+    held += n;
+}
+
+void CircularBuf::unhold() noexcept {
+    w += held;
+    held = 0;
+}
+
+void CircularBuf::View::copy_to(char* dest) const noexcept {
+    if (first.size) {
+        std::memcpy(dest, first.data, first.size);
+    }
 
-    auto test = [nbytes, lim, &delim] (std::vector<char> v, uint32_t from) {
-        if (from + nbytes > lim) {
-            return false;
+    if (second.size) {
+        std::memcpy(dest + first.size, second.data, second.size);
+    }
+}
+
+uint32_t CircularBuf::find(char delim, uint32_t offset) const noexcept {
+    auto v = view(-1, offset);
+
+    if (v.empty()) {
+        return npos;
+    }
+
+    if (auto p = ByteSearch::find(v.first.data, v.first.size, delim)) {
+        return offset + static_cast<uint32_t>(p - v.first.data);
+    }
+
+    if (auto p = ByteSearch::find(v.second.data, v.second.size, delim)) {
+        return offset + v.first.size + static_cast<uint32_t>(p - v.second.data);
+    }
+
+    return npos;
+}
+
+uint32_t CircularBuf::find(const std::string& delim, uint32_t offset) const noexcept {
+    uint32_t n = delim.size();
+    auto v = view(-1, offset);
+
+    if (n == 0 || n > v.size()) {
+        return npos;
+    }
+
+    if (auto p = ByteSearch::find(v.first.data, v.first.size, delim.data(), n)) {
+        return offset + static_cast<uint32_t>(p - v.first.data);
+    }
+
+    // Delimiters straddling the wrap point start in the last n - 1 bytes of the first segment.
+    for (uint32_t i = v.first.size - std::min(v.first.size, n - 1); i < v.first.size; ++i) {
+        uint32_t head = v.first.size - i;
+
+        if (n - head > v.second.size) {
+            break;
         }
 
-        return std::memcmp(delim.c_str(), v.data() + from, nbytes) == 0;
-    };
+        if (std::memcmp(v.first.data + i, delim.data(), head) == 0
+            && std::memcmp(v.second.data, delim.data() + head, n - head) == 0) {
+            return offset + i;
+        }
+    }
 
-    while ((success = shift(data[i++])) && !test(data, i-1));
+    if (auto p = ByteSearch::find(v.second.data, v.second.size, delim.data(), n)) {
+        return offset + v.first.size + static_cast<uint32_t>(p - v.second.data);
+    }
 
-    data.resize(i - !success);
-    return data;
+    return npos;
+}
+
+uint32_t CircularBuf::consume(uint32_t n) noexcept {
+    n = std::min(n, size());
+    r += n;
+    settle();
+
+    return n;
+}
+
+std::vector<char> CircularBuf::read_to(char delim) noexcept {
+    auto i = find(delim);
+    return read(i == npos ? size() : i + 1);
+}
+
+std::vector<char> CircularBuf::read_to(const std::string& delim) noexcept {
+    auto i = find(delim);
+    return read(i == npos ? size() : i + static_cast<uint32_t>(delim.size()));
 }
 
 std::vector<char> CircularBuf::read_from(uint32_t offset) {
@@ -167,49 +426,56 @@ std::vector<char> CircularBuf::read_from(uint32_t offset) {
         return {};
     }
 
-    uint32_t hold = r;
-    r += offset;
-
-    std::vector<char> data = read();
+    uint32_t n = size() - offset;
+    std::vector<char> data(n);
 
-    r = hold;
-    w = r + offset;
+    view(n, offset).copy_to(data.data());
+    truncate(offset);
 
     return data;
 }
 
-uint32_t CircularBuf::write(std::vector<char>& data) {
-    int n = 0;
+uint32_t CircularBuf::write(const char* data, uint32_t n) {
+    unhold();
+    n = std::min(n, space());
+
+    if (!n) {
+        return 0;
+    }
+
+    grow(size() + n);
 
-    while (n < data.size() && push(data[n])) {
-        ++n;
-    };
+    uint32_t _w = mask(w);
+    uint32_t head = backend == Backend::MIRRORED ? n : std::min(n, capacity - _w);
 
+    std::memcpy(buf + _w, data, head);
+    std::memcpy(buf, data + head, n - head);
+
+    w += n;
     return n;
 }
 
+uint32_t CircularBuf::write(std::vector<char>& data) {
+    return write(data.data(), static_cast<uint32_t>(data.size()));
+}
+
 uint32_t CircularBuf::write(std::vector<char>&& data) {
     return write(data);
 }
 
 uint32_t CircularBuf::write(std::string& data) {
-    return write(std::vector<char> { data.begin(), data.end() });
+    return write(data.data(), static_cast<uint32_t>(data.size()));
 }
 
 uint32_t CircularBuf::write(std::string&& data) {
-    return write(std::vector<char> { data.begin(), data.end() });
+    return write(data);
 }
 
-uint32_t CircularBuf::write(uint32_t cb(char* dest, uint32_t n, void* data) noexcept, uint32_t n, void* data) {
-    if (full()) {
-        return 0;
-    }
-
+uint32_t CircularBuf::fill(uint32_t cb(char* dest, uint32_t n, void* data) noexcept, uint32_t n, void* data) {
     uint32_t _r = mask(r), _w = mask(w);
-    n = std::min(n, space());
 
     uint32_t shift;
-    if (_w < _r || !_r) {
+    if (_w < _r || !_r || backend == Backend::MIRRORED) {
         shift = cb(buf + _w, n, data);
         w += shift;
         return shift;
@@ -224,8 +490,79 @@ uint32_t CircularBuf::write(uint32_t cb(char* dest, uint32_t n, void* data) noex
     return shift;
 }
 
+uint32_t CircularBuf::write(uint32_t cb(char* dest, uint32_t n, void* data) noexcept, uint32_t n, void* data) {
+    unhold();
+    n = std::min(n, space());
+    uint32_t total = 0;
+
+    // A pooled buffer grows each time the callback fills the block it has, until it stops or the limit is reached.
+    while (total < n) {
+        grow(size() + 1);
+
+        auto want = std::min(n - total, capacity - size());
+        auto got = fill(cb, want, data);
+
+        total += got;
+
+        if (got < want || backend != Backend::POOLED) {
+            break;
+        }
+    }
+
+    if (!total) {
+        settle();
+    }
+
+    return total;
+}
+
+uint32_t CircularBuf::write_vectored(uint32_t cb(iovec* iov, int iovcnt, void* data) noexcept, uint32_t n, void* data) {
+    unhold();
+    n = std::min(n, space());
+    uint32_t total = 0;
+
+    while (total < n) {
+        grow(size() + 1);
+
+        auto want = std::min(n - total, capacity - size());
+        uint32_t _w = mask(w);
+        uint32_t head = backend == Backend::MIRRORED ? want : std::min(want, capacity - _w);
+
+        iovec iov[2] = {
+            { buf + _w, head },
+            { buf, want - head },
+        };
+
+        auto got = cb(iov, want > head ? 2 : 1, data);
+
+        w += got;
+        total += got;
+
+        if (got < want || backend != Backend::POOLED) {
+            break;
+        }
+    }
+
+    if (!total) {
+        settle();
+    }
+
+    return total;
+}
+
 void CircularBuf::clear() {
-    std::memset(buf, 0, capacity);
+    held = 0;
+
+    if (backend == Backend::POOLED) {
+        r = w = 0;
+        settle();
+        return;
+    }
+
+    if (buf != nullptr) {
+        std::memset(buf, 0, capacity);
+    }
+
     r = w = 0;
 }
 
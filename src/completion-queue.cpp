@@ -0,0 +1,88 @@
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include "completion-queue.hpp"
+#include "logger.hpp"
+#include "error-codes.hpp"
+
+using namespace libev;
+using namespace serv;
+
+event_callback_fn CompletionQueue::wake_callback = [] (evutil_socket_t fd, short flags, void* arg) {
+    ((CompletionQueue*)arg)->flush();
+};
+
+CompletionQueue::CompletionQueue(EventBase* base):
+    base { base },
+    efd { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) },
+    signalled { false }
+{
+    if (efd == -1) {
+        Logger::get().error(ERR_COMPLETION_QUEUE_EVENTFD_FAILED);
+        Logger::get().error("server: completion-queue: eventfd: " + std::string(strerror(errno)));
+        return;
+    }
+
+    event = std::make_unique<Event>(base->new_event(efd, EV_READ|EV_PERSIST, wake_callback, this));
+
+    if (!event->add()) {
+        Logger::get().error(ERR_COMPLETION_QUEUE_EVENTFD_FAILED);
+        base->dump_status();
+    }
+}
+
+CompletionQueue::~CompletionQueue() {
+    event.reset();
+
+    if (efd != -1) {
+        close(efd);
+    }
+}
+
+void CompletionQueue::flush() {
+    uint64_t count;
+    [[maybe_unused]] auto _ = read(efd, &count, sizeof count);
+
+    // Clear the flag before taking the batch: anything posted after the swap must signal again.
+    signalled = false;
+
+    {
+        std::lock_guard lock { queue_mutex };
+        batch.swap(queue);
+    }
+
+    for (auto& task : batch) {
+        try {
+            task();
+        }
+        catch (const std::exception& e) {
+            Logger::get().error(ERR_COMPLETION_QUEUE_TASK_ERROR, &e);
+        }
+    }
+
+    batch.clear();
+}
+
+void CompletionQueue::set_loop_thread() noexcept {
+    loop_thread = std::this_thread::get_id();
+}
+
+bool CompletionQueue::in_loop_thread() const noexcept {
+    return loop_thread == std::this_thread::get_id();
+}
+
+void CompletionQueue::post(Task&& task) {
+    {
+        std::lock_guard lock { queue_mutex };
+        queue.emplace_back(std::move(task));
+    }
+
+    if (!signalled.exchange(true)) {
+        uint64_t one = 1;
+
+        if (write(efd, &one, sizeof one) == -1) {
+            Logger::get().error(ERR_COMPLETION_QUEUE_EVENTFD_FAILED);
+            Logger::get().error("server: completion-queue: write: " + std::string(strerror(errno)));
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <new>
+#include <algorithm>
+#include "connection-table.hpp"
+#include "context.hpp"
+#include "epoch.hpp"
+
+using namespace serv;
+
+struct ConnectionTable::Slot {
+    alignas(Context) unsigned char storage[sizeof(Context)];
+
+    inline Context* get() noexcept {
+        return std::launder(reinterpret_cast<Context*>(storage));
+    }
+};
+
+ConnectionTable::ConnectionTable():
+    count { 0 }
+{}
+
+ConnectionTable::~ConnectionTable() {
+    clear();
+}
+
+ConnectionTable::Entry* ConnectionTable::find(evutil_socket_t fd) noexcept {
+    if (fd < 0 || static_cast<size_t>(fd) >= entries.size()) {
+        return nullptr;
+    }
+
+    return &entries[fd];
+}
+
+const ConnectionTable::Entry* ConnectionTable::find(evutil_socket_t fd) const noexcept {
+    if (fd < 0 || static_cast<size_t>(fd) >= entries.size()) {
+        return nullptr;
+    }
+
+    return &entries[fd];
+}
+
+ConnectionTable::Slot* ConnectionTable::acquire() {
+    if (free_slots.empty()) {
+        auto& slab = slabs.emplace_back(new Slot[SLAB_SLOTS]);
+
+        // Pushed in reverse, so that slots are handed out in address order.
+        for (auto i = SLAB_SLOTS; i > 0; --i) {
+            free_slots.push_back(&slab[i - 1]);
+        }
+    }
+
+    auto slot = free_slots.back();
+    free_slots.pop_back();
+
+    return slot;
+}
+
+void ConnectionTable::retire(Entry& entry) noexcept {
+    auto slot = entry.slot;
+
+    // Unlink the entry first, so that anything the context posts back to the loop from now on is dropped.
+    entry.slot = nullptr;
+    ++entry.generation;
+    --count;
+
+    slot->get()->close();
+    retired.push_back({ slot, 0, false });
+}
+
+void ConnectionTable::release(Slot* slot) noexcept {
+    slot->get()->~Context();
+    free_slots.push_back(slot);
+}
+
+ConnectionTable::Handle ConnectionTable::emplace(Server* server, SecureSocket&& sock, Reactor* reactor) {
+    auto fd = sock.get_fd();
+
+    if (fd <= 0) {
+        return {};
+    }
+
+    auto i = static_cast<size_t>(fd);
+
+    if (i >= entries.size()) {
+        entries.resize(std::max(i + 1, entries.size() * 2));
+    }
+
+    auto& entry = entries[i];
+
+    if (entry.slot != nullptr) {
+        retire(entry);
+    }
+
+    Handle handle { fd, entry.generation };
+    auto slot = acquire();
+
+    new (slot->storage) Context(server, std::move(sock), reactor, handle);
+    entry.slot = slot;
+    ++count;
+
+    return handle;
+}
+
+Context* ConnectionTable::get(Handle handle) const noexcept {
+    auto entry = find(handle.fd);
+
+    if (entry == nullptr || entry->slot == nullptr || entry->generation != handle.generation) {
+        return nullptr;
+    }
+
+    return entry->slot->get();
+}
+
+Context* ConnectionTable::get(evutil_socket_t fd) const noexcept {
+    auto entry = find(fd);
+    return entry != nullptr && entry->slot != nullptr ? entry->slot->get() : nullptr;
+}
+
+bool ConnectionTable::erase(Handle handle) noexcept {
+    if (get(handle) == nullptr) {
+        return false;
+    }
+
+    retire(entries[handle.fd]);
+    return true;
+}
+
+bool ConnectionTable::erase(evutil_socket_t fd) noexcept {
+    auto entry = find(fd);
+
+    if (entry == nullptr || entry->slot == nullptr) {
+        return false;
+    }
+
+    retire(*entry);
+    return true;
+}
+
+size_t ConnectionTable::reclaim() noexcept {
+    auto it = std::remove_if(retired.begin(), retired.end(), [this] (Retired& r) {
+        // Once idle, a context gets no new work: its events are gone and it is unreachable by handle. The epoch is taken
+        // from then on, so that it covers the pool thread that was last draining its strand.
+        if (!r.idle) {
+            if (!r.slot->get()->is_idle()) {
+                return false;
+            }
+
+            r.idle = true;
+            r.epoch = Epoch::current();
+        }
+
+        if (!Epoch::has_passed(r.epoch)) {
+            return false;
+        }
+
+        release(r.slot);
+        return true;
+    });
+
+    retired.erase(it, retired.end());
+    return retired.size();
+}
+
+void ConnectionTable::clear() noexcept {
+    for (auto& entry : entries) {
+        if (entry.slot != nullptr) {
+            retire(entry);
+        }
+    }
+
+    // The context destructors join their strands, waiting out any work still running.
+    for (auto& r : retired) {
+        release(r.slot);
+    }
+
+    retired.clear();
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <mutex>
 #include "context.hpp"
 #include "server.hpp"
+#include "reactor.hpp"
 #include "logger.hpp"
 #include "error-codes.hpp"
 #include "error.pb.h"
@@ -17,11 +18,14 @@ event_callback_fn Context::receive_callback = [] (evutil_socket_t fd, short flag
         return;
     }
 
-    ctx->join();
+    auto [nbytes, can_write] = ctx->sock.try_recv();
 
-    auto cpy = *ctx;
-    cpy.thread = std::make_shared<std::thread>([&cpy] () {
-        cpy.read_sock();
+    if (!ctx->handle_recv(nbytes)) {
+        return;
+    }
+
+    ctx->strand.post([ctx, can_write = can_write] () {
+        ctx->parse_buffer(can_write);
     });
 };
 
@@ -31,27 +35,125 @@ event_callback_fn Context::handshake_callback = [] (evutil_socket_t fd, short fl
         return;
     }
 
-    if (ctx->sock->handshake_final()) {
-        ctx->new_read_event();
+    if (!ctx->sock.handshake_read()) {
+        ctx->complete_handshake(false);
+        return;
+    }
+
+    if (!ctx->offloads_handshake()) {
+        ctx->complete_handshake(ctx->sock.handshake_derive());
+        return;
+    }
+
+    // The socket is not watched again until the key is derived, so the pool has its crypto state to itself meanwhile.
+    ctx->strand.post([ctx] () {
+        auto derived = ctx->sock.handshake_derive();
+
+        ctx->on_loop([ctx, derived] () {
+            ctx->complete_handshake(derived);
+        });
+    });
+};
+
+event_callback_fn Context::write_callback = [] (evutil_socket_t fd, short flags, void* arg) {
+    auto ctx = static_cast<Context*>(arg);
+    if (ctx == nullptr) {
+        return;
+    }
+
+    if (!ctx->sock.try_flush()) {
+        Logger::get().error(ERR_CONTEXT_SEND_MESSAGE_FAILED);
+        return;
+    }
+
+    ctx->watch_writable();
+};
 
-        if (ctx->event->add()) {
+bool Context::offloads_handshake() const noexcept {
+    return server != nullptr && server->get_handshake_offload() && completions != nullptr;
+}
+
+void Context::complete_handshake(bool derived) {
+    if (derived && sock.handshake_complete()) {
+        if (sock.is_resumed()) {
+            read_early_data();
+        }
+
+        new_read_event();
+
+        if (event->add()) {
             return;
         }
 
-        if (ctx->server != nullptr) {
-            ctx->server->get_base()->dump_status();
+        if (base != nullptr) {
+            base->dump_status();
+        }
+    }
+    else if (!sock.get_fd()) {
+        // The peer hung up mid-handshake, so there is nothing to retry: once closed, this context is released by its reactor.
+        if (reactor != nullptr) {
+            reactor->close_connection(handle);
         }
     }
     else {
         Logger::get().log("server: handshake_final failed. retrying");
-        ctx->sock->handshake_init();
+        sock.handshake_init();
+        watch_writable();
+    }
+}
+
+void Context::read_early_data() {
+    if (sock.open_early_data() < 0) {
+        do_error(ERR_CONTEXT_HANDLE_READ_FAILED);
+        return;
     }
-};
+
+    // Taken out of the buffer now, so that nothing received after the handshake is mistaken for early data.
+    std::vector<std::string> messages;
+
+    for (std::string data; sock.try_read_buffer(data); ) {
+        messages.push_back(std::move(data));
+    }
+
+    if (messages.empty()) {
+        return;
+    }
+
+    strand.post([this, messages = std::move(messages)] () mutable {
+        early = true;
+
+        for (auto& data : messages) {
+            parse_message(std::move(data));
+        }
+
+        early = false;
+    });
+}
 
 void Context::new_event(short what, event_callback_fn cb) {
-    if (server != nullptr) {
-        event = std::make_unique<Event>(server->get_base()->new_event(sock->get_fd(), what, cb, this));
+    if (base != nullptr) {
+        event.emplace(base->new_event(sock.get_fd(), what, cb, this));
+    }
+}
+
+void Context::watch_writable() {
+    if (base == nullptr || !sock.has_pending()) {
+        return;
+    }
+
+    if (!write_event) {
+        write_event.emplace(base->new_event(sock.get_fd(), EV_WRITE, write_callback, this));
     }
+
+    if (!write_event->add()) {
+        base->dump_status();
+    }
+}
+
+bool Context::send(const std::string& data) {
+    auto sent = sock.try_send(data);
+    watch_writable();
+    return sent;
 }
 
 void Context::handle_request() {
@@ -59,6 +161,12 @@ void Context::handle_request() {
         return;
     }
 
+    // Early data can be replayed by anyone who saw it, so it may only ask for what is safe to repeat.
+    if (early && !server->is_idempotent(header.path())) {
+        do_error(ERR_CONTEXT_EARLY_DATA_REJECTED);
+        return;
+    }
+
     if (!server->exec_endpoint(header.path(), this)) {
         do_error(ERR_CONTEXT_HANDLE_REQUEST_FAILED);
     }
@@ -70,25 +178,36 @@ void Context::reset() {
     header_parsed = false;
 }
 
-Context::Context(Server* server, SecureSocket&& s):
+Context::Context(Server* server, SecureSocket&& s, Reactor* reactor, ConnectionTable::Handle handle):
     server { server },
-    sock { std::make_shared<SecureSocket>(std::move(s)) }
+    reactor { reactor },
+    base { reactor != nullptr ? reactor->get_base() : nullptr },
+    completions { reactor != nullptr ? reactor->get_completions() : nullptr },
+    handle { handle },
+    sock { std::move(s) },
+    strand { server != nullptr ? server->get_thread_pool() : nullptr }
 {
-    fd = sock->get_fd();
+    fd = sock.get_fd();
 
     if (server == nullptr) {
         return;
     }
 
+    if (this->base == nullptr) {
+        this->base = server->get_base();
+    }
+
     new_handshake_event();
 
-    if (!sock->handshake_init()) {
+    if (!sock.handshake_init()) {
         Logger::get().error("server: handshake_init failed");
         return;
     }
 
+    watch_writable();
+
     if (!event->add()) {
-        server->get_base()->dump_status();
+        this->base->dump_status();
         return;
     }
 }
@@ -97,77 +216,95 @@ Context::~Context() {
     join();
 }
 
-void Context::read_sock() {
-    auto [nbytes, can_write] = sock->try_recv();
-
+bool Context::handle_recv(int32_t nbytes) {
     switch (nbytes) {
         case -2:
             Logger::get().log("server: context: secure-socket blocked try_recv(). attempting handshake");
-            sock->handshake_init();
-            return;
+            sock.handshake_init();
+            watch_writable();
+            return false;
         case -1:
             do_error(ERR_CONTEXT_HANDLE_READ_FAILED);
-            return;
+            return false;
         case 0:
-            /** @todo implement some tidy-up, including removing context from Server::ctx_pool */
-            return;
+            // The socket closes itself when the peer hangs up. Once closed, this context is released by its reactor.
+            if (!sock.get_fd() && reactor != nullptr) {
+                reactor->close_connection(handle);
+            }
+
+            return false;
         default:
-            break;
+            return true;
     }
-    
-    if (!header_parsed) {
+}
+
+void Context::parse_buffer(bool can_write) {
+    // Empty messages are messages too, e.g. a header with every field left at its default.
+    for (std::string data; sock.try_read_buffer(data); ) {
+        parse_message(std::move(data));
+    }
+
+    if (!can_write) {
+        do_error(ERR_CONTEXT_BUFFER_FULL);
+        sock.clear_buffer();
         reset();
-        
-        header_data = sock->read_buffer();
+    }
+}
 
-        if (!header_data.size()) {
-            if (!can_write) {
-                do_error(ERR_CONTEXT_BUFFER_FULL);
-                sock->clear_buffer();
-            }
+void Context::parse_message(std::string&& data) {
+    if (header_parsed) {
+        request_data = std::move(data);
+        handle_request();
+        header_parsed = false;
+        return;
+    }
 
-            return;
-        }
+    reset();
+    header_data = std::move(data);
 
-        if (!header.ParseFromString(header_data)) {
-            do_error(ERR_CONTEXT_HANDLE_READ_FAILED);
-            Logger::get().error("server: context: protobuf: ParseFromString");
-            return;
-        }
+    if (!header.ParseFromString(header_data)) {
+        do_error(ERR_CONTEXT_HANDLE_READ_FAILED);
+        Logger::get().error("server: context: protobuf: ParseFromString");
+        return;
+    }
 
-        if (header.type() == proto::Header_Type::Header_Type_TYPE_PING) {
-            if (!sock->try_send(header_data)) {
+    if (header.type() == proto::Header_Type::Header_Type_TYPE_PING) {
+        on_loop([this, data = header_data] () {
+            if (!send(data)) {
                 do_error(ERR_CONTEXT_PING_FAILED);
                 Logger::get().error("server: context: send ping failed");
             }
-            
-            return;
-        }
-
-        if (header.size() == 0) {
-            handle_request();
-            return;
-        }
+        });
 
-        header_parsed = true;
+        return;
     }
-    
-    request_data = sock->read_buffer();
-    
-    if (request_data.size()) {
+
+    if (header.size() == 0) {
         handle_request();
-        header_parsed = false;
+        return;
     }
-    
-    if (!can_write) {
-        do_error(ERR_CONTEXT_BUFFER_FULL);
-        sock->clear_buffer();
-        reset();
+
+    header_parsed = true;
+}
+
+void Context::read_sock() {
+    auto [nbytes, can_write] = sock.try_recv();
+
+    if (handle_recv(nbytes)) {
+        parse_buffer(can_write);
     }
 }
 
 bool Context::send_message(const std::string& data) {
-    if (!sock->try_send(data)) {
+    if (completions != nullptr && !completions->in_loop_thread()) {
+        on_loop([this, data] () {
+            send_message(data);
+        });
+
+        return true;
+    }
+
+    if (!send(data)) {
         do_error(ERR_CONTEXT_SEND_MESSAGE_FAILED);
         return false;
     }
@@ -183,13 +320,27 @@ void Context::do_error(int err_code) {
     err.set_message(msg);
     err.set_timestamp(ts);
 
-    if (!sock->try_send(err.SerializeAsString())) {
-        Logger::get().error(ERR_CONTEXT_DO_ERROR_FAILED);
+    on_loop([this, data = err.SerializeAsString()] () {
+        if (!send(data)) {
+            Logger::get().error(ERR_CONTEXT_DO_ERROR_FAILED);
+        }
+    });
+}
+
+void Context::close() noexcept {
+    if (event) {
+        event->del();
+    }
+
+    if (write_event) {
+        write_event->del();
+    }
+
+    if (sock.get_fd() > 0) {
+        sock.close_fd();
     }
 }
 
 void Context::join() noexcept {
-    if (thread != nullptr && thread->joinable()) {
-        thread->join();
-    }
+    strand.join();
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <atomic>
+#include <mutex>
+#include "epoch.hpp"
+
+using namespace serv;
+
+namespace {
+
+constexpr uint64_t ACTIVE = 1;
+
+/**
+ * @brief A thread's announcement of the epoch it is pinned to: the epoch shifted left by one, with the low bit set while
+ * pinned. Records are never freed; those of exited threads are reused by new ones.
+ */
+struct Record {
+    std::atomic<uint64_t> state { 0 };
+    std::atomic<bool> in_use { true };
+    Record* next = nullptr;
+};
+
+std::atomic<uint64_t> global_epoch { 0 };
+std::atomic<Record*> records { nullptr };
+std::mutex records_mutex;
+
+Record* acquire_record() {
+    std::lock_guard lock { records_mutex };
+
+    for (auto r = records.load(); r != nullptr; r = r->next) {
+        if (!r->in_use.load(std::memory_order_relaxed)) {
+            r->in_use.store(true, std::memory_order_relaxed);
+            return r;
+        }
+    }
+
+    // Readers walk the list without the mutex, so the record is fully built before it is published.
+    auto r = new Record();
+    r->next = records.load(std::memory_order_relaxed);
+    records.store(r, std::memory_order_release);
+
+    return r;
+}
+
+struct Local {
+    Record* record = nullptr;
+    unsigned depth = 0;
+
+    ~Local() {
+        if (record != nullptr) {
+            record->state.store(0, std::memory_order_release);
+            record->in_use.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local Local local;
+
+/**
+ * @brief Advance the global epoch by one, unless a thread is still pinned to an earlier one.
+ */
+void try_advance() noexcept {
+    auto epoch = global_epoch.load(std::memory_order_seq_cst);
+
+    for (auto r = records.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+        auto state = r->state.load(std::memory_order_seq_cst);
+
+        if ((state & ACTIVE) && (state >> 1) != epoch) {
+            return;
+        }
+    }
+
+    global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+}
+
+Epoch::Guard::Guard() noexcept:
+    pinned { true }
+{
+    if (local.depth++) {
+        return;
+    }
+
+    if (local.record == nullptr) {
+        local.record = acquire_record();
+    }
+
+    // Sequentially consistent, so that the announcement is visible before the thread goes on to read any shared object.
+    local.record->state.store((global_epoch.load(std::memory_order_seq_cst) << 1) | ACTIVE, std::memory_order_seq_cst);
+}
+
+Epoch::Guard::Guard(Guard&& g) noexcept:
+    pinned { g.pinned }
+{
+    g.pinned = false;
+}
+
+Epoch::Guard::~Guard() {
+    if (pinned && !--local.depth) {
+        local.record->state.store(0, std::memory_order_release);
+    }
+}
+
+Epoch::Guard Epoch::pin() noexcept {
+    return Guard();
+}
+
+uint64_t Epoch::current() noexcept {
+    return global_epoch.load(std::memory_order_seq_cst);
+}
+
+bool Epoch::has_passed(uint64_t epoch) noexcept {
+    if (global_epoch.load(std::memory_order_seq_cst) < epoch + 2) {
+        try_advance();
+    }
+
+    // Two advances guarantee that every thread pinned at `epoch` has unpinned at least once since.
+    return global_epoch.load(std::memory_order_seq_cst) >= epoch + 2;
+}
\ No newline at end of file
@@ -2,10 +2,11 @@
 
 using namespace serv;
 
-Handler::Handler(Server* s, std::string path, HandlerFunc cb):
+Handler::Handler(Server* s, std::string path, HandlerFunc cb, bool idempotent):
     s { s },
     path { path },
-    cb { cb }
+    cb { cb },
+    idempotent { idempotent }
 {}
 
 void Handler::exec(Context* c) const {
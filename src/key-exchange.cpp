@@ -0,0 +1,121 @@
+#include <crypt/exchange.hpp>
+#include <crypt/public-key-der.hpp>
+#include <openssl/evp.h>
+#include "key-exchange.hpp"
+
+using namespace serv;
+
+namespace {
+
+class FiniteFieldExchange : public KeyExchange {
+    private:
+        crpt::Exchange dh { "ffdhe2048" };
+
+    public:
+        KeyGroup get_group() const noexcept override {
+            return KeyGroup::FFDHE2048;
+        }
+
+        std::vector<char> get_public_key() const override {
+            return dh.get_public_key().to_vector();
+        }
+
+        bool derive_secret(const std::vector<char>& peer_key) override {
+            crpt::PublicKeyDER pk;
+            pk.from_vector(peer_key);
+
+            return dh.derive_secret(pk);
+        }
+
+        std::vector<char> get_secret() const override {
+            return dh.get_secret();
+        }
+};
+
+class X25519Exchange : public KeyExchange {
+    private:
+        static constexpr size_t KEY_SIZE = 32;
+
+        std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key { nullptr, EVP_PKEY_free };
+        std::vector<char> secret;
+
+    public:
+        X25519Exchange() {
+            auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+            EVP_PKEY* k = nullptr;
+
+            if (ctx != nullptr && EVP_PKEY_keygen_init(ctx) > 0 && EVP_PKEY_keygen(ctx, &k) > 0) {
+                key.reset(k);
+            }
+
+            EVP_PKEY_CTX_free(ctx);
+        }
+
+        inline bool is_valid() const noexcept {
+            return key != nullptr;
+        }
+
+        KeyGroup get_group() const noexcept override {
+            return KeyGroup::X25519;
+        }
+
+        std::vector<char> get_public_key() const override {
+            std::vector<char> pk(KEY_SIZE);
+            auto n = pk.size();
+
+            if (EVP_PKEY_get_raw_public_key(key.get(), (unsigned char*)pk.data(), &n) <= 0) {
+                return {};
+            }
+
+            pk.resize(n);
+            return pk;
+        }
+
+        bool derive_secret(const std::vector<char>& peer_key) override {
+            if (peer_key.size() != KEY_SIZE) {
+                return false;
+            }
+
+            std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> peer {
+                EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, (const unsigned char*)peer_key.data(), peer_key.size()),
+                EVP_PKEY_free
+            };
+
+            if (peer == nullptr) {
+                return false;
+            }
+
+            auto ctx = EVP_PKEY_CTX_new(key.get(), nullptr);
+            auto n = KEY_SIZE;
+            secret.resize(n);
+
+            auto success = ctx != nullptr
+                && EVP_PKEY_derive_init(ctx) > 0
+                && EVP_PKEY_derive_set_peer(ctx, peer.get()) > 0
+                && EVP_PKEY_derive(ctx, (unsigned char*)secret.data(), &n) > 0;
+
+            EVP_PKEY_CTX_free(ctx);
+            secret.resize(success ? n : 0);
+
+            return success;
+        }
+
+        std::vector<char> get_secret() const override {
+            return secret;
+        }
+};
+
+}
+
+std::unique_ptr<KeyExchange> KeyExchange::create(KeyGroup group) {
+    switch (group) {
+        case KeyGroup::FFDHE2048:
+            return std::make_unique<FiniteFieldExchange>();
+        case KeyGroup::X25519: {
+            auto kx = std::make_unique<X25519Exchange>();
+            return kx->is_valid() ? std::move(kx) : nullptr;
+        }
+        default:
+            return nullptr;
+    }
+}
\ No newline at end of file
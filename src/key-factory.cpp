@@ -0,0 +1,147 @@
+#include "key-factory.hpp"
+
+using namespace serv;
+
+KeyFactory::KeyFactory(KeyGroup group, size_t capacity):
+    group { group },
+    capacity { capacity },
+    stopping { false },
+    generated { 0 },
+    hits { 0 },
+    misses { 0 },
+    refill_ns { 0 }
+{
+    // The first key pair is generated here, so that the crypto library is initialised, and registers its own clean-up at
+    // exit, before a static factory does: the library is then torn down only after the refill thread has been joined.
+    auto key = generate();
+
+    if (capacity && key != nullptr) {
+        pool.push_back(std::move(key));
+    }
+}
+
+KeyFactory::~KeyFactory() {
+    {
+        std::lock_guard lock { pool_mutex };
+        stopping = true;
+    }
+
+    refill.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+std::unique_ptr<KeyExchange> KeyFactory::generate() {
+    auto start = std::chrono::steady_clock::now();
+    auto key = KeyExchange::create(group);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    refill_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    ++generated;
+
+    return key;
+}
+
+void KeyFactory::start() {
+    if (!thread.joinable() && capacity) {
+        thread = std::thread([this] () {
+            run();
+        });
+    }
+}
+
+void KeyFactory::run() {
+    std::unique_lock lock { pool_mutex };
+
+    while (true) {
+        refill.wait(lock, [this] () {
+            return stopping || pool.size() < capacity;
+        });
+
+        if (stopping) {
+            return;
+        }
+
+        // Generated outside the lock, so that handshakes can keep taking key pairs meanwhile.
+        lock.unlock();
+
+        auto key = generate();
+        lock.lock();
+
+        // A group that cannot be generated is left to fail inline, on acquire, rather than retried here forever.
+        if (key == nullptr) {
+            return;
+        }
+
+        if (pool.size() < capacity) {
+            pool.push_back(std::move(key));
+        }
+
+        refill.notify_all();
+    }
+}
+
+std::unique_ptr<KeyExchange> KeyFactory::acquire() {
+    {
+        std::lock_guard lock { pool_mutex };
+        start();
+
+        if (!pool.empty()) {
+            auto key = std::move(pool.back());
+            pool.pop_back();
+            ++hits;
+
+            refill.notify_all();
+            return key;
+        }
+    }
+
+    ++misses;
+    return KeyExchange::create(group);
+}
+
+void KeyFactory::set_capacity(size_t n) {
+    {
+        std::lock_guard lock { pool_mutex };
+        capacity = n;
+
+        if (pool.size() > capacity) {
+            pool.resize(capacity);
+        }
+
+        start();
+    }
+
+    refill.notify_all();
+}
+
+bool KeyFactory::wait_until_full(std::chrono::milliseconds timeout) {
+    std::unique_lock lock { pool_mutex };
+    start();
+
+    return refill.wait_for(lock, timeout, [this] () {
+        return pool.size() >= capacity;
+    });
+}
+
+KeyFactory::Stats KeyFactory::get_stats() const {
+    Stats stats;
+
+    {
+        std::lock_guard lock { pool_mutex };
+        stats.available = pool.size();
+        stats.capacity = capacity;
+    }
+
+    stats.generated = generated;
+    stats.hits = hits;
+    stats.misses = misses;
+
+    if (auto ns = refill_ns.load()) {
+        stats.refill_rate = stats.generated * 1e9 / ns;
+    }
+
+    return stats;
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include "latency-histogram.hpp"
+
+using namespace serv;
+
+unsigned LatencyHistogram::bucket_of(uint64_t us) noexcept {
+    if (us < SUB_BUCKETS) {
+        return us;
+    }
+
+    // The position of the highest bit picks the power of two, the bits just below it the linear bucket within it.
+    unsigned exp = 63 - __builtin_clzll(us);
+    unsigned sub = (us >> (exp - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+    return (exp - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::upper_bound_of(unsigned bucket) noexcept {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    unsigned exp = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    uint64_t width = uint64_t(1) << (exp - SUB_BUCKET_BITS);
+
+    return (SUB_BUCKETS + sub) * width + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) noexcept {
+    buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+
+    auto prev = max.load(std::memory_order_relaxed);
+
+    while (us > prev && !max.compare_exchange_weak(prev, us, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& h) noexcept {
+    for (unsigned i = 0; i < BUCKETS; ++i) {
+        if (auto n = h.buckets[i].load(std::memory_order_relaxed)) {
+            buckets[i].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    samples.fetch_add(h.samples.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    auto us = h.max.load(std::memory_order_relaxed);
+    auto prev = max.load(std::memory_order_relaxed);
+
+    while (us > prev && !max.compare_exchange_weak(prev, us, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::reset() noexcept {
+    for (auto& b : buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+
+    samples.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const noexcept {
+    uint64_t total = 0;
+
+    for (const auto& b : buckets) {
+        total += b.load(std::memory_order_relaxed);
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    auto rank = std::max<uint64_t>(1, std::ceil(std::clamp(p, 0.0, 1.0) * total));
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+            // No sample exceeds the maximum, which is tighter than the bucket's bound.
+            return std::min(upper_bound_of(i), max.load(std::memory_order_relaxed));
+        }
+    }
+
+    return max;
+}
+
+LatencyHistogram::Summary LatencyHistogram::summarize() const noexcept {
+    return { samples, percentile(0.5), percentile(0.99), max };
+}
\ No newline at end of file
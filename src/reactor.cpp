@@ -0,0 +1,202 @@
+#include <algorithm>
+#include "reactor.hpp"
+#include "server.hpp"
+#include "context.hpp"
+#include "logger.hpp"
+#include "error-codes.hpp"
+
+using namespace libev;
+using namespace serv;
+
+/**
+ * @brief The primary handler for incoming connection attempts
+ */
+event_callback_fn Reactor::accept_callback = [] (evutil_socket_t listener, short flags, void *arg) {
+    ((Reactor*)arg)->accept_connection();
+};
+
+/**
+ * @brief Retries reclaiming closed connections
+ */
+event_callback_fn Reactor::reclaim_callback = [] (evutil_socket_t fd, short flags, void *arg) {
+    ((Reactor*)arg)->reclaim();
+};
+
+/**
+ * @brief Measures the loop's latency
+ */
+event_callback_fn Reactor::probe_callback = [] (evutil_socket_t fd, short flags, void *arg) {
+    ((Reactor*)arg)->probe();
+};
+
+Reactor::Reactor(Server* server):
+    server { server },
+    completions { &base }
+{
+    reclaim_event = std::make_unique<Event>(base.new_event(-1, 0, reclaim_callback, this));
+    probe_event = std::make_unique<Event>(base.new_event(-1, 0, probe_callback, this));
+}
+
+Reactor::~Reactor() {
+    stop();
+}
+
+bool Reactor::listen(const std::string& port, bool reuseport, int backlog) {
+    if (!listen_sock.try_listen(port, AF_UNSPEC, SOCK_STREAM, AI_PASSIVE, reuseport, backlog)) {
+        status = -1;
+        return false;
+    }
+
+    listen_event = std::make_unique<Event>(base.new_event(listen_sock.get_fd(), EV_READ|EV_PERSIST, accept_callback, this));
+
+    if (!listen_event->add()) {
+        status = -1;
+        return false;
+    }
+
+    return true;
+}
+
+int Reactor::run() {
+    completions.set_loop_thread();
+    return status = base.run();
+}
+
+void Reactor::start() {
+    thread = std::thread([this] () {
+        run();
+    });
+}
+
+void Reactor::accept_connection() {
+    ++wakeups;
+
+    // Linux keeps no count of connections dropped from a full accept queue, so a full queue at wakeup stands in for one.
+    auto [pending, backlog] = listen_sock.get_accept_queue();
+
+    if (backlog && pending >= backlog) {
+        ++overflows;
+    }
+
+    if (pending > peak_queue) {
+        peak_queue = pending;
+    }
+
+    auto batch = server != nullptr ? server->get_accept_batch() : DEFAULT_ACCEPT_BATCH;
+    auto limit = server != nullptr ? server->get_buffer_limit() : Socket::DEFAULT_BUFFER_LIMIT;
+    unsigned n = 0;
+
+    for (; n < batch; ++n) {
+        SecureSocket sock;
+
+        if (!listen_sock.try_accept(sock)) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Logger::get().error(ERR_SERVER_ACCEPT_CONN_FAILED);
+                Logger::get().error("server: accept_connection: failed on sock " + std::to_string(listen_sock.get_fd()));
+            }
+
+            break;
+        }
+
+        sock.set_buffer_limit(limit);
+
+        connections.emplace(server, std::move(sock), this);
+    }
+
+    accepted += n;
+
+    // Accepting onto the fd of a connection not yet closed retires the old one.
+    if (connections.get_retired_count()) {
+        reclaim();
+    }
+
+    if (n == batch) {
+        ++capped;
+    }
+}
+
+Reactor::AcceptStats Reactor::get_accept_stats() const {
+    return { accepted, wakeups, capped, overflows, peak_queue };
+}
+
+void Reactor::set_probe_interval(long us) {
+    completions.dispatch([this, us] () {
+        auto armed = probe_interval_us > 0;
+        probe_interval_us = std::max(us, 0l);
+
+        if (!probe_interval_us) {
+            probe_event->del();
+        }
+        else if (!armed) {
+            arm_probe();
+        }
+    });
+}
+
+void Reactor::arm_probe() {
+    probe_due = std::chrono::steady_clock::now() + std::chrono::microseconds(probe_interval_us);
+
+    timeval tv { probe_interval_us / 1000000, probe_interval_us % 1000000 };
+    probe_event->add(&tv);
+}
+
+void Reactor::probe() {
+    if (!probe_interval_us) {
+        return;
+    }
+
+    auto late = std::chrono::steady_clock::now() - probe_due;
+    loop_latency.record(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(late).count(), 0));
+
+    arm_probe();
+}
+
+void Reactor::close_connection(evutil_socket_t fd) {
+    completions.dispatch([this, fd] () {
+        if (connections.erase(fd)) {
+            reclaim();
+        }
+    });
+}
+
+void Reactor::close_connection(ConnectionTable::Handle handle) {
+    completions.dispatch([this, handle] () {
+        if (connections.erase(handle)) {
+            reclaim();
+        }
+    });
+}
+
+void Reactor::reclaim() {
+    if (!connections.reclaim()) {
+        return;
+    }
+
+    timeval tv { 0, RECLAIM_INTERVAL_US };
+    reclaim_event->add(&tv);
+}
+
+void Reactor::stop() {
+    std::lock_guard lock { stop_mutex };
+
+    // The connection shard belongs to the loop thread, so its contexts are joined there before the loop exits.
+    completions.dispatch([this] () {
+        connections.for_each([] (Context& ctx) {
+            ctx.join();
+        });
+
+        base.loopexit();
+    });
+
+    if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) {
+        thread.join();
+    }
+}
+
+EventBase* const Reactor::get_base() {
+    return &base;
+}
+
+CompletionQueue* const Reactor::get_completions() {
+    return &completions;
+}
\ No newline at end of file
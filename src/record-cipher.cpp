@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include "record-cipher.hpp"
+
+using namespace serv;
+
+namespace {
+
+const char MAC_LABEL[] = "serv record mac";
+
+// Prefixes the nonce when it is MACed, so that a record's IV and its tag are never the same HMAC.
+constexpr unsigned char IV_DOMAIN = 0;
+constexpr unsigned char TAG_DOMAIN = 1;
+
+const EVP_CIPHER* evp_cipher_of(ChannelCipher cipher) noexcept {
+    switch (cipher) {
+        case ChannelCipher::AES_256_CBC:
+            return EVP_aes_256_cbc();
+        case ChannelCipher::AES_256_GCM:
+            return EVP_aes_256_gcm();
+        case ChannelCipher::CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            return nullptr;
+    }
+}
+
+bool init(EVP_CIPHER_CTX* ctx, const EVP_CIPHER* evp, const std::vector<char>& key, int enc) noexcept {
+    auto is_aead = EVP_CIPHER_flags(evp) & EVP_CIPH_FLAG_AEAD_CIPHER;
+
+    return EVP_CipherInit_ex(ctx, evp, nullptr, nullptr, nullptr, enc) > 0
+        && (!is_aead || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, RecordCipher::NONCE_SIZE, nullptr) > 0)
+        && EVP_CipherInit_ex(ctx, nullptr, nullptr, (const unsigned char*)key.data(), nullptr, enc) > 0;
+}
+
+EVP_MAC_CTX* new_hmac(const unsigned char* key, size_t len) noexcept {
+    auto mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+    auto ctx = mac != nullptr ? EVP_MAC_CTX_new(mac) : nullptr;
+
+    // The context holds its own reference to the algorithm.
+    EVP_MAC_free(mac);
+
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = { OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0), OSSL_PARAM_construct_end() };
+
+    if (ctx != nullptr && EVP_MAC_init(ctx, key, len, params) > 0) {
+        return ctx;
+    }
+
+    EVP_MAC_CTX_free(ctx);
+    return nullptr;
+}
+
+/**
+ * @brief Computes the HMAC of `domain`, the nonce, the length prefix if any and the segments under the context's key,
+ * truncated to `n` bytes.
+ */
+bool hmac(EVP_MAC_CTX* ctx, unsigned char domain, const unsigned char* nonce, const char* length, const iovec* iov, int iovcnt,
+    unsigned char* out, size_t n) noexcept
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    size_t len = 0;
+
+    // Re-initialized with no key, HMAC keeps the one it was given.
+    auto success = EVP_MAC_init(ctx, nullptr, 0, nullptr) > 0
+        && EVP_MAC_update(ctx, &domain, 1) > 0
+        && EVP_MAC_update(ctx, nonce, RecordCipher::BLOCK_SIZE) > 0
+        && (length == nullptr || EVP_MAC_update(ctx, (const unsigned char*)length, RecordCipher::LENGTH_SIZE) > 0);
+
+    for (int i = 0; success && i < iovcnt; ++i) {
+        success = !iov[i].iov_len || EVP_MAC_update(ctx, (const unsigned char*)iov[i].iov_base, iov[i].iov_len) > 0;
+    }
+
+    success = success && EVP_MAC_final(ctx, digest, &len, sizeof(digest)) > 0 && len >= n;
+
+    if (success) {
+        std::copy_n(digest, n, out);
+    }
+
+    OPENSSL_cleanse(digest, sizeof(digest));
+    return success;
+}
+
+/**
+ * @brief Copies `n` bytes between `bytes` and the segments, starting `at` bytes into them.
+ */
+void copy_at(const iovec* iov, int iovcnt, size_t at, unsigned char* bytes, size_t n, bool gather) noexcept {
+    for (int i = 0; i < iovcnt && n; ++i) {
+        if (at >= iov[i].iov_len) {
+            at -= iov[i].iov_len;
+            continue;
+        }
+
+        auto seg = (unsigned char*)iov[i].iov_base + at;
+        auto m = std::min(n, iov[i].iov_len - at);
+
+        gather ? std::copy_n(seg, m, bytes) : std::copy_n(bytes, m, seg);
+
+        bytes += m;
+        n -= m;
+        at = 0;
+    }
+}
+
+}
+
+RecordCipher::RecordCipher(ChannelCipher cipher, const std::vector<char>& key, const std::vector<char>& iv, bool is_host):
+    cipher { cipher },
+    sealer { EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free },
+    opener { EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free },
+    seal_mac { nullptr, EVP_MAC_CTX_free },
+    open_mac { nullptr, EVP_MAC_CTX_free }
+{
+    auto evp = evp_cipher_of(cipher);
+
+    if (!is_aead()) {
+        nonce_size = BLOCK_SIZE;
+    }
+
+    valid = evp != nullptr && sealer != nullptr && opener != nullptr
+        && key.size() == KEY_SIZE && iv.size() >= nonce_size
+        && init(sealer.get(), evp, key, 1)
+        && init(opener.get(), evp, key, 0);
+
+    if (!valid) {
+        return;
+    }
+
+    if (!is_aead()) {
+        // The MAC key is derived from the cipher key, rather than being the same key put to a second use.
+        unsigned char mac_key[KEY_SIZE];
+        iovec label { const_cast<char*>(MAC_LABEL), sizeof(MAC_LABEL) - 1 };
+        unsigned char zero[BLOCK_SIZE] {};
+
+        MacCtx derive { new_hmac((const unsigned char*)key.data(), key.size()), EVP_MAC_CTX_free };
+
+        valid = derive != nullptr && hmac(derive.get(), IV_DOMAIN, zero, nullptr, &label, 1, mac_key, KEY_SIZE);
+
+        if (valid) {
+            seal_mac.reset(new_hmac(mac_key, KEY_SIZE));
+            open_mac.reset(new_hmac(mac_key, KEY_SIZE));
+            valid = seal_mac != nullptr && open_mac != nullptr;
+        }
+
+        OPENSSL_cleanse(mac_key, KEY_SIZE);
+
+        if (!valid) {
+            return;
+        }
+    }
+
+    std::copy(iv.begin(), iv.begin() + nonce_size, seal_nonce.begin());
+    open_nonce = seal_nonce;
+
+    // The host seals under the IV as it is and the peer under the IV with its top bit flipped.
+    (is_host ? open_nonce : seal_nonce)[0] ^= 0x80;
+}
+
+void RecordCipher::nonce_of(const std::array<unsigned char, BLOCK_SIZE>& base, uint64_t seq, unsigned char* nonce) const noexcept {
+    std::copy_n(base.begin(), nonce_size, nonce);
+
+    for (int i = 0; i < 8; ++i) {
+        nonce[nonce_size - 1 - i] ^= (seq >> (8 * i)) & 0xff;
+    }
+}
+
+uint32_t RecordCipher::read_length(const char* length) noexcept {
+    auto bytes = (const unsigned char*)length;
+    uint32_t len = 0;
+
+    for (size_t i = 0; i < LENGTH_SIZE; ++i) {
+        len = (len << 8) | bytes[i];
+    }
+
+    return len;
+}
+
+bool RecordCipher::seal(const char* data, size_t len, std::vector<char>& out) {
+    iovec iov { const_cast<char*>(data), len };
+    return seal(&iov, 1, out);
+}
+
+bool RecordCipher::seal(const iovec* iov, int iovcnt, std::vector<char>& out) {
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    auto size = sealed_size(len);
+
+    if (!valid || size - LENGTH_SIZE > MAX_RECORD_SIZE) {
+        return false;
+    }
+
+    // Grows `out` only if its capacity is short, so that a reused buffer costs no allocation.
+    auto start = out.size();
+    out.resize(start + size);
+
+    auto record = (unsigned char*)out.data() + start;
+    auto body = size - LENGTH_SIZE;
+
+    for (size_t i = 0; i < LENGTH_SIZE; ++i) {
+        record[i] = (body >> (8 * (LENGTH_SIZE - 1 - i))) & 0xff;
+    }
+
+    unsigned char nonce[BLOCK_SIZE];
+    nonce_of(seal_nonce, seal_seq, nonce);
+
+    int n = 0;
+    unsigned char iv[BLOCK_SIZE];
+    auto success = is_aead() || hmac(seal_mac.get(), IV_DOMAIN, nonce, nullptr, nullptr, 0, iv, BLOCK_SIZE);
+
+    success = success && EVP_CipherInit_ex(sealer.get(), nullptr, nullptr, nullptr, is_aead() ? nonce : iv, 1) > 0;
+
+    // The length prefix is authenticated as associated data, so that a record cannot be truncated or extended.
+    if (is_aead()) {
+        success = success && EVP_CipherUpdate(sealer.get(), nullptr, &n, record, LENGTH_SIZE) > 0;
+    }
+
+    auto dest = record + LENGTH_SIZE;
+
+    // A CBC cipher holds back any partial block, so each part's output is counted rather than assumed.
+    for (int i = 0; success && i < iovcnt; ++i) {
+        if (!iov[i].iov_len) {
+            continue;
+        }
+
+        success = EVP_CipherUpdate(sealer.get(), dest, &n, (const unsigned char*)iov[i].iov_base, iov[i].iov_len) > 0;
+        dest += n;
+    }
+
+    success = success && EVP_CipherFinal_ex(sealer.get(), dest, &n) > 0;
+    dest += n;
+
+    if (is_aead()) {
+        success = success && EVP_CIPHER_CTX_ctrl(sealer.get(), EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, dest) > 0;
+    }
+    else {
+        // Encrypt-then-MAC: the tag covers the length and the cipher text, and so is checked before anything is decrypted.
+        iovec sealed { record + LENGTH_SIZE, size_t(dest - record) - LENGTH_SIZE };
+        success = success && hmac(seal_mac.get(), TAG_DOMAIN, nonce, (const char*)record, &sealed, 1, dest, TAG_SIZE);
+    }
+
+    dest += TAG_SIZE;
+
+    if (!success || dest != record + size) {
+        out.resize(start);
+        return false;
+    }
+
+    ++seal_seq;
+    return true;
+}
+
+int64_t RecordCipher::open(const char* data, size_t n, std::vector<char>& out) {
+    if (!valid) {
+        return -1;
+    }
+
+    if (n < LENGTH_SIZE) {
+        return 0;
+    }
+
+    size_t body = read_length(data);
+
+    if (body > MAX_RECORD_SIZE || body < get_tag_size()) {
+        valid = false;
+        return -1;
+    }
+
+    auto size = LENGTH_SIZE + body;
+
+    if (n < size) {
+        return 0;
+    }
+
+    auto len = body - get_tag_size();
+    auto start = out.size();
+    out.insert(out.end(), data + LENGTH_SIZE, data + LENGTH_SIZE + len);
+
+    iovec iov { out.data() + start, len };
+    auto m = open_in_place(data, &iov, 1, data + LENGTH_SIZE + len);
+
+    if (m < 0) {
+        out.resize(start);
+        return -1;
+    }
+
+    out.resize(start + m);
+    return size;
+}
+
+int64_t RecordCipher::open_in_place(const char* length, const iovec* iov, int iovcnt, const char* tag) {
+    if (!valid) {
+        return -1;
+    }
+
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    unsigned char nonce[BLOCK_SIZE];
+    nonce_of(open_nonce, open_seq, nonce);
+
+    int64_t m = -1;
+
+    if (!is_aead()) {
+        unsigned char expected[TAG_SIZE];
+        unsigned char iv[BLOCK_SIZE];
+
+        auto authentic = hmac(open_mac.get(), TAG_DOMAIN, nonce, length, iov, iovcnt, expected, TAG_SIZE)
+            && CRYPTO_memcmp(expected, tag, TAG_SIZE) == 0;
+
+        if (authentic && hmac(open_mac.get(), IV_DOMAIN, nonce, nullptr, nullptr, 0, iv, BLOCK_SIZE)) {
+            m = open_blocks(iov, iovcnt, len, iv);
+        }
+    }
+    else {
+        // Copied, since OpenSSL takes the tag as non-const.
+        unsigned char expected[TAG_SIZE];
+        std::copy(tag, tag + TAG_SIZE, expected);
+
+        int n = 0;
+
+        auto success = EVP_CipherInit_ex(opener.get(), nullptr, nullptr, nullptr, nonce, 0) > 0
+            && EVP_CipherUpdate(opener.get(), nullptr, &n, (const unsigned char*)length, LENGTH_SIZE) > 0;
+
+        for (int i = 0; success && i < iovcnt; ++i) {
+            auto bytes = (unsigned char*)iov[i].iov_base;
+            success = !iov[i].iov_len || EVP_CipherUpdate(opener.get(), bytes, &n, bytes, iov[i].iov_len) > 0;
+        }
+
+        success = success
+            && EVP_CIPHER_CTX_ctrl(opener.get(), EVP_CTRL_AEAD_SET_TAG, TAG_SIZE, expected) > 0
+            && EVP_CipherFinal_ex(opener.get(), expected, &n) > 0;
+
+        if (success) {
+            m = len;
+        }
+    }
+
+    if (m < 0) {
+        // Whatever was decrypted is unauthenticated, and the sequence is lost, so the channel is unusable from here on.
+        for (int i = 0; i < iovcnt; ++i) {
+            std::fill_n((char*)iov[i].iov_base, iov[i].iov_len, 0);
+        }
+
+        valid = false;
+        return -1;
+    }
+
+    ++open_seq;
+    return m;
+}
+
+int64_t RecordCipher::open_blocks(const iovec* iov, int iovcnt, size_t len, const unsigned char* iv) {
+    if (!len || len % BLOCK_SIZE) {
+        return -1;
+    }
+
+    // Padding is checked here rather than by OpenSSL, which would hold the last block back from being decrypted in place.
+    auto success = EVP_CipherInit_ex(opener.get(), nullptr, nullptr, nullptr, iv, 0) > 0
+        && EVP_CIPHER_CTX_set_padding(opener.get(), 0) > 0;
+
+    unsigned char block[BLOCK_SIZE];
+    size_t pos = 0;
+    size_t start = 0;
+    int n = 0;
+
+    for (int i = 0; success && i < iovcnt; ++i) {
+        auto bytes = (unsigned char*)iov[i].iov_base;
+        auto end = start + iov[i].iov_len;
+
+        // The whole blocks within this segment are decrypted where they lie.
+        if (pos >= start && pos + BLOCK_SIZE <= end) {
+            auto run = (end - pos) / BLOCK_SIZE * BLOCK_SIZE;
+            success = EVP_CipherUpdate(opener.get(), bytes + pos - start, &n, bytes + pos - start, run) > 0;
+            pos += run;
+        }
+
+        // A block split across segments is gathered, decrypted and scattered back.
+        if (success && pos >= start && pos < end) {
+            copy_at(iov, iovcnt, pos, block, BLOCK_SIZE, true);
+            success = EVP_CipherUpdate(opener.get(), block, &n, block, BLOCK_SIZE) > 0;
+            copy_at(iov, iovcnt, pos, block, BLOCK_SIZE, false);
+            pos += BLOCK_SIZE;
+        }
+
+        start = end;
+    }
+
+    if (!success || pos != len) {
+        return -1;
+    }
+
+    unsigned char pad = 0;
+    copy_at(iov, iovcnt, len - 1, &pad, 1, true);
+
+    if (!pad || pad > BLOCK_SIZE) {
+        return -1;
+    }
+
+    copy_at(iov, iovcnt, len - pad, block, pad, true);
+
+    if (!std::all_of(block, block + pad, [pad] (unsigned char b) { return b == pad; })) {
+        return -1;
+    }
+
+    return len - pad;
+}
\ No newline at end of file
@@ -1,34 +1,100 @@
+#include <algorithm>
 #include <crypt/util.hpp>
-#include <crypt/public-key-der.hpp>
 #include <crypt/error.hpp>
 #include <event2/util.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "secure-socket.hpp"
 #include "socket.hpp"
-#include "socket.hpp"
 #include "host-handshake.pb.h"
 #include "peer-handshake.pb.h"
+#include "session-ticket.pb.h"
 #include "logger.hpp"
 #include "error-codes.hpp"
 
 using namespace serv;
 
+namespace {
+
+constexpr uint32_t framing_bit(Framing f) {
+    return static_cast<uint32_t>(f) < 32 ? 1u << static_cast<uint32_t>(f) : 0;
+}
+
+constexpr uint32_t SUPPORTED_FRAMINGS = framing_bit(Framing::NULL_DELIMITED) | framing_bit(Framing::LENGTH_PREFIXED);
+
+constexpr uint32_t SUPPORTED_CIPHERS = ALL_CHANNEL_CIPHERS;
+
+constexpr size_t RESUMPTION_SECRET_SIZE = 32;
+
+const std::string RESUMPTION_LABEL = "serv resumption";
+const std::string CHANNEL_KEY_LABEL = "serv channel key";
+const std::string CHANNEL_IV_LABEL = "serv channel iv";
+const std::string EARLY_KEY_LABEL = "serv early key";
+const std::string EARLY_IV_LABEL = "serv early iv";
+
+// Sent by the host to confirm a handshake: 1 if the key was exchanged, 2 if the session was resumed.
+constexpr char HANDSHAKE_COMPLETE = 1;
+constexpr char HANDSHAKE_RESUMED = 2;
+
+/**
+ * @brief Frees a vector's storage, which clear() would keep.
+ */
+template <typename T>
+void release(std::vector<T>& v) {
+    std::vector<T>().swap(v);
+}
+
+/**
+ * @brief Zeroes a secret, then frees it.
+ */
+void wipe(std::vector<char>& secret) {
+    std::fill(secret.begin(), secret.end(), 0);
+    release(secret);
+}
+
+}
+
 SecureSocket::SecureSocket(Socket&& sock):
     Socket { std::move(sock) }
 {}
 
 SecureSocket::SecureSocket(SecureSocket& sock): 
     Socket { sock },
-    is_secure { false }
+    is_secure { false },
+    preferred_framing { sock.preferred_framing },
+    key_groups { sock.key_groups },
+    preferred_cipher { sock.preferred_cipher },
+    wants_tickets { sock.wants_tickets }
 {}
 
 SecureSocket::SecureSocket(SecureSocket&& sock): 
     Socket { std::move(sock) },
-    shared_secret { sock.shared_secret },
+    aes { std::move(sock.aes) },
+    records { std::move(sock.records) },
+    early { std::move(sock.early) },
+    exchanges { std::move(sock.exchanges) },
     key { sock.key },
     iv { sock.iv },
-    is_secure { sock.is_secure }
+    is_secure { sock.is_secure },
+    preferred_framing { sock.preferred_framing },
+    negotiated_framing { sock.negotiated_framing },
+    key_groups { sock.key_groups },
+    key_group { sock.key_group },
+    peer_key { std::move(sock.peer_key) },
+    peer_group { sock.peer_group },
+    peer_framing { sock.peer_framing },
+    preferred_cipher { sock.preferred_cipher },
+    channel_cipher { sock.channel_cipher },
+    cbc_records { sock.cbc_records },
+    session { std::move(sock.session) },
+    resumption { std::move(sock.resumption) },
+    resume_nonce { std::move(sock.resume_nonce) },
+    early_data { std::move(sock.early_data) },
+    tickets { sock.tickets },
+    wants_tickets { sock.wants_tickets },
+    resuming { sock.resuming },
+    resumed { sock.resumed }
 {
-    sock.shared_secret = {};
     sock.key = {};
     sock.iv = {};
     sock.is_secure = false;
@@ -37,10 +103,18 @@ SecureSocket::SecureSocket(SecureSocket&& sock):
 SecureSocket& SecureSocket::operator=(SecureSocket& sock) {
     Socket::operator=(sock);
 
-    shared_secret = sock.shared_secret;
     key = sock.key;
     iv = sock.iv;
     is_secure = sock.is_secure;
+    preferred_framing = sock.preferred_framing;
+    negotiated_framing = sock.negotiated_framing;
+    key_groups = sock.key_groups;
+    key_group = sock.key_group;
+    preferred_cipher = sock.preferred_cipher;
+    channel_cipher = sock.channel_cipher;
+    cbc_records = sock.cbc_records;
+    wants_tickets = sock.wants_tickets;
+    resumed = sock.resumed;
 
     return *this;
 }
@@ -48,12 +122,32 @@ SecureSocket& SecureSocket::operator=(SecureSocket& sock) {
 SecureSocket& SecureSocket::operator=(SecureSocket&& sock) {
     Socket::operator=(std::move(sock));
 
-    shared_secret = sock.shared_secret;
+    aes = std::move(sock.aes);
+    records = std::move(sock.records);
+    early = std::move(sock.early);
+    exchanges = std::move(sock.exchanges);
     key = sock.key;
     iv = sock.iv;
     is_secure = sock.is_secure;
+    preferred_framing = sock.preferred_framing;
+    negotiated_framing = sock.negotiated_framing;
+    key_groups = sock.key_groups;
+    key_group = sock.key_group;
+    peer_key = std::move(sock.peer_key);
+    peer_group = sock.peer_group;
+    peer_framing = sock.peer_framing;
+    preferred_cipher = sock.preferred_cipher;
+    channel_cipher = sock.channel_cipher;
+    cbc_records = sock.cbc_records;
+    session = std::move(sock.session);
+    resumption = std::move(sock.resumption);
+    resume_nonce = std::move(sock.resume_nonce);
+    early_data = std::move(sock.early_data);
+    tickets = sock.tickets;
+    wants_tickets = sock.wants_tickets;
+    resuming = sock.resuming;
+    resumed = sock.resumed;
 
-    sock.shared_secret = {};
     sock.key = {};
     sock.iv = {};
     sock.is_secure = false;
@@ -61,17 +155,136 @@ SecureSocket& SecureSocket::operator=(SecureSocket&& sock) {
     return *this;
 }
 
+KeyFactory& SecureSocket::get_key_factory(KeyGroup group) {
+    static KeyFactory ffdhe2048 { KeyGroup::FFDHE2048 };
+    static KeyFactory x25519 { KeyGroup::X25519 };
+
+    return group == KeyGroup::X25519 ? x25519 : ffdhe2048;
+}
+
+SessionTickets& SecureSocket::get_session_tickets() {
+    static SessionTickets tickets;
+    return tickets;
+}
+
+SessionCache& SecureSocket::get_session_cache() {
+    static SessionCache cache;
+    return cache;
+}
+
+crpt::Crypt& SecureSocket::cipher() {
+    if (aes == nullptr) {
+        aes = std::make_unique<crpt::Crypt>(CIPHER);
+    }
+
+    return *aes;
+}
+
+bool SecureSocket::derive_key(KeyExchange& kx) {
+    auto shared_secret = kx.get_secret();
+    auto [secret_hash, success] = crpt::Crypt::hash(shared_secret);
+
+    std::fill(shared_secret.begin(), shared_secret.end(), 0);
+    key_group = kx.get_group();
+    release(exchanges);
+
+    if (!success) {
+        return false;
+    }
+
+    key = secret_hash;
+
+    return true;
+}
+
+bool SecureSocket::start_channel(bool is_host) {
+    {
+        // The start of a record under the last channel's key can never be opened under this one.
+        std::lock_guard lock { buf_mux };
+        buf.truncate(buf.size());
+    }
+
+    if (channel_cipher == ChannelCipher::AES_256_CBC && !cbc_records) {
+        records.reset();
+        cipher();
+
+        return true;
+    }
+
+    aes.reset();
+    records = std::make_unique<RecordCipher>(channel_cipher, key, iv, is_host);
+
+    return records->is_valid();
+}
+
+bool SecureSocket::resume_keys(const std::vector<char>& secret, const std::vector<char>& nonce, bool for_early_data, std::vector<char>& k, std::vector<char>& v) const {
+    k = hkdf(secret, nonce, for_early_data ? EARLY_KEY_LABEL : CHANNEL_KEY_LABEL, RecordCipher::KEY_SIZE);
+    v = hkdf(secret, nonce, for_early_data ? EARLY_IV_LABEL : CHANNEL_IV_LABEL, RecordCipher::BLOCK_SIZE);
+
+    return !k.empty() && !v.empty();
+}
+
+KeyExchange* SecureSocket::find_exchange(KeyGroup group) noexcept {
+    for (const auto& kx : exchanges) {
+        if (kx->get_group() == group) {
+            return kx.get();
+        }
+    }
+
+    return nullptr;
+}
+
 bool SecureSocket::handshake_init() {
     is_secure = false;
-    shared_secret.clear();
     key.clear();
-
-    iv = crpt::util::rand_bytes(16);
-    auto host_pk = dh.get_public_key().to_vector();
+    records.reset();
+    early.reset();
+    channel_cipher = ChannelCipher::AES_256_CBC;
+    cbc_records = false;
+    tickets = false;
+    resumed = false;
+    wipe(resumption);
+    resume_nonce.clear();
+    early_data.clear();
+    set_framing(Framing::NULL_DELIMITED);
 
     serv::proto::HostHandshake host_hs;
-    host_hs.set_public_key({ host_pk.begin(), host_pk.end() });
+    exchanges.clear();
+
+    // Fresh key pairs per handshake, kept only until the peer's reply has been used to derive the key.
+    for (auto group : { KeyGroup::FFDHE2048, KeyGroup::X25519 }) {
+        if (!(key_groups & key_group_bit(group))) {
+            continue;
+        }
+
+        auto kx = get_key_factory(group).acquire();
+
+        if (kx == nullptr) {
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_INIT_FAILED);
+            return false;
+        }
+
+        auto pk = kx->get_public_key();
+
+        // The ffdhe2048 key keeps its original field, so that older peers still find it.
+        if (group == KeyGroup::FFDHE2048) {
+            host_hs.set_public_key({ pk.begin(), pk.end() });
+        }
+        else {
+            auto share = host_hs.add_key_shares();
+            share->set_group(static_cast<uint32_t>(group));
+            share->set_public_key({ pk.begin(), pk.end() });
+        }
+
+        exchanges.push_back(std::move(kx));
+    }
+
+    iv = crpt::util::rand_bytes(16);
     host_hs.set_iv({ iv.begin(), iv.end() });
+    host_hs.set_framings(SUPPORTED_FRAMINGS);
+    host_hs.set_ciphers(SUPPORTED_CIPHERS);
+    host_hs.set_records(true);
+    host_hs.set_tickets(true);
 
     if (!Socket::try_send(host_hs.SerializeAsString())) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_INIT_FAILED);
@@ -82,9 +295,27 @@ bool SecureSocket::handshake_init() {
 }
 
 bool SecureSocket::handshake_accept() {
+    return accept(nullptr, {});
+}
+
+bool SecureSocket::handshake_resume(const Session& resume, const std::vector<std::string>& early) {
+    if ((resume.ticket.empty() && resume.id.empty()) || resume.secret.empty() || resume.is_expired()) {
+        return false;
+    }
+
+    return accept(&resume, early);
+}
+
+bool SecureSocket::accept(const Session* resume, const std::vector<std::string>& early) {
     is_secure = false;
-    shared_secret.clear();
     key.clear();
+    records.reset();
+    resuming = false;
+    resumed = false;
+    wipe(resumption);
+    resume_nonce.clear();
+    peer_key.clear();
+    set_framing(Framing::NULL_DELIMITED);
 
     auto [nbytes, _] = Socket::try_recv();
     if (nbytes < 1) {
@@ -102,18 +333,110 @@ bool SecureSocket::handshake_accept() {
     
     iv = std::vector<char>(host_hs.iv().begin(), host_hs.iv().end());
 
-    crpt::PublicKeyDER host_pk;
-    auto host_pk_str = host_hs.public_key();
-    host_pk.from_vector({ host_pk_str.begin(), host_pk_str.end() });
+    // Prefer X25519 when both sides support it; hosts that know of nothing else only send an ffdhe2048 key.
+    auto group = KeyGroup::FFDHE2048;
+    std::string host_pk = host_hs.public_key();
+
+    for (const auto& share : host_hs.key_shares()) {
+        if (share.group() == static_cast<uint32_t>(KeyGroup::X25519) && (key_groups & key_group_bit(KeyGroup::X25519))) {
+            group = KeyGroup::X25519;
+            host_pk = share.public_key();
+        }
+    }
+
+    if (host_pk.empty() || !(key_groups & key_group_bit(group))) {
+        Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_ACCEPT_DERIVE_FAILED);
+        Logger::get().error("server: secure-socket: handshake_accept: no key group in common with the host");
+        return false;
+    }
+
+    // A session is resumed as it was agreed, so only with a host that still supports its cipher and framing.
+    resuming = resume != nullptr && host_hs.tickets()
+        && (host_hs.ciphers() & channel_cipher_bit(resume->cipher))
+        && (host_hs.framings() & framing_bit(resume->framing));
+
+    exchanges.clear();
+    auto kx = get_key_factory(group).acquire();
 
-    if (!dh.derive_secret(host_pk)) {
+    // A resumed session needs no shared secret, so it is only derived once the host has turned the ticket down.
+    if (kx == nullptr || (!resuming && !kx->derive_secret({ host_pk.begin(), host_pk.end() }))) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_ACCEPT_DERIVE_FAILED);
         return false;
     }
 
+    if (resuming) {
+        peer_key.assign(host_pk.begin(), host_pk.end());
+    }
+
     proto::PeerHandshake peer_hs;
-    auto peer_pk = dh.get_public_key().to_vector();
+    auto peer_pk = kx->get_public_key();
     peer_hs.set_public_key({ peer_pk.begin(), peer_pk.end() });
+    peer_hs.set_group(static_cast<uint32_t>(group));
+    exchanges.push_back(std::move(kx));
+
+    if (resuming) {
+        negotiated_framing = resume->framing;
+        channel_cipher = resume->cipher;
+    }
+    else {
+        negotiated_framing = (host_hs.framings() & framing_bit(preferred_framing)) ? preferred_framing : Framing::NULL_DELIMITED;
+
+        // Hosts that know of nothing but AES-256-CBC leave the bitmask unset.
+        channel_cipher = (host_hs.ciphers() & channel_cipher_bit(preferred_cipher)) ? preferred_cipher : ChannelCipher::AES_256_CBC;
+    }
+
+    peer_hs.set_framing(static_cast<uint32_t>(negotiated_framing));
+    peer_hs.set_cipher(static_cast<uint32_t>(channel_cipher));
+
+    // Records are used only if the host knows of them, so that older hosts still get bare AES-256-CBC cipher texts.
+    cbc_records = host_hs.records();
+    peer_hs.set_records(cbc_records);
+
+    // Tickets are only issued over record channels, since a bare cipher text has nowhere to put one.
+    tickets = wants_tickets && host_hs.tickets() && (channel_cipher != ChannelCipher::AES_256_CBC || cbc_records);
+    peer_hs.set_tickets(tickets);
+
+    if (resuming) {
+        auto nonce = crpt::util::rand_bytes(RESUME_NONCE_SIZE);
+        std::vector<char> early_key, early_iv;
+
+        if (nonce.size() != RESUME_NONCE_SIZE || !resume_keys(resume->secret, nonce, true, early_key, early_iv)) {
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_ACCEPT_DERIVE_FAILED);
+            return false;
+        }
+
+        // Sealed under the early data's keys until the host's confirmation brings the nonce for the channel's.
+        records = std::make_unique<RecordCipher>(channel_cipher, early_key, early_iv, false);
+        wipe(early_key);
+
+        // The early data is framed as the channel will be, then the handshake goes back to being null-delimited.
+        std::vector<char> sealed_early;
+        set_framing(negotiated_framing);
+
+        auto sealed_all = true;
+
+        for (const auto& message : early) {
+            sealed_all = sealed_all && seal_message(message.data(), message.size(), true, sealed_early);
+        }
+
+        set_framing(Framing::NULL_DELIMITED);
+
+        if (!records->is_valid() || !sealed_all || sealed_early.size() > MAX_EARLY_DATA) {
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_ACCEPT_SEND_FAILED);
+            Logger::get().error("server: secure-socket: handshake_resume: could not seal the early data");
+            records.reset();
+            return false;
+        }
+
+        peer_hs.set_ticket(resume->ticket);
+        peer_hs.set_session_id(resume->id);
+        peer_hs.set_resume_nonce({ nonce.begin(), nonce.end() });
+        peer_hs.set_early_data({ sealed_early.begin(), sealed_early.end() });
+
+        // Kept only to derive the channel's keys once the host has confirmed.
+        resumption = resume->secret;
+        resume_nonce = std::move(nonce);
+    }
 
     if (!Socket::try_send(peer_hs.SerializeAsString())) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_ACCEPT_SEND_FAILED);
@@ -124,6 +447,16 @@ bool SecureSocket::handshake_accept() {
 }
 
 bool SecureSocket::handshake_final() {
+    return handshake_read() && handshake_derive() && handshake_complete();
+}
+
+bool SecureSocket::handshake_read() {
+    peer_key.clear();
+    wipe(resumption);
+    resume_nonce.clear();
+    early_data.clear();
+    tickets = false;
+
     auto [nbytes, _] = Socket::try_recv();
     if (nbytes < 1) {
         return false;
@@ -138,58 +471,313 @@ bool SecureSocket::handshake_final() {
         return false;
     }
     
+    if (!(SUPPORTED_FRAMINGS & framing_bit(static_cast<Framing>(peer_hs.framing())))) {
+        Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_PARSE_FAILED);
+        Logger::get().error("server: secure-socket: handshake_final: unsupported framing " + std::to_string(peer_hs.framing()));
+        return false;
+    }
+
+    if (!(SUPPORTED_CIPHERS & channel_cipher_bit(static_cast<ChannelCipher>(peer_hs.cipher())))) {
+        Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_PARSE_FAILED);
+        Logger::get().error("server: secure-socket: handshake_final: unsupported cipher " + std::to_string(peer_hs.cipher()));
+        return false;
+    }
+
+    // Older peers leave the group unset, which reads as ffdhe2048.
+    if (find_exchange(static_cast<KeyGroup>(peer_hs.group())) == nullptr) {
+        Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_PARSE_FAILED);
+        Logger::get().error("server: secure-socket: handshake_final: key group not offered " + std::to_string(peer_hs.group()));
+        return false;
+    }
+
     auto pk_str = peer_hs.public_key();
 
-    crpt::PublicKeyDER peer_pk;
-    peer_pk.from_vector({ pk_str.begin(), pk_str.end() });
+    peer_key.assign(pk_str.begin(), pk_str.end());
+    peer_group = static_cast<KeyGroup>(peer_hs.group());
+    peer_framing = static_cast<Framing>(peer_hs.framing());
+    channel_cipher = static_cast<ChannelCipher>(peer_hs.cipher());
+    cbc_records = peer_hs.records();
+
+    // Tickets are only issued, and sessions only resumed, over record channels.
+    auto record_channel = channel_cipher != ChannelCipher::AES_256_CBC || cbc_records;
+    tickets = peer_hs.tickets() && record_channel;
+
+    if (peer_hs.ticket().empty() && peer_hs.session_id().empty()) {
+        return true;
+    }
+
+    // A session the host cannot find, or that does not match the channel the peer asked for, is turned down quietly: the
+    // handshake carries on in full, over the key share sent alongside it. The cache is tried first, since a lookup is cheaper
+    // than opening the ticket. The ticket of a session whose id the cache issued is never opened, even once the session has
+    // gone from the cache: it would otherwise honor a replay of a session that was already resumed.
+    auto issued = false;
+    auto redeemed = peer_hs.session_id().empty() ? std::nullopt : get_session_cache().take(peer_hs.session_id(), &issued);
+
+    if (!redeemed.has_value() && !issued && !peer_hs.ticket().empty()) {
+        redeemed = get_session_tickets().redeem(peer_hs.ticket());
+    }
+
+    if (redeemed.has_value() && redeemed->cipher == channel_cipher && redeemed->framing == peer_framing && record_channel
+        && peer_hs.resume_nonce().size() == RESUME_NONCE_SIZE && peer_hs.early_data().size() <= MAX_EARLY_DATA) {
+        resumption = std::move(redeemed->secret);
+        resume_nonce.assign(peer_hs.resume_nonce().begin(), peer_hs.resume_nonce().end());
+        early_data.assign(peer_hs.early_data().begin(), peer_hs.early_data().end());
+    }
+
+    return true;
+}
+
+bool SecureSocket::handshake_derive() {
+    if (!resumption.empty()) {
+        release(exchanges);
+        release(peer_key);
+
+        // The channel's keys take a nonce of the host's own as well as the peer's, so that a replayed resumption is sealed
+        // under fresh keys rather than those of the connection it was captured from.
+        auto host_nonce = crpt::util::rand_bytes(RESUME_NONCE_SIZE);
+        auto nonces = resume_nonce;
+        nonces.insert(nonces.end(), host_nonce.begin(), host_nonce.end());
+
+        std::vector<char> early_key, early_iv;
+
+        auto derived = host_nonce.size() == RESUME_NONCE_SIZE
+            && resume_keys(resumption, resume_nonce, true, early_key, early_iv)
+            && resume_keys(resumption, nonces, false, key, iv);
+
+        if (derived) {
+            early = std::make_unique<RecordCipher>(channel_cipher, early_key, early_iv, true);
+            derived = early->is_valid();
+        }
+
+        wipe(early_key);
 
-    if (!dh.derive_secret(peer_pk)) {
+        // The next ticket is for a secret of this channel's own, so that the old one unlocks nothing past this resumption.
+        wipe(resumption);
+
+        if (!derived) {
+            early.reset();
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_HASH_FAILED);
+            return false;
+        }
+
+        // From here on, the nonce to send the peer in the confirmation.
+        resume_nonce = std::move(host_nonce);
+        resumed = true;
+
+        return true;
+    }
+
+    auto kx = find_exchange(peer_group);
+
+    if (kx == nullptr || peer_key.empty() || !kx->derive_secret(peer_key)) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_DERIVE_FAILED);
         return false;
     }
 
-    shared_secret = dh.get_secret();
-    auto [secret_hash, success] = crpt::Crypt::hash(shared_secret);
+    release(peer_key);
 
-    if (!success) {
+    if (!derive_key(*kx)) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_HASH_FAILED);
         return false;
     }
 
-    key = secret_hash;
+    return true;
+}
+
+bool SecureSocket::handshake_complete() {
+    if (key.empty() || !start_channel(true)) {
+        Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_FAILED);
+        return false;
+    }
+
     is_secure = true;
 
-    // Let's send a single byte, value 1 (still null-terminated), to indicate the success of the handshake.
-    if (!Socket::try_send(std::vector<char> { 1, 0 })) {
+    // Early data is held in the buffer as though it had just been received, ahead of anything the peer sends next. Its
+    // responses follow the confirmation straight away, so they are not held back waiting on the peer to acknowledge it.
+    if (resumed) {
+        std::lock_guard lock { buf_mux };
+
+        if (early_data.size() > buf.space()) {
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_FAILED);
+            return false;
+        }
+
+        buf.write(early_data.data(), early_data.size());
+        buf.hold(early_data.size());
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+
+    release(early_data);
+
+    // Let's send a single byte (still null-terminated) to indicate the success of the handshake.
+    // The ticket follows in the same write, so that it is not held back waiting on the peer to acknowledge the first.
+    std::vector<char> confirmation { resumed ? HANDSHAKE_RESUMED : HANDSHAKE_COMPLETE, 0 };
+
+    // A resumption is confirmed with the host's nonce, which the peer needs to derive the channel's keys.
+    if (resumed) {
+        confirmation.insert(confirmation.end(), resume_nonce.begin(), resume_nonce.end());
+    }
+
+    release(resume_nonce);
+
+    if ((tickets && !seal_ticket(confirmation)) || !Socket::try_send(confirmation)) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_FINAL_FAILED);
         return false;
     }
 
+    wipe(resumption);
+    set_framing(peer_framing);
+
     return true;
 }
 
+bool SecureSocket::seal_ticket(std::vector<char>& out) {
+    tickets = false;
+
+    resumption = hkdf(key, iv, RESUMPTION_LABEL, RESUMPTION_SECRET_SIZE);
+
+    auto& issuer = get_session_tickets();
+
+    Session issued;
+    issued.secret = resumption;
+    issued.cipher = channel_cipher;
+    issued.framing = peer_framing;
+
+    proto::SessionTicket ticket;
+    ticket.set_ticket(resumption.empty() ? std::string() : issuer.issue(issued));
+    ticket.set_lifetime(issuer.get_lifetime().count());
+    ticket.set_session_id(get_session_cache().insert(issued));
+
+    wipe(issued.secret);
+    wipe(resumption);
+
+    auto bytes = ticket.SerializeAsString();
+
+    std::lock_guard lock { seal_mux };
+    return records->seal(bytes.data(), bytes.size(), out);
+}
+
+void SecureSocket::read_ticket(uint32_t at, size_t len) {
+    tickets = false;
+
+    std::string bytes(len, 0);
+    buf.peek(bytes.data(), len, at);
+
+    proto::SessionTicket ticket;
+
+    if (ticket.ParseFromString(bytes) && (!ticket.ticket().empty() || !ticket.session_id().empty()) && !resumption.empty()) {
+        Session issued;
+        issued.secret = std::move(resumption);
+        issued.cipher = channel_cipher;
+        issued.framing = negotiated_framing;
+        issued.expires = std::chrono::system_clock::now() + std::chrono::seconds { ticket.lifetime() };
+        issued.ticket = ticket.ticket();
+        issued.id = ticket.session_id();
+
+        session = std::move(issued);
+    }
+
+    wipe(resumption);
+}
+
+int64_t SecureSocket::open_early_data() {
+    std::lock_guard lock { buf_mux };
+
+    if (early == nullptr) {
+        return 0;
+    }
+
+    uint32_t offset = buf.size();
+    buf.unhold();
+
+    auto opened = open_records(*early, offset);
+
+    // Early data is whole records, so anything left over is the start of one that will never be finished.
+    if (buf.get_held()) {
+        buf.truncate(buf.size());
+        opened = -1;
+    }
+
+    early.reset();
+
+    if (opened < 0) {
+        Logger::get().error(ERR_SECURE_SOCKET_RECV_FAILED);
+    }
+
+    return opened;
+}
+
 bool SecureSocket::handshake_confirm() {
-    auto [nbytes, _] = Socket::try_recv(2); // { 1, 0 }
+    auto [nbytes, _] = Socket::try_recv(2); // { 1, 0 }, or { 2, 0 } if the session was resumed
 
     if (nbytes != 2) {
         return false;
     }
 
     auto res = read_buffer(0);
-    if (res.front() != 1) {
+
+    if (res.front() == HANDSHAKE_RESUMED && resuming) {
+        resuming = false;
+        release(exchanges);
+        release(peer_key);
+
+        // The host's nonce follows the confirmation, and the channel's keys are derived from it along with the peer's.
+        auto [nonce_bytes, _] = Socket::try_recv(RESUME_NONCE_SIZE);
+        auto nonces = std::move(resume_nonce);
+
+        if (nonce_bytes == RESUME_NONCE_SIZE) {
+            auto host_nonce = Socket::flush_buffer();
+            nonces.insert(nonces.end(), host_nonce.begin(), host_nonce.end());
+        }
+
+        auto derived = nonces.size() == 2 * RESUME_NONCE_SIZE && resume_keys(resumption, nonces, false, key, iv);
+        wipe(resumption);
+
+        if (!derived || !start_channel(false)) {
+            Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_CONFIRM_DERIVE_FAILED);
+            return false;
+        }
+
+        // As for a full handshake, the next ticket is for a secret derived from this channel's keys.
+        if (tickets) {
+            resumption = hkdf(key, iv, RESUMPTION_LABEL, RESUMPTION_SECRET_SIZE);
+        }
+
+        resumed = true;
+        is_secure = true;
+        set_framing(negotiated_framing);
+
+        return true;
+    }
+
+    if (res.front() != HANDSHAKE_COMPLETE) {
         return false;
     }
 
-    shared_secret = dh.get_secret();
-    auto [secret_hash, success] = crpt::Crypt::hash(shared_secret);
+    // Whatever was kept to resume the session is of no use now.
+    wipe(resumption);
+    release(resume_nonce);
 
-    if (!success) {
+    // The host turned the ticket down, so the key exchange put off by handshake_resume() happens now.
+    auto kx = exchanges.empty() ? nullptr : exchanges.front().get();
+    auto exchanged = kx != nullptr && (!resuming || kx->derive_secret(peer_key));
+
+    resuming = false;
+    release(peer_key);
+
+    if (!exchanged || !derive_key(*kx) || !start_channel(false)) {
         Logger::get().error(ERR_SECURE_SOCKET_HANDSHAKE_CONFIRM_DERIVE_FAILED);
         return false;
     }
 
-    key = secret_hash;
+    if (tickets) {
+        resumption = hkdf(key, iv, RESUMPTION_LABEL, RESUMPTION_SECRET_SIZE);
+    }
+
     is_secure = true;
+    set_framing(negotiated_framing);
 
     return true;
 }
@@ -201,6 +789,15 @@ std::pair<int32_t, uint32_t> SecureSocket::try_recv() {
         return { -2, false };
     }
 
+    // Held across the receive and the in-place decrypt, so that a reader on another thread never sees cipher text. The receive
+    // lock comes first, in the same order as Socket::try_recv() takes them.
+    std::lock_guard recv_lock { recv_mux };
+    std::lock_guard lock { buf_mux };
+
+    if (records != nullptr) {
+        return recv_records();
+    }
+
     int offset = buf.size();
     
     const auto sock_recv = Socket::try_recv();
@@ -210,7 +807,7 @@ std::pair<int32_t, uint32_t> SecureSocket::try_recv() {
     }
 
     auto cipher_text = buf.read_from(offset);
-    auto [plain_text, success] = aes.decrypt(cipher_text, key, iv);
+    auto [plain_text, success] = cipher().decrypt(cipher_text, key, iv);
 
     if (!(success && buf.write(plain_text))) {
         Logger::get().error(ERR_SECURE_SOCKET_RECV_FAILED);
@@ -220,13 +817,150 @@ std::pair<int32_t, uint32_t> SecureSocket::try_recv() {
     return { plain_text.size(), sock_recv.second };
 }
 
-bool SecureSocket::try_send(std::string data, bool terminate) {
+std::pair<int32_t, uint32_t> SecureSocket::recv_records() {
+    // Early data still waiting to be opened is ahead of anything received now, and under keys of its own.
+    auto early_opened = early != nullptr ? open_early_data() : 0;
+
+    if (early_opened < 0) {
+        return { -1, buf.space() };
+    }
+
+    uint32_t offset = buf.size();
+
+    // The start of a record left over from the last receive is still where it was, and the rest of it lands after it.
+    buf.unhold();
+
+    auto awaiting_ticket = tickets;
+    auto sock_recv = Socket::try_recv();
+    auto opened = open_records(*records, offset);
+
+    // A blocking receive that brought only the ticket waits on for whatever follows it, as it would have without the ticket.
+    if (!nonblocking && awaiting_ticket && !tickets && opened == 0 && sock_recv.first > 0) {
+        buf.unhold();
+        sock_recv = Socket::try_recv();
+        opened = open_records(*records, offset);
+    }
+
+    if (opened < 0) {
+        Logger::get().error(ERR_SECURE_SOCKET_RECV_FAILED);
+        return { -1, sock_recv.second };
+    }
+
+    opened += early_opened;
+
+    if (sock_recv.first < 1 && opened == 0) {
+        return sock_recv;
+    }
+
+    return { opened, sock_recv.second };
+}
+
+int64_t SecureSocket::open_records(RecordCipher& cipher, uint32_t offset) {
+    constexpr auto LENGTH_SIZE = RecordCipher::LENGTH_SIZE;
+    const auto tag_size = cipher.get_tag_size();
+
+    // Records are decrypted where they landed; each message is then shifted back over the lengths, tags and padding before it.
+    uint32_t read = offset;
+    uint32_t write = offset;
+    bool authentic = true;
+
+    while (buf.size() - read >= LENGTH_SIZE) {
+        char length[LENGTH_SIZE];
+        buf.peek(length, LENGTH_SIZE, read);
+
+        auto body = RecordCipher::read_length(length);
+
+        if (body > RecordCipher::MAX_RECORD_SIZE || body < tag_size) {
+            authentic = false;
+            break;
+        }
+
+        if (buf.size() - read < LENGTH_SIZE + body) {
+            break;
+        }
+
+        auto len = body - tag_size;
+
+        char tag[RecordCipher::TAG_SIZE];
+        buf.peek(tag, tag_size, read + LENGTH_SIZE + len);
+
+        iovec iov[2];
+        auto iovcnt = buf.span(len, read + LENGTH_SIZE, iov);
+        auto m = cipher.open_in_place(length, iov, iovcnt, tag);
+
+        if (m < 0) {
+            authentic = false;
+            break;
+        }
+
+        // The host's first record carries the session ticket, which is no message for the reader.
+        if (tickets) {
+            read_ticket(read + LENGTH_SIZE, m);
+        }
+        else {
+            buf.shift(read + LENGTH_SIZE, write, m);
+            write += m;
+        }
+
+        read += LENGTH_SIZE + body;
+    }
+
+    if (!authentic) {
+        buf.truncate(write);
+        return -1;
+    }
+
+    // Readers must only ever find messages in the buffer, so the start of the next record is held back until it is whole.
+    // It only moves to close the gap left by the records opened ahead of it in this pass, so however many receives a large
+    // record takes to arrive, each of its bytes is moved at most once.
+    uint32_t pending = buf.size() - read;
+
+    buf.shift(read, write, pending);
+    buf.truncate(write + pending);
+    buf.hold(pending);
+
+    return write - offset;
+}
+
+bool SecureSocket::seal_message(const char* data, size_t len, bool terminate, std::vector<char>& out) {
+    char prefix[MAX_FRAME_PREFIX];
+    char terminator = 0;
+
+    iovec parts[] {
+        { prefix, frame_prefix(len, prefix) },
+        { const_cast<char*>(data), len },
+        { &terminator, framing == Framing::NULL_DELIMITED && terminate ? 1u : 0u },
+    };
+
+    return records->seal(parts, 3, out);
+}
+
+bool SecureSocket::try_send(const std::string& data, bool terminate) {
     if (!is_secure) {
         return false;
     }
 
-    std::vector<char> plain_text { data.c_str(), data.c_str() + data.size() + terminate };
-    auto [cipher_text, success] = aes.encrypt(plain_text, key, iv);
+    if (records != nullptr) {
+        // Records are sealed in sequence, so each is queued before the next can be sealed.
+        std::lock_guard lock { seal_mux };
+        sealed.clear();
+
+        auto sent = seal_message(data.data(), data.size(), terminate, sealed) && Socket::try_send(sealed);
+
+        if (sealed.capacity() > MAX_RETAINED_RECORD) {
+            sealed = {};
+        }
+
+        if (!sent) {
+            Logger::get().error(ERR_SECURE_SOCKET_SEND_FAILED);
+            return false;
+        }
+
+        return true;
+    }
+
+    auto plain_text = frame(data.c_str(), data.size(), terminate);
+    auto [cipher_text, success] = cipher().encrypt(plain_text, key, iv);
 
     if (!success) {
         Logger::get().error(ERR_SECURE_SOCKET_SEND_FAILED);
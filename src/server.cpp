@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <event2/thread.h>
 #include "server.hpp"
 #include "context.hpp"
 #include "logger.hpp"
@@ -6,27 +8,42 @@
 using namespace libev;
 using namespace serv;
 
-/**
- * @brief The primary handler for incoming connection attempts
- */
-event_callback_fn Server::accept_callback = [] (evutil_socket_t listener, short flags, void *arg) {
-    ((Server*)arg)->accept_connection();
-};
-
 Server::Server():
-    port { "3993" }
+    Server("3993")
 {}
 
-Server::Server(std::string port):
-    port { port }
-{}
+Server::Server(std::string port, unsigned n_reactors, ThreadPool::Scheduler scheduler):
+    port { port },
+    thread_pool { 0, scheduler },
+    buffer_limit { Socket::DEFAULT_BUFFER_LIMIT },
+    backlog { Socket::DEFAULT_BACKLOG },
+    accept_batch { Reactor::DEFAULT_ACCEPT_BATCH },
+    handshake_offload { true }
+{
+    // Reactors are stopped, and their connections released, from threads other than their loops, so libevent must lock its event bases.
+    [[maybe_unused]]
+    static const int evthread_status = evthread_use_pthreads();
+
+    if (!n_reactors) {
+        n_reactors = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (size_t i = 0; i < n_reactors; ++i) {
+        reactors.emplace_back(std::make_unique<Reactor>(this));
+    }
+}
 
 Server::~Server() {
     stop();
 }
 
-void Server::set_endpoint(std::string path, HandlerFunc cb) {
-    api.emplace(path, std::make_unique<Handler>(this, path, cb));
+void Server::set_endpoint(std::string path, HandlerFunc cb, bool idempotent) {
+    api.emplace(path, std::make_unique<Handler>(this, path, cb, idempotent));
+}
+
+bool Server::is_idempotent(const std::string& path) const {
+    auto it = api.find(path);
+    return it != api.end() && it->second->is_idempotent();
 }
 
 bool Server::exec_endpoint(std::string path, Context* c) {
@@ -41,53 +58,106 @@ bool Server::exec_endpoint(std::string path, Context* c) {
 }
 
 void Server::run() {
-    if (!listen_sock.try_listen(port)) {
-        status = -1;
-        return;
+    // SO_REUSEPORT is only needed when several reactors share the port.
+    const bool reuseport = reactors.size() > 1;
+
+    for (const auto& reactor : reactors) {
+        if (!reactor->listen(port, reuseport, backlog)) {
+            status = -1;
+            return;
+        }
     }
 
-    Logger::get().log("server: running on port " + port);
+    {
+        std::lock_guard lock { run_mutex };
+        running = true;
+        run_thread = std::this_thread::get_id();
+    }
 
-    auto listen_event = base.new_event(listen_sock.get_fd(), EV_READ|EV_PERSIST, accept_callback, this);
+    Logger::get().log("server: running on port " + port + " with " + std::to_string(reactors.size()) + " reactor(s)");
 
-    if (!listen_event.add()) {
-        status = -1;
-        return;
+    for (size_t i = 1; i < reactors.size(); ++i) {
+        reactors[i]->start();
     }
 
-    status = base.run();
-}
+    status = reactors.front()->run();
+
+    for (const auto& reactor : reactors) {
+        reactor->stop();
 
-void Server::accept_connection() {
-    SecureSocket sock;
+        if (!status) {
+            status = reactor->get_status();
+        }
+    }
 
-    if (!listen_sock.try_accept(sock)) {
-        Logger::get().error(ERR_SERVER_ACCEPT_CONN_FAILED);
-        Logger::get().error("server: accept_connection: failed on sock " + std::to_string(sock.get_fd()));
-        return;
+    {
+        std::lock_guard lock { run_mutex };
+        running = false;
     }
-    
-    ctx_pool.emplace(sock.get_fd(), std::make_shared<Context>(this, std::move(sock)));
+
+    run_condition.notify_all();
 }
 
-void Server::close_connection(evutil_socket_t fd) {
-    thread_pool.enqueue([this, fd] () {
-        auto it = ctx_pool.find(fd);
-        if (it != ctx_pool.end()) {
-            ctx_pool.erase(it);
-        }
-    });
+void Server::close_connection(const Context& ctx) {
+    // Only the reactor that accepted the connection holds it; another may since have accepted a new connection on the same fd.
+    if (ctx.get_reactor() != nullptr) {
+        ctx.get_reactor()->close_connection(ctx.get_handle());
+    }
 }
 
 void Server::stop() {
-    for (const auto& [fd, ctx] : ctx_pool) {
-        ctx->join();
+    for (const auto& reactor : reactors) {
+        reactor->stop();
     }
-    
-    base.loopexit();
+
+    {
+        std::unique_lock lock { run_mutex };
+
+        run_condition.wait(lock, [this] () {
+            return !running || run_thread == std::this_thread::get_id();
+        });
+    }
+
     Logger::get().log("server: stopped with status " + std::to_string(status));
 }
 
-EventBase* const Server::get_base() {
-    return &base;
+Reactor::AcceptStats Server::get_accept_stats() const {
+    Reactor::AcceptStats total;
+
+    for (const auto& reactor : reactors) {
+        auto stats = reactor->get_accept_stats();
+        total.accepted += stats.accepted;
+        total.wakeups += stats.wakeups;
+        total.capped += stats.capped;
+        total.overflows += stats.overflows;
+        total.peak_queue = std::max(total.peak_queue, stats.peak_queue);
+    }
+
+    return total;
 }
+
+void Server::set_loop_probe_interval(long us) {
+    for (const auto& reactor : reactors) {
+        reactor->set_probe_interval(us);
+    }
+}
+
+LatencyHistogram::Summary Server::get_loop_latency() const {
+    LatencyHistogram total;
+
+    for (const auto& reactor : reactors) {
+        total.merge(reactor->get_loop_latency());
+    }
+
+    return total.summarize();
+}
+
+void Server::reset_loop_latency() {
+    for (const auto& reactor : reactors) {
+        reactor->reset_loop_latency();
+    }
+}
+
+EventBase* const Server::get_base() {
+    return reactors.front()->get_base();
+}
\ No newline at end of file
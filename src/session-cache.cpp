@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <functional>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+#include <crypt/util.hpp>
+#include "session-cache.hpp"
+
+using namespace serv;
+
+SessionCache::SessionCache(size_t capacity, std::chrono::seconds ttl):
+    shard_capacity { (capacity + SHARDS - 1) / SHARDS },
+    ttl { ttl.count() },
+    hits { 0 },
+    misses { 0 },
+    evicted { 0 }
+{
+    auto bytes = crpt::util::rand_bytes(id_key.size());
+    std::copy_n(bytes.begin(), std::min(bytes.size(), id_key.size()), id_key.begin());
+    std::fill(bytes.begin(), bytes.end(), 0);
+}
+
+SessionCache::~SessionCache() {
+    clear();
+    OPENSSL_cleanse(id_key.data(), id_key.size());
+}
+
+SessionCache::Shard& SessionCache::shard_of(const std::string& id) {
+    return shards[std::hash<std::string> {}(id) % SHARDS];
+}
+
+void SessionCache::tag_id(const char* id, unsigned char* tag) const {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    if (HMAC(EVP_sha256(), id_key.data(), id_key.size(), (const unsigned char*)id, ID_SIZE - ID_TAG_SIZE, digest, &len) == nullptr) {
+        len = 0;
+    }
+
+    // A tag that could not be computed matches no id.
+    std::fill(digest + std::min<size_t>(len, ID_TAG_SIZE), digest + ID_TAG_SIZE, 0xff);
+    std::copy_n(digest, ID_TAG_SIZE, tag);
+}
+
+void SessionCache::erase(Shard& shard, std::list<Entry>::iterator it) {
+    auto& secret = it->session.secret;
+    std::fill(secret.begin(), secret.end(), 0);
+
+    shard.index.erase(it->id);
+    shard.entries.erase(it);
+}
+
+void SessionCache::trim(Shard& shard, size_t room) {
+    while (!shard.entries.empty() && shard.entries.front().session.is_expired()) {
+        erase(shard, shard.entries.begin());
+    }
+
+    auto capacity = shard_capacity.load();
+
+    while (!shard.entries.empty() && shard.entries.size() + room > capacity) {
+        erase(shard, shard.entries.begin());
+        ++evicted;
+    }
+}
+
+std::string SessionCache::insert(const Session& session) {
+    if (session.secret.empty() || !shard_capacity) {
+        return {};
+    }
+
+    auto bytes = crpt::util::rand_bytes(ID_SIZE - ID_TAG_SIZE);
+
+    if (bytes.size() != ID_SIZE - ID_TAG_SIZE) {
+        return {};
+    }
+
+    std::string id { bytes.begin(), bytes.end() };
+    id.resize(ID_SIZE);
+    tag_id(id.data(), (unsigned char*)id.data() + ID_SIZE - ID_TAG_SIZE);
+
+    Entry entry { id, session };
+    entry.session.ticket.clear();
+    entry.session.expires = std::chrono::system_clock::now() + get_ttl();
+
+    auto& shard = shard_of(id);
+    std::lock_guard lock { shard.mutex };
+
+    trim(shard, 1);
+
+    // The capacity may have dropped to 0 since it was checked.
+    if (!shard_capacity || shard.index.count(id)) {
+        std::fill(entry.session.secret.begin(), entry.session.secret.end(), 0);
+        return {};
+    }
+
+    // Added behind every session that expires no later, so that expired sessions are always found at the front. That is the
+    // back of the list, unless the time-to-live was shortened while longer-lived sessions are still held.
+    auto at = shard.entries.end();
+
+    while (at != shard.entries.begin() && std::prev(at)->session.expires > entry.session.expires) {
+        --at;
+    }
+
+    shard.index.emplace(id, shard.entries.insert(at, std::move(entry)));
+
+    return id;
+}
+
+std::optional<Session> SessionCache::take(const std::string& id, bool* issued) {
+    unsigned char tag[ID_TAG_SIZE];
+
+    if (id.size() == ID_SIZE) {
+        tag_id(id.data(), tag);
+    }
+
+    auto is_issued = id.size() == ID_SIZE && CRYPTO_memcmp(tag, id.data() + ID_SIZE - ID_TAG_SIZE, ID_TAG_SIZE) == 0;
+
+    if (issued != nullptr) {
+        *issued = is_issued;
+    }
+
+    if (!is_issued) {
+        ++misses;
+        return std::nullopt;
+    }
+
+    auto& shard = shard_of(id);
+    std::lock_guard lock { shard.mutex };
+
+    auto found = shard.index.find(id);
+
+    if (found == shard.index.end()) {
+        ++misses;
+        return std::nullopt;
+    }
+
+    auto it = found->second;
+    std::optional<Session> session;
+
+    if (!it->session.is_expired()) {
+        session = std::move(it->session);
+    }
+
+    erase(shard, it);
+
+    session.has_value() ? ++hits : ++misses;
+    return session;
+}
+
+void SessionCache::set_capacity(size_t n) {
+    shard_capacity = (n + SHARDS - 1) / SHARDS;
+}
+
+void SessionCache::set_ttl(std::chrono::seconds s) {
+    ttl = s.count();
+}
+
+std::chrono::seconds SessionCache::get_ttl() const {
+    return std::chrono::seconds { ttl.load() };
+}
+
+void SessionCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard lock { shard.mutex };
+
+        while (!shard.entries.empty()) {
+            erase(shard, shard.entries.begin());
+        }
+    }
+}
+
+SessionCache::Stats SessionCache::get_stats() {
+    Stats stats;
+
+    for (auto& shard : shards) {
+        std::lock_guard lock { shard.mutex };
+        stats.size += shard.entries.size();
+    }
+
+    stats.capacity = shard_capacity * SHARDS;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evicted = evicted;
+
+    return stats;
+}
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <crypt/util.hpp>
+#include "session-ticket.hpp"
+#include "session-ticket.pb.h"
+
+using namespace serv;
+
+namespace {
+
+using CipherCtx = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+}
+
+std::vector<char> serv::hkdf(const std::vector<char>& secret, const std::vector<char>& salt, const std::string& label, size_t len) {
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx { EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr), EVP_PKEY_CTX_free };
+    std::vector<char> out(len);
+
+    auto success = ctx != nullptr && !secret.empty()
+        && EVP_PKEY_derive_init(ctx.get()) > 0
+        && EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha256()) > 0
+        && EVP_PKEY_CTX_set1_hkdf_key(ctx.get(), (const unsigned char*)secret.data(), secret.size()) > 0
+        && (salt.empty() || EVP_PKEY_CTX_set1_hkdf_salt(ctx.get(), (const unsigned char*)salt.data(), salt.size()) > 0)
+        && EVP_PKEY_CTX_add1_hkdf_info(ctx.get(), (const unsigned char*)label.data(), label.size()) > 0
+        && EVP_PKEY_derive(ctx.get(), (unsigned char*)out.data(), &len) > 0
+        && len == out.size();
+
+    if (!success) {
+        return {};
+    }
+
+    return out;
+}
+
+SessionTickets::SessionTickets(std::chrono::seconds lifetime):
+    key { crpt::util::rand_bytes(KEY_SIZE) },
+    lifetime { lifetime }
+{}
+
+std::string SessionTickets::issue(const Session& session) const {
+    auto expires = std::chrono::system_clock::now() + get_lifetime();
+
+    proto::SessionState state;
+    state.set_secret({ session.secret.begin(), session.secret.end() });
+    state.set_cipher(static_cast<uint32_t>(session.cipher));
+    state.set_framing(static_cast<uint32_t>(session.framing));
+    state.set_expires(std::chrono::duration_cast<std::chrono::seconds>(expires.time_since_epoch()).count());
+
+    auto plain = state.SerializeAsString();
+    auto nonce = crpt::util::rand_bytes(NONCE_SIZE);
+
+    std::string ticket(NONCE_SIZE + plain.size() + TAG_SIZE, 0);
+    std::copy(nonce.begin(), nonce.end(), ticket.begin());
+
+    auto out = (unsigned char*)ticket.data() + NONCE_SIZE;
+    int n = 0;
+
+    CipherCtx ctx { EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free };
+    std::unique_lock lock { key_mutex };
+
+    auto success = ctx != nullptr && nonce.size() == NONCE_SIZE
+        && EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, (const unsigned char*)key.data(), (const unsigned char*)nonce.data()) > 0
+        && EVP_EncryptUpdate(ctx.get(), out, &n, (const unsigned char*)plain.data(), plain.size()) > 0
+        && EVP_EncryptFinal_ex(ctx.get(), out + n, &n) > 0
+        && EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, out + plain.size()) > 0;
+
+    lock.unlock();
+
+    // The serialized state holds the resumption secret.
+    std::fill(plain.begin(), plain.end(), 0);
+
+    if (!success) {
+        return {};
+    }
+
+    return ticket;
+}
+
+std::optional<std::string> SessionTickets::open(const std::vector<char>& k, const std::string& ticket) {
+    if (k.size() != KEY_SIZE || ticket.size() < NONCE_SIZE + TAG_SIZE) {
+        return std::nullopt;
+    }
+
+    auto len = ticket.size() - NONCE_SIZE - TAG_SIZE;
+    auto bytes = (const unsigned char*)ticket.data();
+
+    std::string plain(len, 0);
+    auto out = (unsigned char*)plain.data();
+
+    // Copied, since OpenSSL takes the tag as non-const.
+    unsigned char tag[TAG_SIZE];
+    std::copy_n(bytes + NONCE_SIZE + len, TAG_SIZE, tag);
+
+    int n = 0;
+    CipherCtx ctx { EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free };
+
+    auto success = ctx != nullptr
+        && EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, (const unsigned char*)k.data(), bytes) > 0
+        && EVP_DecryptUpdate(ctx.get(), out, &n, bytes + NONCE_SIZE, len) > 0
+        && EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_TAG, TAG_SIZE, tag) > 0
+        && EVP_DecryptFinal_ex(ctx.get(), out + n, &n) > 0;
+
+    if (!success) {
+        return std::nullopt;
+    }
+
+    return plain;
+}
+
+std::optional<Session> SessionTickets::redeem(const std::string& ticket) const {
+    std::optional<std::string> plain;
+
+    {
+        std::lock_guard lock { key_mutex };
+        plain = open(key, ticket);
+
+        if (!plain.has_value()) {
+            plain = open(prev_key, ticket);
+        }
+    }
+
+    proto::SessionState state;
+
+    if (!plain.has_value() || !state.ParseFromString(*plain)) {
+        return std::nullopt;
+    }
+
+    std::fill(plain->begin(), plain->end(), 0);
+
+    Session session;
+    session.secret.assign(state.secret().begin(), state.secret().end());
+    session.cipher = static_cast<ChannelCipher>(state.cipher());
+    session.framing = static_cast<Framing>(state.framing());
+    session.expires = std::chrono::system_clock::time_point { std::chrono::seconds { state.expires() } };
+
+    if (session.is_expired() || session.secret.empty()) {
+        return std::nullopt;
+    }
+
+    return session;
+}
+
+void SessionTickets::rotate() {
+    auto next = crpt::util::rand_bytes(KEY_SIZE);
+
+    std::lock_guard lock { key_mutex };
+    prev_key = std::move(key);
+    key = std::move(next);
+}
+
+void SessionTickets::set_lifetime(std::chrono::seconds s) {
+    std::lock_guard lock { key_mutex };
+    lifetime = s;
+}
+
+std::chrono::seconds SessionTickets::get_lifetime() const {
+    std::lock_guard lock { key_mutex };
+    return lifetime;
+}
\ No newline at end of file
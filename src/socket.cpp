@@ -1,6 +1,8 @@
 #include <iostream>
+#include <algorithm>
 #include <string>
-#include <fcntl.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 
 #include "socket.hpp"
 #include "logger.hpp"
@@ -12,7 +14,16 @@ Socket::Socket():
     fd { 0 },
     listening { false },
     nonblocking { true },
-    recv_flags { 0 }
+    recv_flags { 0 },
+    buf { DEFAULT_BUFFER_LIMIT, CircularBuf::Backend::POOLED },
+    outbound_offset { 0 },
+    outbound_bytes { 0 },
+    low_watermark { DEFAULT_LOW_WATERMARK },
+    high_watermark { DEFAULT_HIGH_WATERMARK },
+    congested { false },
+    framing { Framing::NULL_DELIMITED },
+    frame_size { 0 },
+    frame_pending { false }
 {
     addr_len = sizeof addr;
     std::memset(&addr, 0, addr_len);
@@ -25,7 +36,16 @@ Socket::Socket(Socket& sock):
     recv_flags { sock.recv_flags },
     addr { sock.addr },
     addr_len { sock.addr_len },
-    buf { sock.buf }
+    buf { sock.buf },
+    outbound { sock.outbound },
+    outbound_offset { sock.outbound_offset },
+    outbound_bytes { sock.outbound_bytes },
+    low_watermark { sock.low_watermark },
+    high_watermark { sock.high_watermark },
+    congested { sock.congested },
+    framing { sock.framing },
+    frame_size { sock.frame_size },
+    frame_pending { sock.frame_pending }
 {}
 
 Socket::Socket(Socket&& sock): 
@@ -35,7 +55,16 @@ Socket::Socket(Socket&& sock):
     recv_flags { sock.recv_flags },
     addr { sock.addr },
     addr_len { sock.addr_len },
-    buf { sock.buf }
+    buf { std::move(sock.buf) },
+    outbound { std::move(sock.outbound) },
+    outbound_offset { sock.outbound_offset },
+    outbound_bytes { sock.outbound_bytes },
+    low_watermark { sock.low_watermark },
+    high_watermark { sock.high_watermark },
+    congested { sock.congested },
+    framing { sock.framing },
+    frame_size { sock.frame_size },
+    frame_pending { sock.frame_pending }
 {
     sock.fd = 0;
     sock.listening = false;
@@ -44,6 +73,13 @@ Socket::Socket(Socket&& sock):
     std::memset(&sock.addr, 0, sock.addr_len);
     sock.addr_len = 0;
     sock.buf.clear();
+    sock.outbound.clear();
+    sock.outbound_offset = 0;
+    sock.outbound_bytes = 0;
+    sock.congested = false;
+    sock.framing = Framing::NULL_DELIMITED;
+    sock.frame_size = 0;
+    sock.frame_pending = false;
 }
 
 Socket& Socket::operator=(Socket& sock) {
@@ -54,6 +90,15 @@ Socket& Socket::operator=(Socket& sock) {
     addr = sock.addr;
     addr_len = sock.addr_len;
     buf = sock.buf;
+    outbound = sock.outbound;
+    outbound_offset = sock.outbound_offset;
+    outbound_bytes = sock.outbound_bytes;
+    low_watermark = sock.low_watermark;
+    high_watermark = sock.high_watermark;
+    congested = sock.congested;
+    framing = sock.framing;
+    frame_size = sock.frame_size;
+    frame_pending = sock.frame_pending;
     return *this;
 }
 
@@ -64,7 +109,16 @@ Socket& Socket::operator=(Socket&& sock) {
     recv_flags = sock.recv_flags;
     addr = sock.addr;
     addr_len = sock.addr_len;
-    buf = sock.buf;
+    buf = std::move(sock.buf);
+    outbound = std::move(sock.outbound);
+    outbound_offset = sock.outbound_offset;
+    outbound_bytes = sock.outbound_bytes;
+    low_watermark = sock.low_watermark;
+    high_watermark = sock.high_watermark;
+    congested = sock.congested;
+    framing = sock.framing;
+    frame_size = sock.frame_size;
+    frame_pending = sock.frame_pending;
 
     sock.fd = 0;
     sock.listening = false;
@@ -73,6 +127,13 @@ Socket& Socket::operator=(Socket&& sock) {
     std::memset(&sock.addr, 0, sock.addr_len);
     sock.addr_len = 0;
     sock.buf.clear();
+    sock.outbound.clear();
+    sock.outbound_offset = 0;
+    sock.outbound_bytes = 0;
+    sock.congested = false;
+    sock.framing = Framing::NULL_DELIMITED;
+    sock.frame_size = 0;
+    sock.frame_pending = false;
     
     return *this;
 }
@@ -83,7 +144,7 @@ Socket::~Socket() {
     }
 }
 
-bool Socket::try_listen(const std::string& port, int family, int socktype, int flags) { 
+bool Socket::try_listen(const std::string& port, int family, int socktype, int flags, bool reuseport, int backlog) { 
     if (fd != 0) return false;
 
     addrinfo hints, *ai, *p;
@@ -111,6 +172,12 @@ bool Socket::try_listen(const std::string& port, int family, int socktype, int f
 
         setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
 
+        if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1) {
+            Logger::get().log("server: socket: setsockopt: SO_REUSEPORT: " + std::string(strerror(errno)));
+            close(fd);
+            continue;
+        }
+
         if (bind(fd, p->ai_addr, p->ai_addrlen) == -1) {
             Logger::get().log("server: socket: bind: " + std::string(strerror(errno)));
             close(fd);
@@ -134,8 +201,6 @@ bool Socket::try_listen(const std::string& port, int family, int socktype, int f
         return false;
     }
 
-    constexpr auto backlog = 10;
-
     if (listen(fd, backlog) == -1) {
         Logger::get().error(ERR_SOCKET_LISTEN_FAILED);
         Logger::get().error("server: socket: listen: " + std::string(strerror(errno)));
@@ -208,15 +273,16 @@ bool Socket::try_accept(Socket& socket) {
     socklen_t sock_addr_len = sizeof sock_addr;
     std::memset(&sock_addr, 0, addr_len);
 
-    if ((sock_fd = accept(fd, (sockaddr*)&sock_addr, &sock_addr_len)) == -1) {
-        Logger::get().error(ERR_SOCKET_ACCEPT_CONN_FAILED);
-        Logger::get().error("server: socket: accept: " + std::string(strerror(errno)));
-        return false;
-    }
+    // accept4 sets the flags atomically, saving the two fcntl calls evutil_make_socket_nonblocking would cost per connection.
+    if ((sock_fd = accept4(fd, (sockaddr*)&sock_addr, &sock_addr_len, SOCK_NONBLOCK|SOCK_CLOEXEC)) == -1) {
+        // An empty queue is the normal end of a batch of accepts, not an error.
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            auto err = errno;
+            Logger::get().error(ERR_SOCKET_ACCEPT_CONN_FAILED);
+            Logger::get().error("server: socket: accept: " + std::string(strerror(err)));
+            errno = err;
+        }
 
-    if (evutil_make_socket_nonblocking(sock_fd) == -1) {
-        Logger::get().error(ERR_SOCKET_MAKE_NONBLOCKING_FAILED);
-        Logger::get().error("server: socket: accept: evutil_make_socket_nonblocking: " + std::string(strerror(errno)));
         return false;
     }
 
@@ -227,6 +293,18 @@ bool Socket::try_accept(Socket& socket) {
     return true;
 }
 
+std::pair<uint32_t, uint32_t> Socket::get_accept_queue() const {
+    tcp_info info;
+    socklen_t len = sizeof info;
+
+    if (!listening || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+        return { 0, 0 };
+    }
+
+    // For a listening socket, Linux reports the accept queue length and its limit in these two fields.
+    return { info.tcpi_unacked, info.tcpi_sacked };
+}
+
 std::string Socket::get_host() const {
     char host[NI_MAXHOST];
     int gai = getnameinfo((sockaddr*)&addr, addr_len, host, sizeof host, nullptr, 0, 0);
@@ -247,11 +325,20 @@ bool Socket::close_fd() {
     listening = false;
     std::memset(&addr, 0, addr_len);
 
+    {
+        std::lock_guard lock { send_mux };
+        outbound.clear();
+        outbound_offset = 0;
+        outbound_bytes = 0;
+        congested = false;
+    }
+
     return (status == 0);
 }
 
 std::pair<int32_t, uint32_t> Socket::try_recv(uint32_t (*write_cb) (char* dest, uint32_t n, void* data) noexcept, void* arg, uint32_t len) {
     std::lock_guard lock { recv_mux };
+    std::lock_guard buf_lock { buf_mux };
 
     recv_flags = 0;
     return { 
@@ -260,44 +347,49 @@ std::pair<int32_t, uint32_t> Socket::try_recv(uint32_t (*write_cb) (char* dest,
     };
 }
 
+std::pair<int32_t, uint32_t> Socket::try_recv(uint32_t (*read_cb) (iovec* iov, int iovcnt, void* data) noexcept, void* arg, uint32_t len) {
+    std::lock_guard lock { recv_mux };
+    std::lock_guard buf_lock { buf_mux };
+
+    recv_flags = 0;
+    return { 
+        buf.write_vectored(read_cb, len ? len : buf.space(), arg), 
+        buf.space() 
+    };
+}
+
 std::pair<int32_t, uint32_t> Socket::try_recv(uint32_t len) {
     /**
      * Our circular buffer implements its zero-copy writing in such a way that it expects the socket not to block.
      * 
-     * To support blocking I/O, we can let the first call to recvfrom block, so that the caller gets the expected
+     * To support blocking I/O, we can let the first call to recvmsg block, so that the caller gets the expected
      * behaviour of waiting for data to be available.
      * 
-     * Then, enable O_NONBLOCK for all subsequent calls. The `recv_flags` lets us carry information across the
-     * execution lifecycle of a call to Socket::try_recv.
+     * Then, pass MSG_DONTWAIT to all subsequent calls (a pooled buffer may call again as it grows). The `recv_flags`
+     * lets us carry information across the execution lifecycle of a call to Socket::try_recv.
      * 
-     * Notice that it is implemented such that there is no system call overhead to non-blocking I/O.
+     * Notice that this never rewrites the fd's flags, so there is no system call overhead beyond the receive itself.
      */
-    return try_recv([] (char* dest, uint32_t n, void* data) noexcept -> uint32_t {
+    return try_recv([] (iovec* iov, int iovcnt, void* data) noexcept -> uint32_t {
         static constexpr int DIRTY = 1;
 
         auto socket = (Socket*)data;
-        int fd_flags = -1;
 
-        if (!socket->nonblocking && (socket->recv_flags & DIRTY)) {
-            fd_flags = fcntl(socket->fd, F_GETFL);
-            fcntl(socket->fd, F_SETFL, fd_flags | O_NONBLOCK);
-        }
+        msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
 
-        auto nbytes = recvfrom(socket->fd, dest, n, 0, nullptr, 0);
+        auto nbytes = recvmsg(socket->fd, &msg, socket->nonblocking || (socket->recv_flags & DIRTY) ? MSG_DONTWAIT : 0);
         
         socket->recv_flags |= DIRTY;
 
-        if (fd_flags >= 0) {
-            fcntl(socket->fd, F_SETFL, fd_flags);
-        }
-
         if (nbytes > 0) {
             return static_cast<uint32_t>(nbytes);
         }
 
         if (nbytes == -1) {
-            if (!(errno & (EAGAIN|EWOULDBLOCK))) {
-                Logger::get().error("server: socket: recvfrom: " + std::string(strerror(errno)));
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Logger::get().error("server: socket: recvmsg: " + std::string(strerror(errno)));
             }
         }
         else {
@@ -309,8 +401,81 @@ std::pair<int32_t, uint32_t> Socket::try_recv(uint32_t len) {
     }, this, len);
 }
 
+void Socket::set_framing(Framing f) {
+    std::lock_guard lock { buf_mux };
+    framing = f;
+    frame_size = 0;
+    frame_pending = false;
+}
+
+bool Socket::set_buffer_backend(CircularBuf::Backend backend) {
+    std::lock_guard lock { buf_mux };
+
+    if (!buf.empty()) {
+        return false;
+    }
+
+    if (buf.get_backend() != backend) {
+        buf = CircularBuf(buf.space(), backend);
+    }
+
+    return true;
+}
+
+bool Socket::set_buffer_limit(uint32_t limit) {
+    std::lock_guard lock { buf_mux };
+
+    if (!buf.empty()) {
+        return false;
+    }
+
+    buf = CircularBuf(limit, buf.get_backend());
+    return true;
+}
+
+std::vector<char> Socket::frame(const char* data, size_t len, bool terminate) const {
+    if (framing == Framing::NULL_DELIMITED) {
+        std::vector<char> framed(data, data + len);
+
+        if (terminate) {
+            framed.push_back(0);
+        }
+
+        return framed;
+    }
+
+    char prefix[MAX_FRAME_PREFIX];
+    auto n = frame_prefix(len, prefix);
+
+    std::vector<char> framed;
+    framed.reserve(n + len);
+    framed.insert(framed.end(), prefix, prefix + n);
+    framed.insert(framed.end(), data, data + len);
+
+    return framed;
+}
+
+uint32_t Socket::frame_prefix(size_t len, char* prefix) const noexcept {
+    if (framing == Framing::NULL_DELIMITED) {
+        return 0;
+    }
+
+    uint32_t i = 0;
+
+    for (auto n = static_cast<uint32_t>(len); ; n >>= 7) {
+        if (n < 0x80) {
+            prefix[i++] = static_cast<char>(n);
+            break;
+        }
+
+        prefix[i++] = static_cast<char>((n & 0x7f) | 0x80);
+    }
+
+    return i;
+}
+
 bool Socket::try_send(const std::string& data, bool terminate) {
-    return try_send(std::vector<char>(data.c_str(), data.c_str() + data.size() + terminate), send);
+    return try_send(frame(data.c_str(), data.size(), terminate), send);
 }
 
 bool Socket::try_send(const std::vector<char>& data) {
@@ -326,76 +491,240 @@ bool Socket::try_send(const std::vector<char>& data, ssize_t send(int, const voi
     auto bytes = data.data();
     auto len = data.size();
 
-    auto bytes_sent = 0;
-    auto total = 0;
+    ssize_t bytes_sent = 0;
+    size_t total = 0;
     
-    {
-        std::lock_guard lock { send_mux };
+    std::lock_guard lock { send_mux };
 
+    // Anything already queued must go first; the new data joins the back of the queue.
+    if (outbound.empty()) {
         while (total < len) {
-            if ((bytes_sent = send(fd, bytes + total, len - total, 0)) == -1) {
-                // @todo: send error
+            errno = 0;
+
+            if ((bytes_sent = send(fd, bytes + total, len - total, MSG_NOSIGNAL)) == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+
                 Logger::get().error(ERR_SOCKET_SEND_FAILED);
+                Logger::get().error("server: socket: send: " + std::string(strerror(errno)));
                 return false;
             }
 
             total += bytes_sent;
         }
+
+        if (total == len) {
+            return true;
+        }
     }
 
+    outbound.emplace_back(bytes + total, bytes + len);
+    outbound_bytes += len - total;
+    update_congestion();
+
     return true;
 }
 
-std::vector<char> Socket::read_buffer(char delim) {
-    if (buf.empty()) {
-        return {};
+bool Socket::try_flush() {
+    if (!fd || listening) {
+        Logger::get().error(ERR_SOCKET_INVALID_SEND_ATTEMPT);
+        return false;
     }
 
+    std::lock_guard lock { send_mux };
+    return flush_outbound();
+}
+
+bool Socket::flush_outbound() {
+    static constexpr size_t MAX_IOV = 64;
+    iovec iov[MAX_IOV];
+
+    while (!outbound.empty()) {
+        size_t n = 0;
+
+        for (auto it = outbound.begin(); it != outbound.end() && n < MAX_IOV; ++it, ++n) {
+            auto offset = n ? 0 : outbound_offset;
+            iov[n].iov_base = it->data() + offset;
+            iov[n].iov_len = it->size() - offset;
+        }
+
+        msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        auto bytes_sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+        if (bytes_sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+
+            Logger::get().error(ERR_SOCKET_SEND_FAILED);
+            Logger::get().error("server: socket: sendmsg: " + std::string(strerror(errno)));
+            return false;
+        }
+
+        outbound_bytes -= bytes_sent;
+
+        // Pop every buffer that was written in full, leaving the offset into the first one that was not.
+        size_t remaining = bytes_sent + outbound_offset;
+
+        while (!outbound.empty() && remaining >= outbound.front().size()) {
+            remaining -= outbound.front().size();
+            outbound.pop_front();
+        }
+
+        outbound_offset = remaining;
+        update_congestion();
+    }
+
+    return true;
+}
+
+void Socket::update_congestion() noexcept {
+    if (outbound_bytes > high_watermark) {
+        congested = true;
+    }
+    else if (outbound_bytes <= low_watermark) {
+        congested = false;
+    }
+}
+
+bool Socket::has_pending() {
+    std::lock_guard lock { send_mux };
+    return !outbound.empty();
+}
+
+size_t Socket::get_pending_bytes() {
+    std::lock_guard lock { send_mux };
+    return outbound_bytes;
+}
+
+bool Socket::is_congested() {
+    std::lock_guard lock { send_mux };
+    return congested;
+}
+
+void Socket::set_watermarks(size_t low, size_t high) {
+    std::lock_guard lock { send_mux };
+    low_watermark = low;
+    high_watermark = std::max(low, high);
+    update_congestion();
+}
+
+std::vector<char> Socket::read_buffer(char delim) {
     std::lock_guard lock { buf_mux };
-    auto bytes = buf.read_to(delim);
 
-    /**
-     * This might look odd: why not first search the buffer for the delimiter?
-     * O(n) complexity for each is linear, so idea is to spare implementing a search fn
-     * with an approach that works equally well for multi-byte delimiters.
-     * 
-     * A better question is if we should cancel the op when delim is not found?
-     * 
-     *  - The upside is that the caller does not have to worry about storing and piecing together
-     * partial messages.
-     * 
-     *  - The downside is that we have to check for the delimiter in some way, but this approach is simple
-     * and, as noted above, keeps the class interface small.
-     */
-    if (bytes.back() != delim) {
-        buf.write(bytes);
-        return {};      
+    auto i = buf.find(delim);
+
+    if (i == CircularBuf::npos) {
+        return {};
     }
 
+    auto bytes = buf.read(i + 1);
     bytes.pop_back();
+
     return bytes;
 }
 
 std::vector<char> Socket::read_buffer(std::string delim) {
-    if (buf.empty()) {
+    std::lock_guard lock { buf_mux };
+
+    auto i = buf.find(delim);
+
+    if (i == CircularBuf::npos) {
         return {};
     }
 
-    std::lock_guard lock { buf_mux };
-    auto bytes = buf.read_to(delim);
+    auto bytes = buf.read(i + delim.size());
+    bytes.resize(i);
 
-    if (bytes.size() < delim.size() || std::string(bytes.end() - delim.size(), bytes.end()) != delim) {
-        buf.write(bytes);
-        return {};      
+    return bytes;
+}
+
+bool Socket::next_frame(CircularBuf::View& view) {
+    if (!frame_pending) {
+        // A uint32 varint takes at most 5 bytes.
+        char prefix[5];
+        auto n = buf.peek(prefix, sizeof prefix);
+        uint32_t size = 0;
+        uint32_t i = 0;
+
+        for (; i < n; ++i) {
+            size |= static_cast<uint32_t>(prefix[i] & 0x7f) << (7 * i);
+
+            if (!(prefix[i] & 0x80)) {
+                break;
+            }
+        }
+
+        if (i == n) {
+            if (n == sizeof prefix) {
+                Logger::get().error(ERR_SOCKET_MALFORMED_FRAME);
+                buf.clear();
+            }
+
+            return false;
+        }
+
+        // The fifth byte carries only the top 4 bits of a uint32; any more and the length does not fit. A frame that
+        // could never fit would otherwise wait forever on a full buffer.
+        if ((i == 4 && (prefix[4] & 0x70)) || size > buf.get_limit()) {
+            Logger::get().error(ERR_SOCKET_MALFORMED_FRAME);
+            buf.clear();
+            return false;
+        }
+
+        buf.consume(i + 1);
+        frame_size = size;
+        frame_pending = true;
     }
 
-    bytes.pop_back();
-    return bytes;
+    if (buf.size() < frame_size) {
+        return false;
+    }
+
+    frame_pending = false;
+    view = buf.view(frame_size);
+    return true;
+}
+
+bool Socket::next_message(CircularBuf::View& view, uint32_t& n) {
+    if (framing == Framing::LENGTH_PREFIXED) {
+        if (!next_frame(view)) {
+            return false;
+        }
+
+        n = view.size();
+        return true;
+    }
+
+    auto i = buf.find('\0');
+
+    if (i == CircularBuf::npos) {
+        return false;
+    }
+
+    view = buf.view(i);
+    n = i + 1;
+    return true;
 }
 
 std::string Socket::read_buffer() {
-    auto data = read_buffer(0);
-    return { data.begin(), data.end() };
+    std::string data;
+    try_read_buffer(data);
+
+    return data;
+}
+
+bool Socket::try_read_buffer(std::string& data) {
+    data.clear();
+
+    return read_message([&data] (const CircularBuf::View& view) {
+        data.resize(view.size());
+        view.copy_to(data.data());
+    });
 }
 
 std::vector<char> Socket::flush_buffer() {
@@ -406,4 +735,6 @@ std::vector<char> Socket::flush_buffer() {
 void Socket::clear_buffer() {
     std::lock_guard lock { buf_mux };
     buf.clear();
-}
+    frame_size = 0;
+    frame_pending = false;
+}
\ No newline at end of file
@@ -1,24 +1,47 @@
+#include <algorithm>
 #include "thread-pool.hpp"
+#include "epoch.hpp"
 #include "logger.hpp"
 #include "error-codes.hpp"
 
 using namespace serv;
 
-ThreadPool::ThreadPool():
-    run { true },
-    n { std::thread::hardware_concurrency() - 1 }
-{
-    if (!n) {
-        n = 4;
+void detail::schedule(ThreadPool* pool, std::vector<Task>& tasks) {
+    // A pool that has stopped hands the tasks back, and they run here, so that chained futures still resolve.
+    if (pool != nullptr && pool->enqueue_batch(tasks)) {
+        return;
     }
 
-    start();
+    for (auto& task : tasks) {
+        task();
+    }
+
+    tasks.clear();
 }
 
+thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local unsigned ThreadPool::current_worker = 0;
+
+ThreadPool::ThreadPool():
+    ThreadPool(0, Scheduler::SHARED_QUEUE)
+{}
+
 ThreadPool::ThreadPool(unsigned n):
+    ThreadPool(n, Scheduler::SHARED_QUEUE)
+{}
+
+ThreadPool::ThreadPool(unsigned n, Scheduler scheduler):
+    pending { 0 },
+    sleepers { 0 },
+    next_worker { 0 },
     run { true },
-    n { n }
+    scheduler { scheduler },
+    n { n ? n : std::thread::hardware_concurrency() - 1 }
 {
+    if (!this->n) {
+        this->n = 4;
+    }
+
     start();
 }
 
@@ -26,39 +49,242 @@ ThreadPool::~ThreadPool() {
     stop();
 }
 
-void ThreadPool::start() {
-    for (auto i = 0; i < n; ++i) {
-        std::promise<void> promise;
-        thread_futures.push_back(promise.get_future());
+bool ThreadPool::push(Task&& task) {
+    if (scheduler == Scheduler::SHARED_QUEUE) {
+        {
+            std::lock_guard lock { queue_mutex };
 
-        pool.emplace_back([this, i] (std::promise<void> p) {
-            while (true) {
-                try {
-                    std::function<void()> task;
+            if (!run) {
+                return false;
+            }
 
-                    {
-                        std::unique_lock lock { queue_mutex };
+            queue.emplace(std::move(task));
+        }
 
-                        // Wait until there is work available or the thread pool has been halted.
-                        condition.wait(lock, [this] () {
-                            return !run || !queue.empty();
-                        });
+        // Notify some waiting thread that there is available work in the queue.
+        condition.notify_one();
+        return true;
+    }
 
-                        if (!run && queue.empty()) {
-                            p.set_value();
-                            return;
-                        }
+    // Count the task before it becomes visible, so that a thread that takes it can never see `pending` underflow. Counting
+    // it before checking `run` also means that no thread can exit on seeing nothing pending once the task has been accepted.
+    ++pending;
 
-                        task = queue.front();
-                        queue.pop();
-                    }
+    if (!run) {
+        --pending;
+        return false;
+    }
 
-                    task();
-                }
-                catch (const std::exception& e) {
-                    Logger::get().error(ERR_THREAD_POOL_THREAD_LOOP_ERROR, &e);
+    // Tasks enqueued from one of our own threads stay local to it; the rest are spread across the workers.
+    auto i = current_pool == this ? current_worker : next_worker++ % n;
+
+    {
+        std::lock_guard lock { workers[i]->mutex };
+        workers[i]->deque.emplace_back(std::move(task));
+    }
+
+    // Only touch the shared lock when someone may be asleep: a thread increments `sleepers` before checking `pending`,
+    // so either it sees our task or we see it waiting.
+    if (sleepers) {
+        { std::lock_guard lock { queue_mutex }; }
+        condition.notify_one();
+    }
+
+    return true;
+}
+
+bool ThreadPool::enqueue_batch(std::vector<Task>& tasks) {
+    if (tasks.empty()) {
+        return true;
+    }
+
+    if (scheduler == Scheduler::SHARED_QUEUE) {
+        {
+            std::lock_guard lock { queue_mutex };
+
+            if (!run) {
+                return false;
+            }
+
+            for (auto& task : tasks) {
+                queue.emplace(std::move(task));
+            }
+        }
+
+        condition.notify_all();
+        tasks.clear();
+        return true;
+    }
+
+    // Counted before checking `run`, as in push().
+    pending += tasks.size();
+
+    if (!run) {
+        pending -= tasks.size();
+        return false;
+    }
+
+    if (current_pool == this) {
+        auto& worker = *workers[current_worker];
+        std::lock_guard lock { worker.mutex };
+
+        for (auto& task : tasks) {
+            worker.deque.emplace_back(std::move(task));
+        }
+    }
+    else {
+        // Deal the batch out in contiguous chunks, one lock per worker.
+        auto chunk = (tasks.size() + n - 1) / n;
+
+        for (size_t from = 0; from < tasks.size(); from += chunk) {
+            auto& worker = *workers[next_worker++ % n];
+            std::lock_guard lock { worker.mutex };
+
+            for (auto i = from; i < std::min(from + chunk, tasks.size()); ++i) {
+                worker.deque.emplace_back(std::move(tasks[i]));
+            }
+        }
+    }
+
+    if (sleepers) {
+        { std::lock_guard lock { queue_mutex }; }
+        condition.notify_all();
+    }
+
+    tasks.clear();
+    return true;
+}
+
+void ThreadPool::shared_queue_loop(std::promise<void> p) {
+    while (true) {
+        try {
+            Task task;
+
+            {
+                std::unique_lock lock { queue_mutex };
+
+                // Wait until there is work available or the thread pool has been halted.
+                condition.wait(lock, [this] () {
+                    return !run || !queue.empty();
+                });
+
+                if (!run && queue.empty()) {
+                    p.set_value();
+                    return;
                 }
-            }    
+
+                task = std::move(queue.front());
+                queue.pop();
+            }
+
+            task();
+        }
+        catch (const std::exception& e) {
+            Logger::get().error(ERR_THREAD_POOL_THREAD_LOOP_ERROR, &e);
+        }
+    }
+}
+
+void ThreadPool::work_stealing_loop(unsigned i, std::promise<void> p) {
+    current_pool = this;
+    current_worker = i;
+
+    while (true) {
+        try {
+            Task task;
+
+            // Victims are only waited on once a round of trying them has come up empty, so that a busy deque is passed over.
+            if (pop(i, task) || steal(i, task, false) || steal(i, task, true)) {
+                task();
+                continue;
+            }
+
+            std::unique_lock lock { queue_mutex };
+            ++sleepers;
+
+            if (pending) {
+                // Counted but not yet in a deque: back off until it lands rather than spin on it.
+                condition.wait_for(lock, STEAL_BACKOFF);
+            }
+            else {
+                // Wait until there is work available somewhere or the thread pool has been halted.
+                condition.wait(lock, [this] () {
+                    return !run || pending;
+                });
+            }
+
+            --sleepers;
+
+            if (!run && !pending) {
+                p.set_value();
+                return;
+            }
+        }
+        catch (const std::exception& e) {
+            Logger::get().error(ERR_THREAD_POOL_THREAD_LOOP_ERROR, &e);
+        }
+    }
+}
+
+bool ThreadPool::pop(unsigned i, Task& task) {
+    auto& worker = *workers[i];
+    std::lock_guard lock { worker.mutex };
+
+    if (worker.deque.empty()) {
+        return false;
+    }
+
+    task = std::move(worker.deque.back());
+    worker.deque.pop_back();
+    --pending;
+
+    return true;
+}
+
+bool ThreadPool::steal(unsigned i, Task& task, bool wait) {
+    for (unsigned j = 1; j < n; ++j) {
+        auto& victim = *workers[(i + j) % n];
+        std::unique_lock lock { victim.mutex, std::defer_lock };
+
+        if (wait) {
+            lock.lock();
+        }
+        else if (!lock.try_lock()) {
+            continue;
+        }
+
+        if (victim.deque.empty()) {
+            continue;
+        }
+
+        task = std::move(victim.deque.front());
+        victim.deque.pop_front();
+        --pending;
+
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::start() {
+    if (scheduler == Scheduler::WORK_STEALING) {
+        for (unsigned i = 0; i < n; ++i) {
+            workers.emplace_back(std::make_unique<Worker>());
+        }
+    }
+
+    for (unsigned i = 0; i < n; ++i) {
+        std::promise<void> promise;
+        thread_futures.push_back(promise.get_future());
+
+        pool.emplace_back([this, i] (std::promise<void> p) {
+            if (scheduler == Scheduler::WORK_STEALING) {
+                work_stealing_loop(i, std::move(p));
+            }
+            else {
+                shared_queue_loop(std::move(p));
+            }
         }, std::move(promise));
     }
 }
@@ -66,7 +292,10 @@ void ThreadPool::start() {
 void ThreadPool::stop(bool graceful) {
     try {
         if (run) {
-            run = false;
+            {
+                std::lock_guard lock { queue_mutex };
+                run = false;
+            }
 
             condition.notify_all();
 
@@ -85,4 +314,70 @@ void ThreadPool::stop(bool graceful) {
     catch (const std::exception& e) {
         Logger::get().error(ERR_THREAD_POOL_DESTROY_POOL_ERROR, &e);
     }   
+}
+
+Strand::Strand(ThreadPool* pool):
+    pool { pool },
+    running { false }
+{}
+
+Strand::~Strand() {
+    join();
+}
+
+void Strand::schedule() {
+    // A pool that has stopped turns the batch away, so it is drained here instead: otherwise the strand stays running and
+    // join() waits on it forever.
+    auto scheduled = pool != nullptr && pool->enqueue([this] () {
+        drain();
+    });
+
+    if (!scheduled) {
+        drain();
+    }
+}
+
+void Strand::drain() {
+    // Pinned until the strand has finished with its owner, so that the owner is not reclaimed from under a running batch.
+    auto guard = Epoch::pin();
+
+    for (auto i = 0; i < BATCH_SIZE; ++i) {
+        Task task;
+
+        {
+            std::lock_guard lock { queue_mutex };
+
+            if (queue.empty()) {
+                running = false;
+                idle.notify_all();
+                return;
+            }
+
+            task = std::move(queue.front());
+            queue.pop();
+        }
+
+        try {
+            task();
+        }
+        catch (const std::exception& e) {
+            Logger::get().error(ERR_THREAD_POOL_STRAND_TASK_ERROR, &e);
+        }
+    }
+
+    // Yield the pool thread so that other strands get a turn, leaving the rest of our queue for the next batch.
+    schedule();
+}
+
+bool Strand::is_idle() {
+    std::lock_guard lock { queue_mutex };
+    return !running;
+}
+
+void Strand::join() {
+    std::unique_lock lock { queue_mutex };
+
+    idle.wait(lock, [this] () {
+        return !running;
+    });
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include <boost/test/unit_test.hpp>
 #include <string>
+#include <algorithm>
 #include <chrono>
+#include <random>
 #include "circular-buffer.hpp"
+#include "byte-search.hpp"
+#include "buffer-pool.hpp"
 
 namespace {
 
@@ -234,4 +238,382 @@ BOOST_AUTO_TEST_CASE( circ_buf_read_to_table_test ) {
     for (auto &test : read_to_tests) do_read_to_test(test);
 }
 
+BOOST_AUTO_TEST_CASE( circ_buf_peek_does_not_consume ) {
+    serv::CircularBuf buffer(16);
+
+    // in buffer: 1234> ---- ---- |1234 (the mock input restarts as the write wraps round)
+    buffer.write(write_cb, 12);
+    buffer.read(12);
+    buffer.write(write_cb, 8);
+
+    char bytes[8];
+
+    BOOST_ASSERT( buffer.peek(bytes, 8) == 8 );
+    BOOST_ASSERT( std::string(bytes, 8) == "12341234" );
+
+    BOOST_ASSERT( buffer.peek(bytes, 8, 6) == 2 );
+    BOOST_ASSERT( std::string(bytes, 2) == "34" );
+
+    BOOST_ASSERT( buffer.peek(bytes, 8, 8) == 0 );
+    BOOST_ASSERT( buffer.size() == 8 );
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_view_spans_wrap_and_consume_releases ) {
+    serv::CircularBuf buffer(16);
+    offset_buffer(buffer, 12);
+
+    // in buffer: 5678> ---- ---- |1234
+    buffer.write(write_cb, 8);
+
+    auto view = buffer.view();
+
+    BOOST_ASSERT( view.size() == 8 && !view.contiguous() );
+    BOOST_ASSERT( std::string(view.first.data, view.first.size) == "1234" );
+    BOOST_ASSERT( std::string(view.second.data, view.second.size) == "1234" );
+
+    // Views do not consume
+    BOOST_ASSERT( buffer.size() == 8 );
+
+    view = buffer.view(2, 1);
+    BOOST_ASSERT( view.contiguous() && std::string(view.first.data, view.first.size) == "23" );
+
+    BOOST_ASSERT( buffer.find('3') == 2 );
+    BOOST_ASSERT( buffer.find('3', 3) == 6 );
+    BOOST_ASSERT( buffer.find('9') == serv::CircularBuf::npos );
+    BOOST_ASSERT( buffer.find("41") == 3 );
+    BOOST_ASSERT( buffer.find("412") == 3 );
+    BOOST_ASSERT( buffer.find("3412") == 2 );
+    BOOST_ASSERT( buffer.find("4123", 4) == serv::CircularBuf::npos );
+
+    auto bytes = buffer.read_to("41");
+    BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == "12341" );
+
+    BOOST_ASSERT( buffer.consume(2) == 2 );
+    BOOST_ASSERT( buffer.size() == 1 && *buffer.view().first.data == '4' );
+    BOOST_ASSERT( buffer.consume(4) == 1 && buffer.empty() );
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_span_shift_and_truncate_edit_in_place_across_the_wrap ) {
+    serv::CircularBuf buffer(16);
+    offset_buffer(buffer, 12);
+
+    // in buffer: --gh --cd ef-- |ab--
+    std::string data = "ab--cdef--gh";
+    buffer.write(data);
+
+    iovec iov[2];
+    BOOST_ASSERT( buffer.span(-1, 0, iov) == 2 );
+    BOOST_ASSERT( iov[0].iov_len == 4 && iov[1].iov_len == 8 );
+    BOOST_ASSERT( buffer.span(2, 4, iov) == 1 && iov[0].iov_len == 2 );
+    BOOST_ASSERT( buffer.span(-1, 12, iov) == 0 );
+
+    buffer.span(-1, 0, iov);
+
+    for (auto& v : iov) {
+        auto bytes = static_cast<char*>(v.iov_base);
+        std::transform(bytes, bytes + v.iov_len, bytes, ::toupper);
+    }
+
+    // Close both gaps, the first across the wrap point.
+    buffer.shift(4, 2, 4);
+    buffer.shift(10, 6, 2);
+    buffer.truncate(8);
+
+    BOOST_ASSERT( buffer.size() == 8 );
+
+    auto bytes = buffer.read();
+    BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == "ABCDEFGH" );
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_mirrored_backend_is_contiguous ) {
+    using Backend = serv::CircularBuf::Backend;
+
+    serv::CircularBuf buffer(16, Backend::MIRRORED);
+    BOOST_ASSERT( buffer.get_backend() == Backend::MIRRORED );
+
+    // Rounded up to a whole page.
+    auto capacity = buffer.space();
+    BOOST_ASSERT( capacity >= 16 && !(capacity & (capacity - 1)) );
+
+    offset_buffer(buffer, capacity - 4);
+
+    // A write across the end of the mapping takes a single call, so the mock input does not restart.
+    int calls = 0;
+
+    buffer.write([] (char* dest, uint32_t n, void* data) noexcept -> uint32_t {
+        ++*static_cast<int*>(data);
+        return mock_recvfrom(4, dest, n);
+    }, 8, &calls);
+
+    BOOST_ASSERT( calls == 1 );
+
+    auto view = buffer.view();
+    BOOST_ASSERT( view.contiguous() && std::string(view.first.data, view.first.size) == "12345678" );
+    BOOST_ASSERT( buffer.find("4567") == 3 );
+
+    serv::CircularBuf copy = buffer;
+    auto bytes = copy.read();
+
+    BOOST_ASSERT( copy.get_backend() == Backend::MIRRORED );
+    BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == "12345678" );
+    BOOST_ASSERT( buffer.size() == 8 );
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_mirrored_backend_shifts_across_the_wrap ) {
+    using Backend = serv::CircularBuf::Backend;
+
+    serv::CircularBuf buffer(16, Backend::MIRRORED);
+    auto capacity = buffer.space();
+
+    // Each shift moves bytes from past the wrap point to before it, some so far that source and destination are the same
+    // memory seen through either mapping.
+    for (uint32_t gap = 1; gap <= 64; gap *= 2) {
+        buffer.clear();
+        offset_buffer(buffer, capacity - 32);
+
+        std::string data;
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            data.push_back(static_cast<char>(i));
+        }
+
+        BOOST_ASSERT( buffer.write(data) == data.size() );
+
+        buffer.shift(gap, 0, data.size() - gap);
+        buffer.truncate(data.size() - gap);
+
+        auto bytes = buffer.read();
+        BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == data.substr(gap) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_pooled_backend_grows_and_releases ) {
+    using Backend = serv::CircularBuf::Backend;
+
+    auto& pool = serv::BufferPool::get();
+    auto used = pool.get_used_bytes();
+
+    serv::CircularBuf buffer(64 * 1024, Backend::POOLED);
+
+    // No memory is held until the first write.
+    BOOST_ASSERT( pool.get_used_bytes() == used );
+    BOOST_ASSERT( buffer.space() == 64 * 1024 );
+
+    auto sequence = [] (char* dest, uint32_t n, void* data) noexcept -> uint32_t {
+        auto next = static_cast<uint32_t*>(data);
+
+        for (uint32_t i = 0; i < n; ++i) {
+            dest[i] = static_cast<char>((*next)++ % 251);
+        }
+
+        return n;
+    };
+
+    auto expect_sequence = [] (const std::vector<char>& bytes, uint32_t from) {
+        for (uint32_t i = 0; i < bytes.size(); ++i) {
+            if (bytes[i] != static_cast<char>((from + i) % 251)) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    uint32_t next = 0;
+
+    BOOST_ASSERT( buffer.write(sequence, 5000, &next) == 5000 );
+    BOOST_ASSERT( pool.get_used_bytes() == used + 8192 );
+
+    BOOST_ASSERT( expect_sequence(buffer.read(3000), 0) );
+
+    // Wraps round the end of the block, then grows while wrapped.
+    BOOST_ASSERT( buffer.write(sequence, 6000, &next) == 6000 );
+    BOOST_ASSERT( pool.get_used_bytes() == used + 8192 );
+
+    BOOST_ASSERT( buffer.write(sequence, 4000, &next) == 4000 );
+    BOOST_ASSERT( pool.get_used_bytes() == used + 16384 );
+
+    auto bytes = buffer.read();
+    BOOST_ASSERT( bytes.size() == 12000 && expect_sequence(bytes, 3000) );
+
+    // Drained, so the block goes back to the pool.
+    BOOST_ASSERT( buffer.empty() && pool.get_used_bytes() == used );
+
+    // Growth stops at the limit.
+    BOOST_ASSERT( buffer.write(sequence, 100000, &next) == 64 * 1024 );
+    BOOST_ASSERT( buffer.full() && pool.get_used_bytes() == used + 64 * 1024 );
+
+    buffer.clear();
+    BOOST_ASSERT( pool.get_used_bytes() == used );
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_holds_bytes_back_until_the_next_write ) {
+    using Backend = serv::CircularBuf::Backend;
+
+    auto& pool = serv::BufferPool::get();
+    auto used = pool.get_used_bytes();
+
+    serv::CircularBuf buffer(4096, Backend::POOLED);
+    std::string data { "message", 8 };
+    data += "partial";
+
+    BOOST_ASSERT( buffer.write(data) == data.size() );
+
+    // The held bytes are out of sight of reads and searches, but still take up space.
+    buffer.hold(7);
+    BOOST_ASSERT( buffer.size() == 8 && buffer.get_held() == 7 );
+    BOOST_ASSERT( buffer.space() == 4096 - 15 );
+    BOOST_ASSERT( buffer.find('p') == serv::CircularBuf::npos );
+
+    auto message = buffer.read();
+    BOOST_ASSERT( std::string(message.data()) == "message" );
+
+    // Drained of everything but held bytes, a pooled buffer keeps its block.
+    BOOST_ASSERT( buffer.empty() && pool.get_used_bytes() > used );
+
+    // The next write lands after them.
+    BOOST_ASSERT( buffer.write(std::string { " record" }) == 7 );
+    BOOST_ASSERT( buffer.get_held() == 0 );
+
+    auto bytes = buffer.read();
+    BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == "partial record" );
+
+    // Truncating drops them along with the bytes past the cut.
+    BOOST_ASSERT( buffer.write(std::string { "kept, dropped" }) == 13 );
+    buffer.hold(7);
+    buffer.truncate(4);
+    buffer.unhold();
+
+    bytes = buffer.read();
+    BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == "kept" );
+    BOOST_ASSERT( pool.get_used_bytes() == used );
+}
+
+BOOST_AUTO_TEST_CASE( byte_search_levels_agree_with_std_search ) {
+    using Level = serv::ByteSearch::Level;
+
+    std::mt19937 rng { 42 };
+    auto supported = serv::ByteSearch::get_supported_level();
+
+    for (auto level : { Level::SCALAR, Level::SSE2, Level::AVX2 }) {
+        if (level > supported) {
+            break;
+        }
+
+        BOOST_ASSERT( serv::ByteSearch::set_level(level) == level );
+
+        for (int round = 0; round < 500; ++round) {
+            // A small alphabet, so that partial matches are common.
+            std::string data(rng() % 200, 0);
+
+            for (auto& c : data) {
+                c = "ab\r\n"[rng() % 4];
+            }
+
+            std::string needle(1 + rng() % 5, 0);
+
+            for (auto& c : needle) {
+                c = "ab\r\n"[rng() % 4];
+            }
+
+            auto expected = data.find(needle);
+            auto p = serv::ByteSearch::find(data.data(), data.size(), needle.data(), needle.size());
+
+            BOOST_ASSERT( (p == nullptr ? std::string::npos : p - data.data()) == expected );
+
+            expected = data.find(needle[0]);
+            p = serv::ByteSearch::find(data.data(), data.size(), needle[0]);
+
+            BOOST_ASSERT( (p == nullptr ? std::string::npos : p - data.data()) == expected );
+        }
+    }
+
+    serv::ByteSearch::set_level(supported);
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_find_matches_delimiters_across_the_wrap ) {
+    const std::string data = "--------\r\n\r\n--";
+    const std::string delim = "\r\n\r\n";
+
+    // Place the delimiter at every position relative to the end of the underlying array.
+    for (unsigned offset = 0; offset < 16; ++offset) {
+        serv::CircularBuf buffer(16);
+        offset_buffer(buffer, offset);
+
+        std::string cpy = data;
+        buffer.write(cpy);
+
+        BOOST_ASSERT( buffer.find(delim) == 8 );
+        BOOST_ASSERT( buffer.find(delim, 9) == serv::CircularBuf::npos );
+        BOOST_ASSERT( buffer.find('\n', 10) == 11 );
+
+        auto bytes = buffer.read_to(delim);
+        BOOST_ASSERT( std::string(bytes.begin(), bytes.end()) == data.substr(0, 12) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( circ_buf_find_benchmark ) {
+    using namespace std::chrono;
+    using Level = serv::ByteSearch::Level;
+
+    auto name = [] (Level level) {
+        return level == Level::AVX2 ? std::string("avx2") : level == Level::SSE2 ? std::string("sse2") : std::string("scalar");
+    };
+
+    auto supported = serv::ByteSearch::get_supported_level();
+
+    for (uint32_t size : { 1u << 10, 1u << 14, 1u << 16, 1u << 20 }) {
+        // Header-like lines, so that the multi-byte search meets many partial matches, then the message terminator.
+        // The buffer wraps half way through, and each search scans it all.
+        serv::CircularBuf buffer(size);
+        offset_buffer(buffer, size / 2);
+
+        std::string data;
+
+        while (data.size() + 32 < size) {
+            data += "content-type: x\r\n";
+        }
+
+        data.resize(size - 5, 'x');
+        data += std::string("\r\n\r\n\0", 5);
+        buffer.write(data);
+
+        const int rounds = std::max(1u, (64u << 20) / size);
+
+        for (auto level : { Level::SCALAR, Level::SSE2, Level::AVX2 }) {
+            if (level > supported) {
+                break;
+            }
+
+            serv::ByteSearch::set_level(level);
+
+            uint64_t found = 0;
+            auto start = steady_clock::now();
+
+            for (int i = 0; i < rounds; ++i) {
+                found += buffer.find('\0');
+            }
+
+            auto byte_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / rounds;
+
+            start = steady_clock::now();
+
+            for (int i = 0; i < rounds; ++i) {
+                found += buffer.find("\r\n\r\n");
+            }
+
+            auto seq_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / rounds;
+
+            BOOST_ASSERT( found == rounds * (2ull * size - 6) );
+
+            serv::Logger::get().log(
+                "BENCH: circular buffer find: " + std::to_string(size) + " bytes, " + name(level)
+                + ": 1-byte " + std::to_string(byte_ns) + "ns, 4-byte " + std::to_string(seq_ns) + "ns"
+            );
+        }
+    }
+
+    serv::ByteSearch::set_level(supported);
+}
+
 }
\ No newline at end of file
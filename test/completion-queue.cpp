@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+#include <event-base.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "completion-queue.hpp"
+#include "thread-pool.hpp"
+
+struct CompletionQueueFixture {
+    libev::EventBase base;
+    serv::CompletionQueue completions;
+    std::thread::id loop_id;
+    std::thread loop;
+
+    CompletionQueueFixture():
+        completions { &base }
+    {
+        std::atomic<bool> started { false };
+
+        loop = std::thread([this, &started] () {
+            completions.set_loop_thread();
+            loop_id = std::this_thread::get_id();
+            started = true;
+            base.run();
+        });
+
+        while (!started) {
+            std::this_thread::yield();
+        }
+    }
+
+    ~CompletionQueueFixture() {
+        if (loop.joinable()) {
+            completions.post([this] () {
+                base.loopexit();
+            });
+
+            loop.join();
+        }
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE( completion_queue_runs_posted_tasks_on_loop_thread_in_order, CompletionQueueFixture ) {
+    serv::ThreadPool pool { 4 };
+    serv::Strand strand { &pool };
+
+    constexpr int NTASKS = 1000;
+    std::vector<int> order;
+    std::atomic<int> off_loop { 0 };
+    std::atomic<int> done { 0 };
+
+    for (int i = 0; i < NTASKS; ++i) {
+        strand.post([&, i] () {
+            completions.post([&, i] () {
+                if (std::this_thread::get_id() != loop_id) {
+                    ++off_loop;
+                }
+
+                order.push_back(i);
+                ++done;
+            });
+        });
+    }
+
+    strand.join();
+
+    while (done < NTASKS) {
+        std::this_thread::yield();
+    }
+
+    BOOST_ASSERT( off_loop == 0 );
+
+    for (int i = 0; i < NTASKS; ++i) {
+        BOOST_ASSERT( order[i] == i );
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE( completion_queue_dispatch_runs_inline_on_loop_thread, CompletionQueueFixture ) {
+    std::atomic<bool> inline_ran { false };
+    std::atomic<bool> done { false };
+
+    completions.post([&] () {
+        bool ran = false;
+
+        completions.dispatch([&ran] () {
+            ran = true;
+        });
+
+        inline_ran = ran;
+        done = true;
+    });
+
+    while (!done) {
+        std::this_thread::yield();
+    }
+
+    BOOST_ASSERT( inline_ran );
+    BOOST_ASSERT( !completions.in_loop_thread() );
+}
\ No newline at end of file
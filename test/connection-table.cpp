@@ -0,0 +1,155 @@
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include "connection-table.hpp"
+#include "context.hpp"
+#include "epoch.hpp"
+#include "client.hpp"
+#include "helpers.hpp"
+
+struct ConnectionTableFixture {
+    serv::Socket listener;
+    std::deque<test::Client> clients;
+    serv::ConnectionTable table;
+
+    ConnectionTableFixture() {
+        clear_logger();
+        listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE);
+    }
+
+    ~ConnectionTableFixture() {
+        table.clear();
+
+        for (auto& client : clients) {
+            client.try_close();
+        }
+
+        listener.close_fd();
+    }
+
+    void connect() {
+        auto& client = clients.emplace_back("8000");
+        BOOST_ASSERT( client.try_connect() );
+    }
+
+    serv::ConnectionTable::Handle accept() {
+        connect();
+        return accept_pending();
+    }
+
+    serv::ConnectionTable::Handle accept_pending() {
+        serv::SecureSocket sock;
+        BOOST_ASSERT( listener.try_accept(sock) );
+
+        return table.emplace(nullptr, std::move(sock), nullptr);
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE( connection_table_indexes_contexts_by_fd, ConnectionTableFixture ) {
+    constexpr int NCONNS = 3;
+    std::vector<serv::ConnectionTable::Handle> handles;
+
+    for (int i = 0; i < NCONNS; ++i) {
+        handles.push_back(accept());
+        BOOST_ASSERT( handles.back().fd > 0 );
+    }
+
+    BOOST_ASSERT( table.size() == NCONNS );
+    BOOST_ASSERT( table.capacity() == serv::ConnectionTable::SLAB_SLOTS );
+
+    for (const auto& handle : handles) {
+        BOOST_ASSERT( table.get(handle) != nullptr );
+        BOOST_ASSERT( table.get(handle) == table.get(handle.fd) );
+    }
+
+    int visited = 0;
+
+    table.for_each([&visited] (serv::Context& ctx) {
+        ++visited;
+    });
+
+    BOOST_ASSERT( visited == NCONNS );
+    BOOST_ASSERT( table.get(serv::ConnectionTable::Handle {}) == nullptr );
+}
+
+BOOST_FIXTURE_TEST_CASE( connection_table_rejects_stale_handles, ConnectionTableFixture ) {
+    auto first = accept();
+    auto slot = table.get(first);
+
+    // Connect the next client first, so that its own socket does not take the fd about to be freed.
+    connect();
+
+    BOOST_ASSERT( table.erase(first) );
+    BOOST_ASSERT( !table.erase(first) );
+    BOOST_ASSERT( table.get(first) == nullptr );
+    BOOST_ASSERT( table.size() == 0 );
+    BOOST_ASSERT( table.get_retired_count() == 1 );
+
+    while (table.reclaim());
+
+    // The kernel hands out the lowest free fd, so the next connection reuses the fd, and the table the slot.
+    auto second = accept_pending();
+
+    BOOST_ASSERT( second.fd == first.fd );
+    BOOST_ASSERT( second.generation != first.generation );
+    BOOST_ASSERT( table.get(second) == slot );
+    BOOST_ASSERT( table.get(first) == nullptr );
+    BOOST_ASSERT( !table.erase(first) );
+    BOOST_ASSERT( table.size() == 1 );
+}
+
+BOOST_FIXTURE_TEST_CASE( connection_table_grows_by_whole_slabs, ConnectionTableFixture ) {
+    constexpr int NCONNS = serv::ConnectionTable::SLAB_SLOTS + 1;
+
+    for (int i = 0; i < NCONNS; ++i) {
+        BOOST_ASSERT( accept().fd > 0 );
+    }
+
+    BOOST_ASSERT( table.size() == NCONNS );
+    BOOST_ASSERT( table.capacity() == 2 * serv::ConnectionTable::SLAB_SLOTS );
+
+    table.clear();
+
+    BOOST_ASSERT( table.size() == 0 );
+    BOOST_ASSERT( table.capacity() == 2 * serv::ConnectionTable::SLAB_SLOTS );
+}
+
+BOOST_FIXTURE_TEST_CASE( connection_table_defers_reclaiming_while_threads_are_pinned, ConnectionTableFixture ) {
+    auto handle = accept();
+    std::atomic<bool> pinned = false;
+    std::atomic<bool> done = false;
+
+    std::thread worker([&] () {
+        auto guard = serv::Epoch::pin();
+        pinned = true;
+
+        while (!done) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!pinned) {
+        std::this_thread::yield();
+    }
+
+    BOOST_ASSERT( table.erase(handle) );
+    BOOST_ASSERT( table.get(handle) == nullptr );
+
+    for (int i = 0; i < 8; ++i) {
+        BOOST_ASSERT( table.reclaim() == 1 );
+    }
+
+    done = true;
+    worker.join();
+
+    int attempts = 0;
+
+    while (table.reclaim()) {
+        ++attempts;
+    }
+
+    BOOST_ASSERT( attempts <= 2 );
+    BOOST_ASSERT( table.get_retired_count() == 0 );
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <atomic>
+#include "epoch.hpp"
+
+BOOST_AUTO_TEST_CASE( epoch_passes_once_pinned_threads_unpin ) {
+    std::atomic<bool> pinned = false;
+    std::atomic<bool> done = false;
+
+    std::thread worker([&] () {
+        auto guard = serv::Epoch::pin();
+        pinned = true;
+
+        while (!done) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!pinned) {
+        std::this_thread::yield();
+    }
+
+    auto epoch = serv::Epoch::current();
+
+    for (int i = 0; i < 8; ++i) {
+        BOOST_ASSERT( !serv::Epoch::has_passed(epoch) );
+    }
+
+    done = true;
+    worker.join();
+
+    // The worker held the epoch back by one; with it gone, the next attempt completes the second advance.
+    BOOST_ASSERT( serv::Epoch::has_passed(epoch) );
+    BOOST_ASSERT( serv::Epoch::current() == epoch + 2 );
+}
+
+BOOST_AUTO_TEST_CASE( epoch_nested_guards_stay_pinned_until_the_outermost_exits ) {
+    std::atomic<int> stage = 0;
+    std::atomic<bool> proceed = false;
+
+    std::thread worker([&] () {
+        auto outer = serv::Epoch::pin();
+
+        {
+            auto inner = serv::Epoch::pin();
+        }
+
+        stage = 1;
+
+        while (!proceed) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (stage != 1) {
+        std::this_thread::yield();
+    }
+
+    auto epoch = serv::Epoch::current();
+
+    for (int i = 0; i < 8; ++i) {
+        BOOST_ASSERT( !serv::Epoch::has_passed(epoch) );
+    }
+
+    proceed = true;
+    worker.join();
+
+    while (!serv::Epoch::has_passed(epoch));
+}
\ No newline at end of file
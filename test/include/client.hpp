@@ -24,8 +24,12 @@ class Client {
         crpt::Crypt aes { "AES-256-CBC" };
         crpt::Exchange dh { "ffdhe2048" };
         bool secure = false;
+        serv::Framing framing = serv::Framing::NULL_DELIMITED;
+        uint32_t key_groups = serv::ALL_KEY_GROUPS;
+        serv::ChannelCipher cipher = serv::ChannelCipher::AES_256_GCM;
         serv::Socket sock;
         serv::SecureSocket ssock;
+        std::optional<serv::Session> session;
         
     public:
         Client(): port { "3993" }, fd { 0 } {};
@@ -59,9 +63,22 @@ class Client {
         bool handshake_init() {
             secure = false;
             ssock = serv::SecureSocket(std::move(sock));
+            ssock.set_preferred_framing(framing);
+            ssock.set_key_groups(key_groups);
+            ssock.set_preferred_cipher(cipher);
             return ssock.handshake_accept();
         }
 
+        /**
+         * @brief Resumes the session from an earlier handshake, see set_session(), sending `early` along with the ticket.
+         */
+        bool handshake_resume(const std::vector<std::string>& early = {}) {
+            secure = false;
+            ssock = serv::SecureSocket(std::move(sock));
+            ssock.set_key_groups(key_groups);
+            return session.has_value() && ssock.handshake_resume(*session, early);
+        }
+
         bool handshake_final() {
             if (ssock.handshake_confirm()) {
                 secure = true;
@@ -71,6 +88,55 @@ class Client {
             return false;
         }
 
+        /**
+         * @brief Sets the framing mode of the plain socket, and the mode to ask for in the next handshake.
+         */
+        void set_framing(serv::Framing f) {
+            framing = f;
+            sock.set_framing(f);
+        }
+
+        /**
+         * @brief Sets the key groups to choose from in the next handshake.
+         */
+        void set_key_groups(uint32_t groups) {
+            key_groups = groups;
+        }
+
+        /**
+         * @brief Sets the channel cipher to ask for in the next handshake.
+         */
+        void set_cipher(serv::ChannelCipher c) {
+            cipher = c;
+        }
+
+        serv::ChannelCipher get_cipher() const {
+            return ssock.get_cipher();
+        }
+
+        serv::KeyGroup get_key_group() const {
+            return ssock.get_key_group();
+        }
+
+        /**
+         * @brief Get the session to resume on the next connection, once the host's ticket has been received.
+         */
+        const std::optional<serv::Session>& get_session() const {
+            return session;
+        }
+
+        void set_session(const std::optional<serv::Session>& s) {
+            session = s;
+        }
+
+        bool is_resumed() const {
+            return ssock.is_resumed();
+        }
+
+        serv::Framing get_framing() const {
+            return secure ? ssock.get_framing() : sock.get_framing();
+        }
+
         bool try_close() {
             return sock.close_fd() || ssock.close_fd();
         }
@@ -86,6 +152,14 @@ class Client {
         std::string try_recv() {
             if (secure) {
                 ssock.try_recv();
+
+                // Kept by the client, since the socket is replaced on the next connection.
+                auto& issued = ssock.get_session();
+
+                if (issued.has_value() && (!session.has_value() || (session->ticket != issued->ticket || session->id != issued->id))) {
+                    session = issued;
+                }
+
                 return ssock.read_buffer();
             } else {
                 sock.try_recv();
@@ -93,6 +167,13 @@ class Client {
             }
         }
 
+        /**
+         * @brief Reads whatever bytes are available straight from the connected socket, bypassing the buffer.
+         */
+        ssize_t try_recv_raw(char* dest, size_t n) {
+            return recv(secure ? ssock.get_fd() : sock.get_fd(), dest, n, 0);
+        }
+
         const evutil_socket_t get_fd() const {
             return fd;
         }
@@ -3,10 +3,20 @@
 
 #include <iostream>
 #include <vector>
+#include <cstdint>
 #include <thread>
 #include <boost/test/unit_test.hpp>
 #include "logger.hpp"
 
+extern thread_local uint64_t test_allocations;
+
+/**
+ * @brief Get the number of allocations made through new on the calling thread so far.
+ */
+inline uint64_t count_allocations() {
+    return test_allocations;
+}
+
 inline void clear_logger() {
     serv::Logger::get().clear_buf();
 }
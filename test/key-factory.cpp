@@ -0,0 +1,71 @@
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <set>
+#include "key-factory.hpp"
+#include "logger.hpp"
+
+BOOST_AUTO_TEST_CASE( key_factory_hands_out_pregenerated_keys ) {
+    constexpr size_t CAPACITY = 4;
+    serv::KeyFactory factory { serv::KeyGroup::FFDHE2048, CAPACITY };
+
+    BOOST_ASSERT( factory.wait_until_full(std::chrono::seconds(10)) );
+    BOOST_ASSERT( factory.get_stats().available == CAPACITY );
+
+    std::set<std::vector<char>> public_keys;
+
+    for (size_t i = 0; i < CAPACITY; ++i) {
+        auto key = factory.acquire();
+        BOOST_ASSERT( key != nullptr );
+        public_keys.insert(key->get_public_key());
+    }
+
+    auto stats = factory.get_stats();
+
+    BOOST_ASSERT( public_keys.size() == CAPACITY );
+    BOOST_ASSERT( stats.hits == CAPACITY );
+    BOOST_ASSERT( stats.misses == 0 );
+    BOOST_ASSERT( stats.generated >= CAPACITY );
+    BOOST_ASSERT( stats.refill_rate > 0 );
+
+    factory.set_capacity(0);
+    BOOST_ASSERT( factory.acquire() != nullptr );
+
+    stats = factory.get_stats();
+
+    BOOST_ASSERT( stats.available == 0 );
+    BOOST_ASSERT( stats.misses == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( key_factory_acquire_benchmark ) {
+    constexpr size_t NKEYS = 32;
+
+    serv::KeyFactory pooled { serv::KeyGroup::FFDHE2048, NKEYS };
+    serv::KeyFactory inline_only { serv::KeyGroup::FFDHE2048, 0 };
+
+    BOOST_ASSERT( pooled.wait_until_full(std::chrono::seconds(30)) );
+
+    auto time_acquires = [] (serv::KeyFactory& factory) {
+        std::vector<std::unique_ptr<serv::KeyExchange>> keys;
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < NKEYS; ++i) {
+            keys.push_back(factory.acquire());
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / NKEYS;
+    };
+
+    auto pooled_ns = time_acquires(pooled);
+    auto inline_ns = time_acquires(inline_only);
+    auto stats = pooled.get_stats();
+
+    serv::Logger::get().log(
+        "BENCH: key-factory: acquire: " + std::to_string(pooled_ns) + "ns pooled, " + std::to_string(inline_ns) + "ns inline; "
+        + std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) + " misses, refill rate "
+        + std::to_string(stats.refill_rate) + " keys/s"
+    );
+
+    BOOST_ASSERT( stats.misses == 0 );
+    BOOST_ASSERT( pooled_ns < inline_ns );
+}
\ No newline at end of file
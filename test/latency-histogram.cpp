@@ -0,0 +1,61 @@
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <vector>
+#include "latency-histogram.hpp"
+
+BOOST_AUTO_TEST_CASE( latency_histogram_percentiles_are_within_a_bucket ) {
+    serv::LatencyHistogram h;
+
+    BOOST_ASSERT( h.percentile(0.99) == 0 );
+
+    for (uint64_t us = 1; us <= 1000; ++us) {
+        h.record(us);
+    }
+
+    auto summary = h.summarize();
+
+    BOOST_ASSERT( summary.samples == 1000 );
+    BOOST_ASSERT( summary.max == 1000 );
+
+    // Buckets are a quarter of a power of two wide, so a percentile is never more than 25% above the exact value.
+    BOOST_ASSERT( summary.p50 >= 500 && summary.p50 <= 625 );
+    BOOST_ASSERT( summary.p99 >= 990 && summary.p99 <= 1000 );
+    BOOST_ASSERT( h.percentile(0) == 1 );
+    BOOST_ASSERT( h.percentile(1) == 1000 );
+
+    h.record(UINT64_MAX);
+    BOOST_ASSERT( h.percentile(1) == UINT64_MAX );
+
+    h.reset();
+    BOOST_ASSERT( h.get_samples() == 0 );
+    BOOST_ASSERT( h.percentile(0.5) == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( latency_histogram_merges_concurrent_recordings ) {
+    constexpr int NTHREADS = 4;
+    constexpr int NSAMPLES = 10000;
+
+    serv::LatencyHistogram hs[NTHREADS];
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < NTHREADS; ++i) {
+        threads.emplace_back([&h = hs[i], i] () {
+            for (int j = 0; j < NSAMPLES; ++j) {
+                h.record(i * 100 + j % 100);
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    serv::LatencyHistogram total;
+
+    for (const auto& h : hs) {
+        total.merge(h);
+    }
+
+    BOOST_ASSERT( total.get_samples() == NTHREADS * NSAMPLES );
+    BOOST_ASSERT( total.summarize().max == (NTHREADS - 1) * 100 + 99 );
+}
\ No newline at end of file
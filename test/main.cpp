@@ -2,9 +2,129 @@
 
 #include <boost/test/unit_test.hpp>
 #include <fstream>
+#include <cstdlib>
+#include <new>
 #include <crypt/error.hpp>
 #include "logger.hpp"
 
+thread_local uint64_t test_allocations = 0;
+
+namespace {
+
+void* allocate(size_t n) noexcept {
+    ++test_allocations;
+    return std::malloc(n ? n : 1);
+}
+
+void* allocate_or_throw(size_t n) {
+    if (auto p = allocate(n)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+void* allocate(size_t n, std::align_val_t al) noexcept {
+    auto align = static_cast<size_t>(al);
+    ++test_allocations;
+
+    // aligned_alloc wants a size that is a multiple of the alignment.
+    return std::aligned_alloc(align, ((n ? n : 1) + align - 1) / align * align);
+}
+
+void* allocate_or_throw(size_t n, std::align_val_t al) {
+    if (auto p = allocate(n, al)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+}
+
+// Counts every allocation made through new on the calling thread, for tests that check a path does not allocate. Every
+// replaceable form is replaced, over-aligned ones included, so that none escapes the count and memory is always returned
+// the way it was taken.
+void* operator new(size_t n) {
+    return allocate_or_throw(n);
+}
+
+void* operator new[](size_t n) {
+    return allocate_or_throw(n);
+}
+
+void* operator new(size_t n, const std::nothrow_t&) noexcept {
+    return allocate(n);
+}
+
+void* operator new[](size_t n, const std::nothrow_t&) noexcept {
+    return allocate(n);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void* operator new(size_t n, std::align_val_t al) {
+    return allocate_or_throw(n, al);
+}
+
+void* operator new[](size_t n, std::align_val_t al) {
+    return allocate_or_throw(n, al);
+}
+
+void* operator new(size_t n, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return allocate(n, al);
+}
+
+void* operator new[](size_t n, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return allocate(n, al);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
 struct GlobalFixture {
     
     std::ofstream tout { "test/zout.txt", std::ios::out | std::ios::trunc };
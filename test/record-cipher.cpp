@@ -0,0 +1,195 @@
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include "record-cipher.hpp"
+
+namespace {
+
+const std::vector<char> KEY(serv::RecordCipher::KEY_SIZE, 'k');
+const std::vector<char> IV(16, 'i');
+
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_round_trips_records_in_both_directions ) {
+    for (auto cipher : { serv::ChannelCipher::AES_256_GCM, serv::ChannelCipher::CHACHA20_POLY1305 }) {
+        serv::RecordCipher host { cipher, KEY, IV, true };
+        serv::RecordCipher peer { cipher, KEY, IV, false };
+
+        BOOST_ASSERT( host.is_valid() && peer.is_valid() );
+
+        std::vector<char> records;
+        std::vector<std::string> messages { "first", "", "third message" };
+
+        for (const auto& m : messages) {
+            BOOST_ASSERT( host.seal(m.data(), m.size(), records) );
+        }
+
+        BOOST_ASSERT( records.size() == 18 + 3 * serv::RecordCipher::OVERHEAD );
+
+        // Records coalesced into one read are opened one after the other.
+        size_t offset = 0;
+
+        for (const auto& m : messages) {
+            std::vector<char> plain_text;
+            auto n = peer.open(records.data() + offset, records.size() - offset, plain_text);
+
+            BOOST_ASSERT( n == m.size() + serv::RecordCipher::OVERHEAD );
+            BOOST_ASSERT( std::string(plain_text.begin(), plain_text.end()) == m );
+            offset += n;
+        }
+
+        // The other direction uses its own nonces, so the host cannot open what it sealed itself.
+        std::vector<char> reply, plain_text;
+        BOOST_ASSERT( peer.seal("ok", 2, reply) );
+        BOOST_ASSERT( host.open(reply.data(), reply.size(), plain_text) > 0 );
+
+        serv::RecordCipher other_host { cipher, KEY, IV, true };
+        std::vector<char> own;
+        BOOST_ASSERT( other_host.seal("ok", 2, own) );
+        BOOST_ASSERT( other_host.open(own.data(), own.size(), plain_text) == -1 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_waits_for_complete_records ) {
+    serv::RecordCipher host { serv::ChannelCipher::AES_256_GCM, KEY, IV, true };
+    serv::RecordCipher peer { serv::ChannelCipher::AES_256_GCM, KEY, IV, false };
+
+    std::vector<char> record, plain_text;
+    BOOST_ASSERT( host.seal("partial", 7, record) );
+
+    for (size_t n = 0; n < record.size(); ++n) {
+        BOOST_ASSERT( peer.open(record.data(), n, plain_text) == 0 );
+    }
+
+    BOOST_ASSERT( plain_text.empty() );
+    BOOST_ASSERT( peer.open(record.data(), record.size(), plain_text) == record.size() );
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_rejects_tampered_and_replayed_records ) {
+    serv::RecordCipher host { serv::ChannelCipher::AES_256_GCM, KEY, IV, true };
+
+    std::vector<char> record, plain_text;
+    BOOST_ASSERT( host.seal("payload", 7, record) );
+
+    auto tampered = record;
+    tampered[serv::RecordCipher::LENGTH_SIZE] ^= 1;
+
+    serv::RecordCipher peer { serv::ChannelCipher::AES_256_GCM, KEY, IV, false };
+    BOOST_ASSERT( peer.open(tampered.data(), tampered.size(), plain_text) == -1 );
+    BOOST_ASSERT( plain_text.empty() );
+
+    // A failed record leaves the channel unusable, even for the genuine record.
+    BOOST_ASSERT( !peer.is_valid() );
+    BOOST_ASSERT( peer.open(record.data(), record.size(), plain_text) == -1 );
+
+    // Replaying a record fails, since the next record is expected under the next nonce.
+    serv::RecordCipher fresh { serv::ChannelCipher::AES_256_GCM, KEY, IV, false };
+    BOOST_ASSERT( fresh.open(record.data(), record.size(), plain_text) > 0 );
+    BOOST_ASSERT( fresh.open(record.data(), record.size(), plain_text) == -1 );
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_is_invalid_without_a_known_cipher_or_key ) {
+    BOOST_ASSERT( !serv::RecordCipher(static_cast<serv::ChannelCipher>(7), KEY, IV, true).is_valid() );
+    BOOST_ASSERT( !serv::RecordCipher(serv::ChannelCipher::AES_256_GCM, { 'k' }, IV, true).is_valid() );
+    BOOST_ASSERT( !serv::RecordCipher(serv::ChannelCipher::AES_256_GCM, KEY, { 'i' }, true).is_valid() );
+    BOOST_ASSERT( !serv::RecordCipher(serv::ChannelCipher::AES_256_CBC, KEY, std::vector<char>(12, 'i'), true).is_valid() );
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_pads_cbc_records_to_whole_blocks ) {
+    serv::RecordCipher host { serv::ChannelCipher::AES_256_CBC, KEY, IV, true };
+    serv::RecordCipher peer { serv::ChannelCipher::AES_256_CBC, KEY, IV, false };
+
+    BOOST_ASSERT( host.is_valid() && peer.is_valid() );
+    BOOST_ASSERT( host.get_tag_size() == serv::RecordCipher::TAG_SIZE );
+
+    // Messages either side of a block boundary, each padded by at least one byte.
+    std::vector<std::string> messages { "", "fifteen bytes..", "sixteen bytes...", "seventeen bytes.." };
+    std::vector<char> records;
+
+    for (const auto& m : messages) {
+        BOOST_ASSERT( host.seal(m.data(), m.size(), records) );
+    }
+
+    BOOST_ASSERT( records.size() == 4 * serv::RecordCipher::OVERHEAD + 16 + 16 + 32 + 32 );
+
+    size_t offset = 0;
+
+    for (const auto& m : messages) {
+        std::vector<char> plain_text;
+        auto n = peer.open(records.data() + offset, records.size() - offset, plain_text);
+
+        BOOST_ASSERT( n == host.sealed_size(m.size()) );
+        BOOST_ASSERT( std::string(plain_text.begin(), plain_text.end()) == m );
+        offset += n;
+    }
+
+    // The same message sealed twice differs, since every record is encrypted under its own IV.
+    std::vector<char> first, second;
+    BOOST_ASSERT( host.seal("again", 5, first) && host.seal("again", 5, second) );
+    BOOST_ASSERT( first != second );
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_opens_split_records_in_place ) {
+    const std::string message = "a message that spans several cipher blocks, split at every point";
+
+    for (auto cipher : { serv::ChannelCipher::AES_256_CBC, serv::ChannelCipher::AES_256_GCM }) {
+        // Each record is split in two at a different point, as it would be where it wraps round a CircularBuf.
+        for (size_t split = 0; split <= 48; ++split) {
+            serv::RecordCipher host { cipher, KEY, IV, true };
+            serv::RecordCipher peer { cipher, KEY, IV, false };
+
+            std::vector<char> record;
+            BOOST_ASSERT( host.seal(message.data(), message.size(), record) );
+
+            auto tag_size = peer.get_tag_size();
+            auto body = record.size() - serv::RecordCipher::LENGTH_SIZE - tag_size;
+
+            std::vector<char> head(record.begin() + serv::RecordCipher::LENGTH_SIZE, record.begin() + serv::RecordCipher::LENGTH_SIZE + split);
+            std::vector<char> tail(record.begin() + serv::RecordCipher::LENGTH_SIZE + split, record.end() - tag_size);
+            iovec iov[] { { head.data(), head.size() }, { tail.data(), tail.size() } };
+
+            auto m = peer.open_in_place(record.data(), iov, 2, record.data() + record.size() - tag_size);
+            BOOST_ASSERT( m == message.size() );
+
+            head.insert(head.end(), tail.begin(), tail.end());
+            BOOST_ASSERT( body == head.size() );
+            BOOST_ASSERT( std::string(head.begin(), head.begin() + m) == message );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( record_cipher_rejects_malformed_cbc_records ) {
+    serv::RecordCipher host { serv::ChannelCipher::AES_256_CBC, KEY, IV, true };
+
+    std::vector<char> record, plain_text;
+    BOOST_ASSERT( host.seal("payload", 7, record) );
+
+    // A body that is not whole blocks is rejected before it is decrypted.
+    auto truncated = record;
+    truncated[serv::RecordCipher::LENGTH_SIZE - 1] -= 1;
+    truncated.pop_back();
+
+    serv::RecordCipher peer { serv::ChannelCipher::AES_256_CBC, KEY, IV, false };
+    BOOST_ASSERT( peer.open(truncated.data(), truncated.size(), plain_text) == -1 );
+    BOOST_ASSERT( !peer.is_valid() );
+
+    // Nor does a record open under the wrong IV.
+    serv::RecordCipher wrong { serv::ChannelCipher::AES_256_CBC, KEY, std::vector<char>(16, 'j'), false };
+    BOOST_ASSERT( wrong.open(record.data(), record.size(), plain_text) == -1 );
+    BOOST_ASSERT( plain_text.empty() );
+
+    // Any change to the cipher text or the tag, including one that only disturbs the padding, fails authentication alike.
+    for (size_t i = serv::RecordCipher::LENGTH_SIZE; i < record.size(); ++i) {
+        auto tampered = record;
+        tampered[i] ^= 0x01;
+
+        serv::RecordCipher opener { serv::ChannelCipher::AES_256_CBC, KEY, IV, false };
+        BOOST_ASSERT( opener.open(tampered.data(), tampered.size(), plain_text) == -1 );
+        BOOST_ASSERT( plain_text.empty() );
+    }
+
+    // A record replayed after it was opened is not authentic for the next sequence number.
+    serv::RecordCipher replayed { serv::ChannelCipher::AES_256_CBC, KEY, IV, false };
+    BOOST_ASSERT( replayed.open(record.data(), record.size(), plain_text) == int64_t(record.size()) );
+    BOOST_ASSERT( replayed.open(record.data(), record.size(), plain_text) == -1 );
+}
\ No newline at end of file
@@ -1,11 +1,20 @@
 #include <boost/test/unit_test.hpp>
 #include <chrono>
 #include <thread>
+#include <deque>
+#include <numeric>
+#include <algorithm>
+#include <malloc.h>
+#include <ctime>
+#include <optional>
+#include <netinet/tcp.h>
 #include "socket.hpp"
 #include "secure-socket.hpp"
+#include "buffer-pool.hpp"
 #include "error-codes.hpp"
 #include "helpers.hpp"
 #include "client.hpp"
+#include "host-handshake.pb.h"
 #include "peer-handshake.pb.h"
 
 BOOST_AUTO_TEST_CASE( test_secure_socket_handshake_init_fails ) {
@@ -50,6 +59,42 @@ BOOST_FIXTURE_TEST_CASE( test_secure_socket_handshake_final, SecureSockFixture )
     BOOST_ASSERT( client.handshake_final() );
 }
 
+BOOST_FIXTURE_TEST_CASE( test_secure_socket_handshake_final_in_phases, SecureSockFixture ) {
+    BOOST_ASSERT( sender.handshake_init() );
+    BOOST_ASSERT( client.handshake_init() );
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.handshake_read() );
+
+    // Only the derivation leaves the thread that does the socket I/O.
+    auto derived = false;
+    std::thread worker([&] () {
+        derived = sender.handshake_derive();
+    });
+    worker.join();
+
+    BOOST_ASSERT( derived );
+    BOOST_ASSERT( sender.handshake_complete() );
+    BOOST_ASSERT( client.handshake_final() );
+
+    BOOST_ASSERT( client.try_send("hello") );
+    tiny_sleep();
+
+    sender.try_recv();
+    BOOST_ASSERT( sender.read_buffer() == "hello" );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_handshake_complete_fails_before_derive ) {
+    clear_logger();
+
+    serv::SecureSocket sock;
+
+    BOOST_ASSERT( !sock.handshake_derive() );
+    ASSERT_ERR_LOGGED( ERR_SECURE_SOCKET_HANDSHAKE_FINAL_DERIVE_FAILED );
+    BOOST_ASSERT( !sock.handshake_complete() );
+    ASSERT_ERR_LOGGED( ERR_SECURE_SOCKET_HANDSHAKE_FINAL_FAILED );
+}
+
 BOOST_FIXTURE_TEST_CASE( test_secure_socket_handshake_final_fails_on_close, SecureSockFixture ) {
     sender.handshake_init();
 
@@ -116,4 +161,1029 @@ BOOST_FIXTURE_TEST_CASE( test_secure_socket_data_sent_matches_data_recv, SecureS
 
     auto recvd = sender.flush_buffer();
     BOOST_ASSERT( std::string(recvd.begin(), recvd.end() - 1) == data);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_secure_socket_negotiates_length_prefixed_framing, SecureSockFixture ) {
+    client.set_framing(serv::Framing::LENGTH_PREFIXED);
+
+    sender.handshake_init();
+    client.handshake_init();
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.handshake_final() );
+    BOOST_ASSERT( client.handshake_final() );
+
+    BOOST_ASSERT( sender.get_framing() == serv::Framing::LENGTH_PREFIXED );
+    BOOST_ASSERT( client.get_framing() == serv::Framing::LENGTH_PREFIXED );
+
+    const std::string binary { "\0\1\2\0", 4 };
+    BOOST_ASSERT( client.try_send(binary) );
+
+    tiny_sleep();
+    auto [len, can_write] = sender.try_recv();
+    BOOST_ASSERT( len > -1 );
+    BOOST_ASSERT( sender.read_buffer() == binary );
+}
+
+BOOST_FIXTURE_TEST_CASE( test_secure_socket_defaults_to_null_delimited_framing, SecureSockFixture ) {
+    sender.handshake_init();
+    client.handshake_init();
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.handshake_final() );
+    BOOST_ASSERT( client.handshake_final() );
+
+    BOOST_ASSERT( sender.get_framing() == serv::Framing::NULL_DELIMITED );
+}
+
+struct KeyGroupTestCase {
+    uint32_t host_groups;
+    uint32_t peer_groups;
+    bool expecting;
+    serv::KeyGroup group;
+};
+
+constexpr auto FFDHE2048_ONLY = serv::key_group_bit(serv::KeyGroup::FFDHE2048);
+constexpr auto X25519_ONLY = serv::key_group_bit(serv::KeyGroup::X25519);
+
+std::vector<KeyGroupTestCase> key_group_tests {
+    { serv::ALL_KEY_GROUPS, serv::ALL_KEY_GROUPS, true, serv::KeyGroup::X25519 },
+    { serv::ALL_KEY_GROUPS, FFDHE2048_ONLY, true, serv::KeyGroup::FFDHE2048 },
+    { FFDHE2048_ONLY, serv::ALL_KEY_GROUPS, true, serv::KeyGroup::FFDHE2048 },
+    { X25519_ONLY, X25519_ONLY, true, serv::KeyGroup::X25519 },
+    { X25519_ONLY, FFDHE2048_ONLY, false, serv::KeyGroup::FFDHE2048 },
+};
+
+void do_key_group_test(const KeyGroupTestCase& test) {
+    SecureSockFixture f;
+
+    f.sender.set_key_groups(test.host_groups);
+    f.client.set_key_groups(test.peer_groups);
+
+    BOOST_ASSERT( f.sender.handshake_init() );
+    BOOST_ASSERT( f.client.handshake_init() == test.expecting );
+
+    if (!test.expecting) {
+        return;
+    }
+
+    tiny_sleep();
+    BOOST_ASSERT( f.sender.handshake_final() );
+    BOOST_ASSERT( f.client.handshake_final() );
+
+    BOOST_ASSERT( f.sender.get_key_group() == test.group );
+    BOOST_ASSERT( f.client.get_key_group() == test.group );
+
+    // Both sides must have derived the same key.
+    auto data = "0123456789";
+    BOOST_ASSERT( f.client.try_send(data) );
+
+    tiny_sleep();
+    auto [len, can_write] = f.sender.try_recv();
+    BOOST_ASSERT( len > -1 );
+    BOOST_ASSERT( f.sender.read_buffer() == data );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_negotiates_key_group_table_test ) {
+    RUN_TEST_CASES<KeyGroupTestCase>( do_key_group_test, key_group_tests );
+}
+
+struct CipherTestCase {
+    serv::ChannelCipher preferred;
+    serv::ChannelCipher cipher;
+};
+
+std::vector<CipherTestCase> cipher_tests {
+    { serv::ChannelCipher::AES_256_GCM, serv::ChannelCipher::AES_256_GCM },
+    { serv::ChannelCipher::CHACHA20_POLY1305, serv::ChannelCipher::CHACHA20_POLY1305 },
+    { serv::ChannelCipher::AES_256_CBC, serv::ChannelCipher::AES_256_CBC },
+};
+
+void do_cipher_test(const CipherTestCase& test) {
+    SecureSockFixture f;
+
+    f.client.set_cipher(test.preferred);
+
+    BOOST_ASSERT( f.sender.handshake_init() );
+    BOOST_ASSERT( f.client.handshake_init() );
+
+    tiny_sleep();
+    BOOST_ASSERT( f.sender.handshake_final() );
+    BOOST_ASSERT( f.client.handshake_final() );
+
+    BOOST_ASSERT( f.sender.get_cipher() == test.cipher );
+    BOOST_ASSERT( f.client.get_cipher() == test.cipher );
+
+    // Several messages each way, so that both directions move through their nonces.
+    for (int i = 0; i < 4; ++i) {
+        auto data = "message " + std::to_string(i);
+
+        BOOST_ASSERT( f.client.try_send(data) );
+        tiny_sleep();
+
+        auto [len, can_write] = f.sender.try_recv();
+        BOOST_ASSERT( len > -1 );
+        BOOST_ASSERT( f.sender.read_buffer() == data );
+
+        BOOST_ASSERT( f.sender.try_send(data) );
+        BOOST_ASSERT( f.client.try_recv() == data );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_negotiates_cipher_table_test ) {
+    RUN_TEST_CASES<CipherTestCase>( do_cipher_test, cipher_tests );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_rejects_forged_records ) {
+    clear_logger();
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    serv::Socket connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+    serv::SecureSocket host, peer { std::move(connecting) };
+    BOOST_ASSERT( listener.try_accept(host) );
+
+    BOOST_ASSERT( host.handshake_init() );
+    BOOST_ASSERT( peer.handshake_accept() );
+    BOOST_ASSERT( host.handshake_final() );
+    BOOST_ASSERT( peer.handshake_confirm() );
+    BOOST_ASSERT( host.get_cipher() == serv::ChannelCipher::AES_256_GCM );
+
+    // A well-formed record of 5 bytes, under a tag that was never computed.
+    std::vector<char> forged { 0, 0, 0, 5, 'h', 'e', 'l', 'l', 'o' };
+    forged.resize(forged.size() + serv::RecordCipher::TAG_SIZE);
+
+    BOOST_ASSERT( static_cast<serv::Socket&>(peer).try_send(forged) );
+    tiny_sleep();
+
+    auto [len, can_write] = host.try_recv();
+    BOOST_ASSERT( len == -1 );
+    BOOST_ASSERT( host.read_buffer().empty() );
+    ASSERT_ERR_LOGGED( ERR_SECURE_SOCKET_RECV_FAILED );
+
+    listener.close_fd();
+}
+
+struct SplitRecordTestCase {
+    serv::ChannelCipher cipher;
+    bool host_offers_records;
+};
+
+std::vector<SplitRecordTestCase> split_record_tests {
+    { serv::ChannelCipher::AES_256_CBC, true },
+    { serv::ChannelCipher::AES_256_GCM, true },
+    { serv::ChannelCipher::CHACHA20_POLY1305, true },
+    { serv::ChannelCipher::AES_256_CBC, false },
+};
+
+/**
+ * @brief Receives from `from` until at least `n` bytes have arrived, or a second has passed.
+ */
+std::vector<char> relay_recv(serv::Socket& from, size_t n = 1) {
+    std::vector<char> bytes;
+
+    for (int i = 0; i < 1000 && bytes.size() < n; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        from.try_recv();
+
+        auto more = from.flush_buffer();
+        bytes.insert(bytes.end(), more.begin(), more.end());
+    }
+
+    return bytes;
+}
+
+void do_split_record_test(const SplitRecordTestCase& test) {
+    clear_logger();
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    // Host and peer talk through a relay, which passes their bytes on in whatever pieces the test chooses.
+    serv::Socket host_end, peer_end, connecting;
+    serv::SecureSocket host;
+
+    BOOST_ASSERT( host_end.try_connect("", "8000", false) );
+    BOOST_ASSERT( listener.try_accept(host) );
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+    BOOST_ASSERT( listener.try_accept(peer_end) );
+
+    serv::SecureSocket peer { std::move(connecting) };
+    peer.set_preferred_cipher(test.cipher);
+
+    // No ticket, so that only the messages below cross the relay.
+    peer.set_tickets(false);
+
+    int nodelay = 1;
+    setsockopt(peer_end.get_fd(), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    BOOST_ASSERT( host.handshake_init() );
+    auto init = relay_recv(host_end);
+
+    // A host that predates records, as far as the peer can tell.
+    if (!test.host_offers_records) {
+        serv::proto::HostHandshake host_hs;
+        BOOST_ASSERT( host_hs.ParseFromArray(init.data(), init.size() - 1) );
+        host_hs.set_records(false);
+
+        auto data = host_hs.SerializeAsString();
+        init.assign(data.begin(), data.end());
+        init.push_back(0);
+    }
+
+    BOOST_ASSERT( peer_end.try_send(init) );
+    relay_recv(peer, 0);
+    BOOST_ASSERT( peer.handshake_accept() );
+
+    BOOST_ASSERT( host_end.try_send(relay_recv(peer_end)) );
+    BOOST_ASSERT( host.handshake_final() );
+
+    BOOST_ASSERT( peer_end.try_send(relay_recv(host_end, 2)) );
+    BOOST_ASSERT( peer.handshake_confirm() );
+    BOOST_ASSERT( peer.get_cipher() == test.cipher );
+
+    std::vector<std::string> messages { "first", "a second, longer message, that spans several cipher blocks", "third" };
+
+    // The size each message travels in, with its null-terminator, as a record or as a bare CBC cipher text.
+    serv::RecordCipher sizing { test.cipher, std::vector<char>(serv::RecordCipher::KEY_SIZE), std::vector<char>(16), true };
+    std::vector<size_t> sizes;
+
+    for (const auto& m : messages) {
+        sizes.push_back(sizing.sealed_size(m.size() + 1) - (test.host_offers_records ? 0 : serv::RecordCipher::OVERHEAD));
+    }
+
+    if (!test.host_offers_records) {
+        // Bare cipher texts only decrypt one at a time, so each is passed on alone.
+        for (size_t i = 0; i < messages.size(); ++i) {
+            BOOST_ASSERT( host.try_send(messages[i]) );
+
+            auto bytes = relay_recv(host_end, sizes[i]);
+            BOOST_ASSERT( bytes.size() == sizes[i] );
+            BOOST_ASSERT( peer_end.try_send(bytes) );
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            BOOST_ASSERT( peer.try_recv().first > -1 );
+            BOOST_ASSERT( peer.read_buffer() == messages[i] );
+        }
+
+        listener.close_fd();
+        return;
+    }
+
+    auto total = std::accumulate(sizes.begin(), sizes.end(), size_t(0));
+    auto text = std::accumulate(messages.begin(), messages.end(), size_t(0), [] (size_t n, const std::string& m) {
+        return n + m.size() + 1;
+    });
+
+    // Coalesced: every record arrives in one read, and is opened in the same pass.
+    for (const auto& m : messages) {
+        BOOST_ASSERT( host.try_send(m) );
+    }
+
+    auto bytes = relay_recv(host_end, total);
+    BOOST_ASSERT( bytes.size() == total );
+    BOOST_ASSERT( peer_end.try_send(bytes) );
+
+    std::pair<int32_t, uint32_t> received { 0, 0 };
+
+    for (int i = 0; i < 1000 && received.first == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        received = peer.try_recv();
+    }
+
+    BOOST_ASSERT( received.first == text );
+
+    for (const auto& m : messages) {
+        BOOST_ASSERT( peer.read_buffer() == m );
+    }
+
+    // Split: the records arrive a few bytes at a time, and each message appears only once its record is whole.
+    for (const auto& m : messages) {
+        BOOST_ASSERT( host.try_send(m) );
+    }
+
+    bytes = relay_recv(host_end, total);
+    BOOST_ASSERT( bytes.size() == total );
+
+    constexpr size_t PIECE = 7;
+    size_t delivered = 0;
+    size_t nread = 0;
+
+    while (delivered < bytes.size()) {
+        auto n = std::min(PIECE, bytes.size() - delivered);
+
+        BOOST_ASSERT( peer_end.try_send(std::vector<char>(bytes.begin() + delivered, bytes.begin() + delivered + n)) );
+        delivered += n;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        BOOST_ASSERT( peer.try_recv().first > -1 );
+
+        for (auto m = peer.read_buffer(); !m.empty(); m = peer.read_buffer()) {
+            BOOST_ASSERT( nread < messages.size() );
+            BOOST_ASSERT( m == messages[nread++] );
+        }
+
+        size_t whole = 0;
+
+        for (size_t i = 0, end = 0; i < sizes.size() && (end += sizes[i]) <= delivered; ++i) {
+            ++whole;
+        }
+
+        BOOST_ASSERT( nread == whole );
+    }
+
+    BOOST_ASSERT( nread == messages.size() );
+    BOOST_ASSERT( serv::Logger::get().search_buf(ERR_SECURE_SOCKET_RECV_FAILED).empty() );
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_reassembles_split_and_coalesced_records_table_test ) {
+    RUN_TEST_CASES<SplitRecordTestCase>( do_split_record_test, split_record_tests );
+}
+
+struct ResumeTestCase {
+    serv::ChannelCipher cipher;
+    serv::Framing framing;
+    std::vector<std::string> early;
+    bool cached;    // Whether the host still holds the session in its cache when the peer returns.
+    bool ticketed;  // Whether the host can still open the ticket, i.e. its key has not been rotated out.
+};
+
+std::vector<ResumeTestCase> resume_tests {
+    { serv::ChannelCipher::AES_256_GCM, serv::Framing::NULL_DELIMITED, {}, true, true },
+    { serv::ChannelCipher::AES_256_GCM, serv::Framing::NULL_DELIMITED, { "first", "second" }, true, true },
+    { serv::ChannelCipher::CHACHA20_POLY1305, serv::Framing::LENGTH_PREFIXED, { "early" }, true, true },
+    { serv::ChannelCipher::AES_256_CBC, serv::Framing::NULL_DELIMITED, { "early" }, true, true },
+    { serv::ChannelCipher::AES_256_GCM, serv::Framing::NULL_DELIMITED, { "early" }, false, true },
+    { serv::ChannelCipher::AES_256_GCM, serv::Framing::NULL_DELIMITED, { "early" }, true, false },
+    { serv::ChannelCipher::AES_256_GCM, serv::Framing::NULL_DELIMITED, { "early" }, false, false },
+};
+
+void do_resume_test(const ResumeTestCase& test) {
+    std::optional<serv::Session> session;
+
+    {
+        SecureSockFixture f;
+
+        f.client.set_cipher(test.cipher);
+        f.client.set_framing(test.framing);
+
+        BOOST_ASSERT( f.sender.handshake_init() );
+        BOOST_ASSERT( f.client.handshake_init() );
+
+        tiny_sleep();
+        BOOST_ASSERT( f.sender.handshake_final() );
+        BOOST_ASSERT( f.client.handshake_final() );
+        BOOST_ASSERT( !f.sender.is_resumed() && !f.client.is_resumed() );
+
+        // The ticket comes in ahead of the first message, without being mistaken for one.
+        BOOST_ASSERT( f.sender.try_send("hello") );
+        BOOST_ASSERT( f.client.try_recv() == "hello" );
+
+        session = f.client.get_session();
+    }
+
+    BOOST_ASSERT( session.has_value() && !session->is_expired() );
+    BOOST_ASSERT( session->cipher == test.cipher && session->framing == test.framing );
+    BOOST_ASSERT( session->id.size() == serv::SessionCache::ID_SIZE );
+
+    // As though the session was issued by another host, whose ids this host's cache does not know.
+    if (!test.cached) {
+        serv::SessionCache elsewhere;
+        session->id = elsewhere.insert(*session);
+        serv::SecureSocket::get_session_cache().clear();
+    }
+
+    if (!test.ticketed) {
+        serv::SecureSocket::get_session_tickets().rotate();
+        serv::SecureSocket::get_session_tickets().rotate();
+    }
+
+    auto rejected = !test.cached && !test.ticketed;
+
+    SecureSockFixture f;
+    f.client.set_session(session);
+
+    BOOST_ASSERT( f.sender.handshake_init() );
+    BOOST_ASSERT( f.client.handshake_resume(test.early) );
+
+    tiny_sleep();
+    BOOST_ASSERT( f.sender.handshake_final() );
+    BOOST_ASSERT( f.client.handshake_final() );
+
+    BOOST_ASSERT( f.sender.is_resumed() == !rejected );
+    BOOST_ASSERT( f.client.is_resumed() == !rejected );
+    BOOST_ASSERT( f.sender.get_cipher() == test.cipher && f.client.get_cipher() == test.cipher );
+
+    // Early data is only opened if the session was resumed; otherwise it is dropped, for the peer to send again.
+    BOOST_ASSERT( f.sender.open_early_data() > (rejected || test.early.empty() ? -1 : 0) );
+
+    for (const auto& m : test.early) {
+        BOOST_ASSERT( f.sender.read_buffer() == (rejected ? "" : m) );
+    }
+
+    BOOST_ASSERT( f.sender.read_buffer().empty() );
+
+    for (int i = 0; i < 3; ++i) {
+        auto data = "message " + std::to_string(i);
+
+        BOOST_ASSERT( f.client.try_send(data) );
+        tiny_sleep();
+
+        auto [len, can_write] = f.sender.try_recv();
+        BOOST_ASSERT( len > 0 );
+        BOOST_ASSERT( f.sender.read_buffer() == data );
+
+        BOOST_ASSERT( f.sender.try_send(data) );
+        BOOST_ASSERT( f.client.try_recv() == data );
+    }
+
+    // Every handshake brings a fresh ticket and session id, whether or not it resumed the last.
+    BOOST_ASSERT( f.client.get_session().has_value() );
+    BOOST_ASSERT( f.client.get_session()->ticket != session->ticket );
+    BOOST_ASSERT( f.client.get_session()->id != session->id );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_resumes_sessions_with_early_data_table_test ) {
+    RUN_TEST_CASES<ResumeTestCase>( do_resume_test, resume_tests );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_resumes_each_session_once ) {
+    std::optional<serv::Session> session;
+
+    {
+        SecureSockFixture f;
+
+        BOOST_ASSERT( f.sender.handshake_init() );
+        BOOST_ASSERT( f.client.handshake_init() );
+
+        tiny_sleep();
+        BOOST_ASSERT( f.sender.handshake_final() );
+        BOOST_ASSERT( f.client.handshake_final() );
+
+        BOOST_ASSERT( f.sender.try_send("hello") );
+        BOOST_ASSERT( f.client.try_recv() == "hello" );
+
+        session = f.client.get_session();
+    }
+
+    BOOST_ASSERT( session.has_value() && !session->id.empty() && !session->ticket.empty() );
+
+    // The same session presented twice, with its id and its still unexpired ticket: only the first is resumed, and the second
+    // falls back to a full handshake rather than being honored by the ticket.
+    for (auto expect_resumed : { true, false }) {
+        SecureSockFixture f;
+        f.client.set_session(session);
+
+        BOOST_ASSERT( f.sender.handshake_init() );
+        BOOST_ASSERT( f.client.handshake_resume({ "early" }) );
+
+        tiny_sleep();
+        BOOST_ASSERT( f.sender.handshake_final() );
+        BOOST_ASSERT( f.client.handshake_final() );
+
+        BOOST_ASSERT( f.sender.is_resumed() == expect_resumed && f.client.is_resumed() == expect_resumed );
+        BOOST_ASSERT( f.sender.open_early_data() == (expect_resumed ? 6 : 0) );
+        BOOST_ASSERT( f.sender.read_buffer() == (expect_resumed ? "early" : "") );
+
+        BOOST_ASSERT( f.client.try_send("message") );
+        tiny_sleep();
+
+        BOOST_ASSERT( f.sender.try_recv().first > 0 );
+        BOOST_ASSERT( f.sender.read_buffer() == "message" );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_resumed_sessions_rotate_their_secret ) {
+    std::vector<serv::Session> sessions;
+
+    // A full handshake, then a chain of resumptions, each from the session the last one was issued.
+    for (int i = 0; i < 3; ++i) {
+        SecureSockFixture f;
+
+        if (!sessions.empty()) {
+            f.client.set_session(sessions.back());
+        }
+
+        BOOST_ASSERT( f.sender.handshake_init() );
+        BOOST_ASSERT( sessions.empty() ? f.client.handshake_init() : f.client.handshake_resume() );
+
+        tiny_sleep();
+        BOOST_ASSERT( f.sender.handshake_final() );
+        BOOST_ASSERT( f.client.handshake_final() );
+        BOOST_ASSERT( f.sender.is_resumed() == !sessions.empty() && f.client.is_resumed() == !sessions.empty() );
+
+        BOOST_ASSERT( f.sender.try_send("hello") );
+        BOOST_ASSERT( f.client.try_recv() == "hello" );
+
+        BOOST_ASSERT( f.client.get_session().has_value() );
+        sessions.push_back(*f.client.get_session());
+    }
+
+    // Each secret is derived from the keys of the channel that issued it, so none unlocks a session after its own.
+    BOOST_ASSERT( sessions[0].secret != sessions[1].secret );
+    BOOST_ASSERT( sessions[1].secret != sessions[2].secret );
+    BOOST_ASSERT( sessions[0].secret != sessions[2].secret );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_does_not_resume_expired_sessions ) {
+    serv::Session session;
+    session.secret = std::vector<char>(32, 's');
+    session.ticket = "ticket";
+    session.expires = std::chrono::system_clock::now() - std::chrono::seconds { 1 };
+
+    serv::SecureSocket sock;
+    BOOST_ASSERT( !sock.handshake_resume(session) );
+
+    session.expires = std::chrono::system_clock::now() + std::chrono::seconds { 60 };
+    session.ticket.clear();
+    BOOST_ASSERT( !sock.handshake_resume(session) );
+}
+
+BOOST_AUTO_TEST_CASE( test_secure_socket_replayed_resumption_is_sealed_under_fresh_keys ) {
+    clear_logger();
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    std::optional<serv::Session> session;
+
+    {
+        serv::Socket connecting;
+        BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+        serv::SecureSocket host, peer { std::move(connecting) };
+        BOOST_ASSERT( listener.try_accept(host) );
+
+        BOOST_ASSERT( host.handshake_init() );
+        BOOST_ASSERT( peer.handshake_accept() );
+        BOOST_ASSERT( host.handshake_final() );
+        BOOST_ASSERT( peer.handshake_confirm() );
+
+        BOOST_ASSERT( host.try_send("hello") );
+        BOOST_ASSERT( peer.try_recv().first > 0 );
+
+        session = peer.get_session();
+    }
+
+    BOOST_ASSERT( session.has_value() );
+
+    // Presented by its ticket alone, which stays good until it expires, as it would be to a host without the session cached.
+    session->id.clear();
+
+    serv::Socket peer_end, connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+    BOOST_ASSERT( listener.try_accept(peer_end) );
+
+    serv::SecureSocket peer { std::move(connecting) };
+
+    // No ticket, so that the host's first record is the same message on both connections.
+    peer.set_tickets(false);
+
+    serv::RecordCipher sizing { session->cipher, std::vector<char>(serv::RecordCipher::KEY_SIZE), std::vector<char>(16), true };
+    const auto confirmation_size = 2 + serv::SecureSocket::RESUME_NONCE_SIZE;
+    const auto response_size = sizing.sealed_size(sizeof "response");
+
+    // The same resumption flight goes to one host, then is replayed to another.
+    std::vector<char> flight;
+    std::vector<std::vector<char>> responses;
+
+    for (int i = 0; i < 2; ++i) {
+        serv::Socket host_end;
+        serv::SecureSocket host;
+
+        BOOST_ASSERT( host_end.try_connect("", "8000", false) );
+        BOOST_ASSERT( listener.try_accept(host) );
+        BOOST_ASSERT( host.handshake_init() );
+
+        auto init = relay_recv(host_end);
+
+        if (flight.empty()) {
+            BOOST_ASSERT( peer_end.try_send(init) );
+            BOOST_ASSERT( peer.handshake_resume(*session, { "early" }) );
+            flight = relay_recv(peer_end);
+        }
+
+        BOOST_ASSERT( host_end.try_send(flight) );
+        tiny_sleep();
+
+        BOOST_ASSERT( host.handshake_final() && host.is_resumed() );
+        BOOST_ASSERT( host.open_early_data() > 0 && host.read_buffer() == "early" );
+        BOOST_ASSERT( host.try_send("response") );
+
+        auto sent = relay_recv(host_end, confirmation_size + response_size);
+        BOOST_ASSERT( sent.size() == confirmation_size + response_size );
+
+        if (i == 0) {
+            BOOST_ASSERT( peer_end.try_send(sent) );
+            BOOST_ASSERT( peer.handshake_confirm() && peer.is_resumed() );
+            BOOST_ASSERT( peer.try_recv().first > 0 && peer.read_buffer() == "response" );
+        }
+
+        responses.push_back(sent);
+    }
+
+    // Each host confirms with its own nonce, so the same message is sealed under a different key and nonce.
+    BOOST_ASSERT( responses[0].front() == responses[1].front() );
+    BOOST_ASSERT( !std::equal(responses[0].begin() + 2, responses[0].begin() + confirmation_size, responses[1].begin() + 2) );
+    BOOST_ASSERT( !std::equal(responses[0].begin() + confirmation_size, responses[0].end(), responses[1].begin() + confirmation_size) );
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_cipher_throughput_benchmark ) {
+    constexpr int NMESSAGES = 2048;
+    constexpr size_t MESSAGE_SIZE = 16 * 1024;
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    serv::Socket connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+    serv::SecureSocket host, peer { std::move(connecting) };
+    BOOST_ASSERT( listener.try_accept(host) );
+
+    const std::string message(MESSAGE_SIZE, 'x');
+
+    auto cpu_seconds = [] () {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    };
+
+    for (auto cipher : { serv::ChannelCipher::AES_256_CBC, serv::ChannelCipher::AES_256_GCM, serv::ChannelCipher::CHACHA20_POLY1305 }) {
+        peer.set_preferred_cipher(cipher);
+
+        BOOST_ASSERT( host.handshake_init() );
+        BOOST_ASSERT( peer.handshake_accept() );
+        BOOST_ASSERT( host.handshake_final() );
+        BOOST_ASSERT( peer.handshake_confirm() );
+        BOOST_ASSERT( peer.get_cipher() == cipher );
+
+        auto start = cpu_seconds();
+
+        for (int i = 0; i < NMESSAGES; ++i) {
+            BOOST_ASSERT( host.try_send(message) );
+
+            std::string received;
+
+            while (received.empty()) {
+                BOOST_ASSERT( peer.try_recv().first > -1 );
+                received = peer.read_buffer();
+            }
+
+            BOOST_ASSERT( received.size() == MESSAGE_SIZE );
+        }
+
+        auto elapsed = cpu_seconds() - start;
+
+        const char* name = cipher == serv::ChannelCipher::AES_256_CBC ? "aes-256-cbc"
+            : cipher == serv::ChannelCipher::AES_256_GCM ? "aes-256-gcm" : "chacha20-poly1305";
+
+        serv::Logger::get().log(
+            "BENCH: secure-socket: cipher: " + std::string(name) + ": "
+            + std::to_string(static_cast<int>(NMESSAGES * MESSAGE_SIZE / elapsed / (1024 * 1024))) + " MiB/s on one core, "
+            + std::to_string(MESSAGE_SIZE / 1024) + " KiB messages, both sides"
+        );
+    }
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_record_path_does_not_allocate ) {
+    constexpr int NMESSAGES = 256;
+    constexpr size_t MESSAGE_SIZE = 4 * 1024;
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    serv::Socket connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+    serv::SecureSocket host, peer { std::move(connecting) };
+    BOOST_ASSERT( listener.try_accept(host) );
+
+    const std::string message(MESSAGE_SIZE, 'x');
+
+    for (auto cipher : { serv::ChannelCipher::AES_256_CBC, serv::ChannelCipher::AES_256_GCM, serv::ChannelCipher::CHACHA20_POLY1305 }) {
+        peer.set_preferred_cipher(cipher);
+
+        BOOST_ASSERT( host.handshake_init() );
+        BOOST_ASSERT( peer.handshake_accept() );
+        BOOST_ASSERT( host.handshake_final() );
+        BOOST_ASSERT( peer.handshake_confirm() );
+
+        size_t received = 0;
+        uint64_t allocations = 0;
+
+        // The first round trip sizes the record and socket buffers; every one after it should reuse them.
+        for (int i = 0; i <= NMESSAGES; ++i) {
+            auto before = count_allocations();
+            bool read = false;
+
+            BOOST_ASSERT( host.try_send(message) );
+
+            while (!read) {
+                BOOST_ASSERT( peer.try_recv().first > -1 );
+                read = peer.read_message([&received] (const serv::CircularBuf::View& view) {
+                    received = view.size();
+                });
+            }
+
+            if (i) {
+                allocations += count_allocations() - before;
+            }
+        }
+
+        BOOST_CHECK( received == MESSAGE_SIZE );
+
+        BOOST_CHECK( allocations == 0 );
+
+        const char* name = cipher == serv::ChannelCipher::AES_256_CBC ? "aes-256-cbc"
+            : cipher == serv::ChannelCipher::AES_256_GCM ? "aes-256-gcm" : "chacha20-poly1305";
+
+        serv::Logger::get().log(
+            "BENCH: secure-socket: cipher: " + std::string(name) + ": "
+            + std::to_string(static_cast<double>(allocations) / NMESSAGES) + " allocations per message sent and received"
+        );
+    }
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_handshake_throughput_benchmark ) {
+    constexpr int NHANDSHAKES = 64;
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    serv::Socket connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+    serv::SecureSocket host, peer { std::move(connecting) };
+    BOOST_ASSERT( listener.try_accept(host) );
+
+    // The peer never reads from the channel, so it must not be sent a ticket ahead of the next handshake.
+    peer.set_tickets(false);
+
+    for (auto group : { serv::KeyGroup::FFDHE2048, serv::KeyGroup::X25519 }) {
+        host.set_key_groups(serv::key_group_bit(group));
+        peer.set_key_groups(serv::key_group_bit(group));
+
+        // Key generation is part of what a handshake costs a core, so none is done ahead of time.
+        auto& factory = serv::SecureSocket::get_key_factory(group);
+        auto capacity = factory.get_stats().capacity;
+        factory.set_capacity(0);
+
+        // CPU time rather than wall time, so that round trips on the loopback are not counted.
+        auto cpu_seconds = [] () {
+            timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return ts.tv_sec + ts.tv_nsec / 1e9;
+        };
+
+        auto start = cpu_seconds();
+
+        for (int i = 0; i < NHANDSHAKES; ++i) {
+            BOOST_ASSERT( host.handshake_init() );
+            BOOST_ASSERT( peer.handshake_accept() );
+            BOOST_ASSERT( host.handshake_final() );
+            BOOST_ASSERT( peer.handshake_confirm() );
+        }
+
+        auto elapsed = cpu_seconds() - start;
+        factory.set_capacity(capacity);
+
+        BOOST_ASSERT( host.get_key_group() == group );
+
+        serv::Logger::get().log(
+            "BENCH: secure-socket: handshake: " + std::string(group == serv::KeyGroup::X25519 ? "x25519" : "ffdhe2048") + ": "
+            + std::to_string(static_cast<int>(NHANDSHAKES / elapsed)) + " handshakes/s on one core, both sides"
+        );
+    }
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_resumed_handshake_throughput_benchmark ) {
+    constexpr int NHANDSHAKES = 64;
+    const std::string MESSAGE = "message";
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    serv::Socket connecting;
+    BOOST_ASSERT( connecting.try_connect("", "8000", false) );
+
+    serv::SecureSocket host, peer { std::move(connecting) };
+    BOOST_ASSERT( listener.try_accept(host) );
+
+    auto cpu_seconds = [] () {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    };
+
+    enum class Mode { COLD, CACHED, TICKETED };
+
+    for (auto group : { serv::KeyGroup::FFDHE2048, serv::KeyGroup::X25519 }) {
+        host.set_key_groups(serv::key_group_bit(group));
+        peer.set_key_groups(serv::key_group_bit(group));
+
+        // Both sides still take a key pair per handshake, in case the session is turned down, so the pool is filled ahead of
+        // time as it would be on a busy host: what is left to compare is the key exchange itself.
+        auto& factory = serv::SecureSocket::get_key_factory(group);
+        auto capacity = factory.get_stats().capacity;
+
+        for (auto mode : { Mode::COLD, Mode::CACHED, Mode::TICKETED }) {
+            factory.set_capacity(2 * NHANDSHAKES);
+            BOOST_ASSERT( factory.wait_until_full(std::chrono::seconds(30)) );
+
+            std::optional<serv::Session> session = peer.get_session();
+            auto start = cpu_seconds();
+
+            for (int i = 0; i < NHANDSHAKES; ++i) {
+                // Without its id, the session can only be resumed by opening the ticket.
+                if (session.has_value() && mode == Mode::TICKETED) {
+                    session->id.clear();
+                }
+
+                BOOST_ASSERT( host.handshake_init() );
+                BOOST_ASSERT( mode == Mode::COLD ? peer.handshake_accept() : peer.handshake_resume(*session) );
+                BOOST_ASSERT( host.handshake_final() );
+                BOOST_ASSERT( peer.handshake_confirm() );
+                BOOST_ASSERT( peer.is_resumed() == (mode != Mode::COLD) );
+
+                // The next ticket comes in ahead of the first message, in every mode alike.
+                BOOST_ASSERT( host.try_send(MESSAGE) );
+                BOOST_ASSERT( peer.try_recv().first > 0 );
+                BOOST_ASSERT( peer.read_buffer() == MESSAGE );
+
+                session = peer.get_session();
+                BOOST_ASSERT( session.has_value() );
+            }
+
+            auto elapsed = cpu_seconds() - start;
+
+            std::string name = mode == Mode::COLD ? "cold" : mode == Mode::CACHED ? "resumed from cache" : "resumed from ticket";
+
+            serv::Logger::get().log(
+                "BENCH: secure-socket: handshake: " + std::string(group == serv::KeyGroup::X25519 ? "x25519" : "ffdhe2048") + ": "
+                + name + ": " + std::to_string(static_cast<int>(NHANDSHAKES / elapsed)) + " handshakes/s on one core, both sides"
+            );
+        }
+
+        factory.set_capacity(capacity);
+    }
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_time_to_first_response_benchmark ) {
+    constexpr int NCONNS = 64;
+    const std::string REQUEST = "request";
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    std::optional<serv::Session> session;
+
+    // From connecting to reading the response to the first request: after the handshake when cold, with it when resumed.
+    for (auto resume : { false, true }) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < NCONNS; ++i) {
+            test::Client client { "8000" };
+            serv::SecureSocket host;
+
+            BOOST_ASSERT( client.try_connect() );
+            BOOST_ASSERT( listener.try_accept(host) );
+
+            client.set_session(session);
+
+            BOOST_ASSERT( host.handshake_init() );
+            BOOST_ASSERT( resume ? client.handshake_resume({ REQUEST }) : client.handshake_init() );
+            BOOST_ASSERT( host.handshake_final() );
+            BOOST_ASSERT( client.handshake_final() );
+            BOOST_ASSERT( client.is_resumed() == resume );
+
+            if (resume) {
+                BOOST_ASSERT( host.open_early_data() > 0 );
+            }
+            else {
+                BOOST_ASSERT( client.try_send(REQUEST) );
+                tiny_sleep();
+                BOOST_ASSERT( host.try_recv().first > 0 );
+            }
+
+            BOOST_ASSERT( host.read_buffer() == REQUEST );
+            BOOST_ASSERT( host.try_send(REQUEST) );
+            BOOST_ASSERT( client.try_recv() == REQUEST );
+
+            session = client.get_session();
+            client.try_close();
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        serv::Logger::get().log(
+            std::string("BENCH: secure-socket: time to first response: ") + (resume ? "resumed" : "cold") + ": "
+            + std::to_string(elapsed.count() / NCONNS) + "us per connection"
+        );
+    }
+
+    listener.close_fd();
+}
+
+BOOST_AUTO_TEST_CASE( secure_socket_bytes_per_connection ) {
+    constexpr int NCONNS = 64;
+
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE) );
+
+    std::deque<test::Client> clients;
+
+    auto accept = [&] (std::deque<serv::SecureSocket>& socks) {
+        for (auto& sock : socks) {
+            BOOST_ASSERT( clients.emplace_back("8000").try_connect() );
+            BOOST_ASSERT( listener.try_accept(sock) );
+        }
+    };
+
+    // One group of sockets per stage of the handshake.
+    std::deque<serv::SecureSocket> accepted(NCONNS), handshaking(NCONNS), secure(NCONNS);
+
+    accept(accepted);
+    accept(handshaking);
+    accept(secure);
+
+    for (auto& sock : handshaking) {
+        BOOST_ASSERT( sock.handshake_init() );
+    }
+
+    for (int i = 0; i < NCONNS; ++i) {
+        BOOST_ASSERT( secure[i].handshake_init() );
+        BOOST_ASSERT( clients[2 * NCONNS + i].handshake_init() );
+    }
+
+    tiny_sleep();
+
+    for (auto& sock : secure) {
+        BOOST_ASSERT( sock.handshake_final() );
+    }
+
+    // The key factories refill on a thread of their own, so they are left to finish before the heap is measured.
+    for (auto group : { serv::KeyGroup::FFDHE2048, serv::KeyGroup::X25519 }) {
+        BOOST_ASSERT( serv::SecureSocket::get_key_factory(group).wait_until_full(std::chrono::seconds(10)) );
+    }
+
+    // Each group is measured by what destroying it gives back, so that only memory the sockets own is counted. Blocks the
+    // buffer pool caches are free for the next connection, so they are not counted against this one.
+    auto footprint = [] (auto& socks) {
+        auto heap_bytes = [] () {
+            return static_cast<long>(mallinfo2().uordblks - serv::BufferPool::get().get_cached_bytes());
+        };
+
+        // Freed on a thread of its own, whose cached chunks go back to the heap when it exits, so that the count is exact
+        // however full this thread's cache was left by earlier work.
+        auto before = heap_bytes();
+        std::thread([&socks] () { socks.clear(); }).join();
+
+        return (before - heap_bytes()) / NCONNS;
+    };
+
+    auto accepted_bytes = footprint(accepted);
+    auto handshaking_bytes = footprint(handshaking);
+    auto secure_bytes = footprint(secure);
+
+    // What the secure sockets' channel cipher costs on its own, for comparison.
+    std::deque<serv::RecordCipher> ciphers;
+
+    for (int i = 0; i < NCONNS; ++i) {
+        ciphers.emplace_back(serv::ChannelCipher::AES_256_GCM, std::vector<char>(32), std::vector<char>(16), true);
+    }
+
+    auto cipher_bytes = footprint(ciphers);
+
+    serv::Logger::get().log(
+        "BENCH: secure-socket: bytes per connection: " + std::to_string(accepted_bytes) + " accepted, "
+        + std::to_string(handshaking_bytes) + " mid-handshake, " + std::to_string(secure_bytes) + " secure, "
+        + std::to_string(cipher_bytes) + " of cipher"
+    );
+
+    // Key exchange state is only held mid-handshake: once secure, a socket holds its cipher, key and IV, and no secrets of the
+    // session to resume; even one left behind would tip it over.
+    BOOST_ASSERT( handshaking_bytes > accepted_bytes );
+    BOOST_ASSERT( secure_bytes < accepted_bytes + cipher_bytes + 160 );
+
+    for (auto& client : clients) {
+        client.try_close();
+    }
+
+    listener.close_fd();
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <thread>
 #include <future>
+#include <deque>
+#include <atomic>
 #include <iostream>
 #include <boost/test/unit_test.hpp>
 #include <crypt/exchange.hpp>
@@ -13,6 +15,8 @@
 #include "host-handshake.pb.h"
 #include "peer-handshake.pb.h"
 #include "header.pb.h"
+#include "error.pb.h"
+#include "error-codes.hpp"
 
 struct ServerFixture {
     test::Client client;
@@ -88,6 +92,74 @@ BOOST_FIXTURE_TEST_CASE( handler_integration_test, ServerFixture ) {
     BOOST_ASSERT( client.try_recv() == MESSAGE_2 );
 }
 
+BOOST_FIXTURE_TEST_CASE( server_serves_only_idempotent_early_requests, ServerFixture ) {
+    const std::string READ_PATH = "/test/read";
+    const std::string WRITE_PATH = "/test/write";
+
+    s.set_endpoint(READ_PATH, [] (serv::Server* srv, serv::Context* ctx) {
+        ctx->send_message("read");
+    }, true);
+
+    std::atomic<int> writes { 0 };
+
+    s.set_endpoint(WRITE_PATH, [&writes] (serv::Server* srv, serv::Context* ctx) {
+        ++writes;
+        ctx->send_message("written");
+    });
+
+    BOOST_ASSERT( s.is_idempotent(READ_PATH) && !s.is_idempotent(WRITE_PATH) && !s.is_idempotent("/none") );
+
+    using namespace serv::proto;
+    Header header;
+    header.set_type(Header_Type::Header_Type_TYPE_REQUEST);
+    header.set_size(0);
+    header.set_path(READ_PATH);
+
+    BOOST_ASSERT( client.try_connect() );
+    BOOST_ASSERT( client.handshake_init() );
+    BOOST_ASSERT( client.handshake_final() );
+    BOOST_ASSERT( client.try_send(header.SerializeAsString()) );
+    BOOST_ASSERT( client.try_recv() == "read" );
+
+    auto session = client.get_session();
+    BOOST_ASSERT( session.has_value() );
+    client.try_close();
+
+    for (const auto& path : { READ_PATH, WRITE_PATH }) {
+        test::Client returning { "8000" };
+        returning.set_session(session);
+        header.set_path(path);
+
+        BOOST_ASSERT( returning.try_connect() );
+        BOOST_ASSERT( returning.handshake_resume({ header.SerializeAsString() }) );
+        BOOST_ASSERT( returning.handshake_final() );
+        BOOST_ASSERT( returning.is_resumed() );
+
+        auto res = returning.try_recv();
+
+        // Each session is resumed once, so the next connection resumes the one this connection was issued.
+        session = returning.get_session();
+        BOOST_ASSERT( session.has_value() );
+
+        if (path == READ_PATH) {
+            BOOST_ASSERT( res == "read" );
+            returning.try_close();
+            continue;
+        }
+
+        // Refused from early data, since it could be replayed; the same request is served once the handshake is done.
+        Error err;
+        BOOST_ASSERT( err.ParseFromString(res) && err.code() == ERR_CONTEXT_EARLY_DATA_REJECTED );
+        BOOST_ASSERT( writes == 0 );
+
+        BOOST_ASSERT( returning.try_send(header.SerializeAsString()) );
+        BOOST_ASSERT( returning.try_recv() == "written" );
+        BOOST_ASSERT( writes == 1 );
+
+        returning.try_close();
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE( server_basic_multiple_connection_test, ServerFixture ) {
     const std::string PATH = "/test";
 
@@ -119,6 +191,179 @@ BOOST_FIXTURE_TEST_CASE( server_basic_multiple_connection_test, ServerFixture )
         clients[i].try_send(header.SerializeAsString());
     }
 
+    for (int i = 0; i < NCLIENTS; ++i) {
+        BOOST_ASSERT( clients[i].try_recv() == "1" );
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE( server_accepts_connection_bursts_in_batches, ServerFixture ) {
+    s.set_accept_batch(4);
+
+    constexpr int NCLIENTS = 64;
+    std::vector<test::Client> clients(NCLIENTS);
+
+    for (auto& c : clients) {
+        c = test::Client("8000");
+        BOOST_ASSERT( c.try_connect() );
+    }
+
+    using namespace std::chrono_literals;
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+
+    while (s.get_accept_stats().accepted < NCLIENTS && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    auto stats = s.get_accept_stats();
+
+    BOOST_ASSERT( stats.accepted == NCLIENTS );
+    BOOST_ASSERT( stats.wakeups <= stats.accepted );
+    BOOST_ASSERT( stats.overflows == 0 );
+
+    serv::Logger::get().log(
+        "BENCH: accept: " + std::to_string(stats.accepted) + " connections in " + std::to_string(stats.wakeups) + " wakeups, "
+        + std::to_string(stats.capped) + " capped, peak queue " + std::to_string(stats.peak_queue)
+    );
+}
+
+BOOST_FIXTURE_TEST_CASE( server_survives_connection_churn, ServerFixture ) {
+    const std::string PATH = "/test";
+
+    // Responses are still being produced on the pool as their connections go away.
+    s.set_endpoint(PATH, [] (serv::Server* srv, serv::Context* ctx) {
+        using namespace std::chrono_literals;
+        std::this_thread::sleep_for(1ms);
+        ctx->send_message("1");
+    });
+
+    using namespace serv::proto;
+    Header header;
+    header.set_type(Header_Type::Header_Type_TYPE_REQUEST);
+    header.set_size(0);
+    header.set_path(PATH);
+
+    constexpr int NROUNDS = 4;
+    constexpr int NCLIENTS = 16;
+
+    for (int round = 0; round < NROUNDS; ++round) {
+        std::vector<test::Client> clients(NCLIENTS);
+
+        for (auto& c : clients) {
+            c = test::Client("8000");
+            c.try_connect();
+            c.handshake_init();
+            c.handshake_final();
+            c.try_send(header.SerializeAsString());
+        }
+
+        for (auto& c : clients) {
+            c.try_close();
+        }
+    }
+
+    client.try_connect();
+    client.handshake_init();
+    BOOST_ASSERT( client.handshake_final() );
+
+    client.try_send(header.SerializeAsString());
+    BOOST_ASSERT( client.try_recv() == "1" );
+}
+
+BOOST_FIXTURE_TEST_CASE( server_offloads_handshakes_from_the_loop, ServerFixture ) {
+    constexpr int NCLIENTS = 32;
+
+    s.set_loop_probe_interval(1000);
+
+    for (auto offload : { false, true }) {
+        s.set_handshake_offload(offload);
+
+        std::deque<test::Client> clients;
+
+        for (int i = 0; i < NCLIENTS; ++i) {
+            auto& c = clients.emplace_back("8000");
+            c.set_key_groups(serv::key_group_bit(serv::KeyGroup::FFDHE2048));
+            BOOST_ASSERT( c.try_connect() );
+        }
+
+        using namespace std::chrono_literals;
+        std::this_thread::sleep_for(10ms);
+
+        // Each reply is derived by the host as soon as it arrives, in a burst as long as the clients take to send them.
+        s.reset_loop_latency();
+
+        for (auto& c : clients) {
+            BOOST_ASSERT( c.handshake_init() );
+        }
+
+        for (auto& c : clients) {
+            BOOST_ASSERT( c.handshake_final() );
+        }
+
+        auto latency = s.get_loop_latency();
+        BOOST_ASSERT( latency.samples > 0 );
+
+        serv::Logger::get().log(
+            std::string("BENCH: server: handshake burst: ") + (offload ? "offloaded" : "inline") + ": loop latency p50 "
+            + std::to_string(latency.p50) + "us, p99 " + std::to_string(latency.p99) + "us, max " + std::to_string(latency.max)
+            + "us over " + std::to_string(latency.samples) + " probes"
+        );
+
+        for (auto& c : clients) {
+            c.try_close();
+        }
+    }
+
+    s.set_loop_probe_interval(0);
+}
+
+struct MultiReactorFixture {
+    serv::Server s;
+    std::thread t;
+
+    MultiReactorFixture(): s { "8000", 4 } {
+        auto run = [=] () {
+            s.run();
+        }; 
+        
+        t = std::thread(run);
+        t.detach();
+    }
+
+    ~MultiReactorFixture() {
+        s.stop();
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE( server_multi_reactor_connection_test, MultiReactorFixture ) {
+    BOOST_ASSERT( s.get_reactor_count() == 4 );
+
+    const std::string PATH = "/test";
+
+    s.set_endpoint(PATH, [] (serv::Server* srv, serv::Context* ctx) {
+        std::string data = "1";
+        ctx->send_message(data);
+    });
+
+    constexpr int NCLIENTS = 32;
+    std::vector<test::Client> clients(NCLIENTS);
+
+    for (int i = 0; i < NCLIENTS; ++i) {
+        clients[i] = test::Client("8000");
+        clients[i].try_connect();
+        clients[i].handshake_init();
+        clients[i].handshake_final();
+    }
+
+    for (int i = 0; i < NCLIENTS; ++i) {
+        using namespace serv::proto;
+        Header header;
+        header.set_type(Header_Type::Header_Type_TYPE_REQUEST);
+        header.set_size(0);
+        header.set_path(PATH);
+
+        clients[i].try_send(header.SerializeAsString());
+    }
+
     for (int i = 0; i < NCLIENTS; ++i) {
         BOOST_ASSERT( clients[i].try_recv() == "1" );
     }
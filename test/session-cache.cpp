@@ -0,0 +1,155 @@
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include "session-cache.hpp"
+
+namespace {
+
+serv::Session make_session(char fill = 's') {
+    serv::Session session;
+    session.secret = std::vector<char>(32, fill);
+    session.cipher = serv::ChannelCipher::AES_256_GCM;
+    session.framing = serv::Framing::LENGTH_PREFIXED;
+    session.ticket = "ticket";
+
+    return session;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( session_cache_redeems_each_id_once ) {
+    serv::SessionCache cache;
+    auto id = cache.insert(make_session());
+
+    BOOST_ASSERT( id.size() == serv::SessionCache::ID_SIZE );
+    BOOST_ASSERT( cache.insert(make_session()) != id );
+
+    auto session = cache.take(id);
+
+    BOOST_ASSERT( session.has_value() );
+    BOOST_ASSERT( session->secret == make_session().secret );
+    BOOST_ASSERT( session->cipher == serv::ChannelCipher::AES_256_GCM );
+    BOOST_ASSERT( session->framing == serv::Framing::LENGTH_PREFIXED );
+    BOOST_ASSERT( session->ticket.empty() );
+    BOOST_ASSERT( !session->is_expired() );
+
+    // Once redeemed, an id is still known as one the cache issued, unlike an id from anywhere else.
+    auto issued = false;
+
+    BOOST_ASSERT( !cache.take(id, &issued).has_value() && issued );
+    BOOST_ASSERT( !cache.take("", &issued).has_value() && !issued );
+    BOOST_ASSERT( !cache.take(std::string(serv::SessionCache::ID_SIZE, 'x'), &issued).has_value() && !issued );
+
+    serv::SessionCache elsewhere;
+    BOOST_ASSERT( !elsewhere.take(cache.insert(make_session()), &issued).has_value() && !issued );
+
+    auto stats = cache.get_stats();
+    BOOST_ASSERT( stats.size == 2 && stats.hits == 1 && stats.misses == 3 );
+
+    // A session without a secret has nothing to resume from.
+    BOOST_ASSERT( cache.insert(serv::Session {}).empty() );
+}
+
+BOOST_AUTO_TEST_CASE( session_cache_expires_sessions_after_their_ttl ) {
+    serv::SessionCache cache { serv::SessionCache::DEFAULT_CAPACITY, std::chrono::seconds { 0 } };
+
+    auto id = cache.insert(make_session());
+    BOOST_ASSERT( !id.empty() );
+    BOOST_ASSERT( !cache.take(id).has_value() );
+
+    // Expired sessions are dropped as new ones arrive.
+    for (int i = 0; i < 64; ++i) {
+        cache.insert(make_session());
+    }
+
+    BOOST_ASSERT( cache.get_stats().size <= serv::SessionCache::SHARDS );
+    BOOST_ASSERT( cache.get_stats().evicted == 0 );
+
+    cache.set_ttl(std::chrono::seconds { 60 });
+    BOOST_ASSERT( cache.take(cache.insert(make_session())).has_value() );
+}
+
+BOOST_AUTO_TEST_CASE( session_cache_drops_expired_sessions_after_the_ttl_is_shortened ) {
+    serv::SessionCache cache;
+    std::vector<std::string> lasting, fleeting;
+
+    for (int i = 0; i < 64; ++i) {
+        lasting.push_back(cache.insert(make_session()));
+    }
+
+    cache.set_ttl(std::chrono::seconds { 0 });
+
+    for (int i = 0; i < 256; ++i) {
+        fleeting.push_back(cache.insert(make_session()));
+    }
+
+    // Expired sessions are dropped as new ones arrive, although they were added after sessions that outlive them.
+    BOOST_ASSERT( cache.get_stats().size <= lasting.size() + serv::SessionCache::SHARDS );
+    BOOST_ASSERT( cache.get_stats().evicted == 0 );
+
+    for (const auto& id : fleeting) {
+        BOOST_ASSERT( !cache.take(id).has_value() );
+    }
+
+    for (const auto& id : lasting) {
+        BOOST_ASSERT( cache.take(id).has_value() );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( session_cache_evicts_the_oldest_sessions_once_full ) {
+    constexpr size_t CAPACITY = 4 * serv::SessionCache::SHARDS;
+    constexpr size_t NSESSIONS = 16 * CAPACITY;
+
+    serv::SessionCache cache { CAPACITY };
+    std::vector<std::string> ids;
+
+    for (size_t i = 0; i < NSESSIONS; ++i) {
+        ids.push_back(cache.insert(make_session()));
+    }
+
+    auto stats = cache.get_stats();
+
+    BOOST_ASSERT( stats.capacity == CAPACITY );
+    BOOST_ASSERT( stats.size <= CAPACITY );
+    BOOST_ASSERT( stats.evicted == NSESSIONS - stats.size );
+
+    // The newest session in every shard is still held.
+    BOOST_ASSERT( cache.take(ids.back()).has_value() );
+    BOOST_ASSERT( !cache.take(ids.front()).has_value() );
+
+    cache.set_capacity(0);
+    BOOST_ASSERT( cache.insert(make_session()).empty() );
+
+    cache.clear();
+    BOOST_ASSERT( cache.get_stats().size == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( session_cache_is_safe_to_share_between_threads ) {
+    constexpr int NTHREADS = 8;
+    constexpr int NSESSIONS = 1024;
+
+    serv::SessionCache cache;
+    std::atomic<int> redeemed { 0 };
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < NTHREADS; ++t) {
+        threads.emplace_back([&cache, &redeemed, t] () {
+            for (int i = 0; i < NSESSIONS; ++i) {
+                auto session = cache.take(cache.insert(make_session('a' + t)));
+
+                if (session.has_value() && session->secret == make_session('a' + t).secret) {
+                    ++redeemed;
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    BOOST_ASSERT( redeemed == NTHREADS * NSESSIONS );
+    BOOST_ASSERT( cache.get_stats().size == 0 );
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include "session-ticket.hpp"
+
+namespace {
+
+serv::Session make_session() {
+    serv::Session session;
+    session.secret = std::vector<char>(32, 's');
+    session.cipher = serv::ChannelCipher::CHACHA20_POLY1305;
+    session.framing = serv::Framing::LENGTH_PREFIXED;
+
+    return session;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( session_tickets_round_trip_the_session ) {
+    serv::SessionTickets tickets;
+    auto ticket = tickets.issue(make_session());
+
+    BOOST_ASSERT( ticket.size() > serv::SessionTickets::NONCE_SIZE + serv::SessionTickets::TAG_SIZE );
+
+    auto session = tickets.redeem(ticket);
+
+    BOOST_ASSERT( session.has_value() );
+    BOOST_ASSERT( session->secret == make_session().secret );
+    BOOST_ASSERT( session->cipher == serv::ChannelCipher::CHACHA20_POLY1305 );
+    BOOST_ASSERT( session->framing == serv::Framing::LENGTH_PREFIXED );
+    BOOST_ASSERT( !session->is_expired() );
+
+    // The ticket is opaque: the secret never appears in it.
+    BOOST_ASSERT( ticket.find(std::string(32, 's')) == std::string::npos );
+
+    // Each ticket has its own nonce, so two tickets for one session are unlinkable.
+    BOOST_ASSERT( tickets.issue(make_session()) != ticket );
+}
+
+BOOST_AUTO_TEST_CASE( session_tickets_reject_tampered_and_foreign_tickets ) {
+    serv::SessionTickets tickets;
+    auto ticket = tickets.issue(make_session());
+
+    for (size_t i = 0; i < ticket.size(); i += 7) {
+        auto tampered = ticket;
+        tampered[i] ^= 1;
+
+        BOOST_ASSERT( !tickets.redeem(tampered).has_value() );
+    }
+
+    BOOST_ASSERT( !tickets.redeem("").has_value() );
+    BOOST_ASSERT( !tickets.redeem(ticket.substr(0, ticket.size() - 1)).has_value() );
+
+    serv::SessionTickets other;
+    BOOST_ASSERT( !other.redeem(ticket).has_value() );
+}
+
+BOOST_AUTO_TEST_CASE( session_tickets_expire_after_their_lifetime ) {
+    serv::SessionTickets tickets;
+    tickets.set_lifetime(std::chrono::seconds { 0 });
+
+    BOOST_ASSERT( !tickets.redeem(tickets.issue(make_session())).has_value() );
+
+    tickets.set_lifetime(std::chrono::seconds { 60 });
+    BOOST_ASSERT( tickets.redeem(tickets.issue(make_session())).has_value() );
+}
+
+BOOST_AUTO_TEST_CASE( session_tickets_survive_one_rotation ) {
+    serv::SessionTickets tickets;
+    auto ticket = tickets.issue(make_session());
+
+    tickets.rotate();
+    BOOST_ASSERT( tickets.redeem(ticket).has_value() );
+    BOOST_ASSERT( tickets.redeem(tickets.issue(make_session())).has_value() );
+
+    tickets.rotate();
+    BOOST_ASSERT( !tickets.redeem(ticket).has_value() );
+}
+
+BOOST_AUTO_TEST_CASE( hkdf_derives_distinct_keys_per_label_and_salt ) {
+    std::vector<char> secret(32, 's');
+
+    auto key = serv::hkdf(secret, { 'a' }, "serv channel key", 32);
+
+    BOOST_ASSERT( key.size() == 32 );
+    BOOST_ASSERT( key == serv::hkdf(secret, { 'a' }, "serv channel key", 32) );
+    BOOST_ASSERT( key != serv::hkdf(secret, { 'b' }, "serv channel key", 32) );
+    BOOST_ASSERT( key != serv::hkdf(secret, { 'a' }, "serv channel iv", 32) );
+    BOOST_ASSERT( serv::hkdf({}, {}, "serv channel key", 32).empty() );
+}
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include <boost/test/unit_test.hpp>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <poll.h>
 #include "socket.hpp"
+#include "buffer-pool.hpp"
 #include "client.hpp"
 #include "error-codes.hpp"
 #include "helpers.hpp"
@@ -62,6 +66,37 @@ BOOST_FIXTURE_TEST_CASE( socket_try_accept_test, AcceptFixture ) {
     BOOST_ASSERT( sock.get_host() == "localhost" );
 }
 
+BOOST_AUTO_TEST_CASE( socket_accept_queue_reports_pending_connections ) {
+    serv::Socket listener;
+    BOOST_ASSERT( listener.try_listen("8000", AF_UNSPEC, SOCK_STREAM, AI_PASSIVE, false, 8) );
+    BOOST_ASSERT( listener.get_accept_queue() == std::make_pair(0u, 8u) );
+
+    constexpr int NCLIENTS = 3;
+    std::vector<test::Client> clients(NCLIENTS);
+
+    for (auto& client : clients) {
+        client = test::Client("8000");
+        BOOST_ASSERT( client.try_connect() );
+    }
+
+    BOOST_ASSERT( listener.get_accept_queue() == std::make_pair(3u, 8u) );
+
+    std::vector<serv::Socket> accepted(NCLIENTS + 1);
+
+    for (int i = 0; i < NCLIENTS; ++i) {
+        BOOST_ASSERT( listener.try_accept(accepted[i]) );
+    }
+
+    // The queue is drained: the next accept fails without logging an error.
+    clear_logger();
+    BOOST_ASSERT( !listener.try_accept(accepted[NCLIENTS]) );
+    BOOST_ASSERT( errno == EAGAIN || errno == EWOULDBLOCK );
+    BOOST_ASSERT( serv::Logger::get().search_buf(ERR_SOCKET_ACCEPT_CONN_FAILED).empty() );
+
+    BOOST_ASSERT( listener.get_accept_queue() == std::make_pair(0u, 8u) );
+    listener.close_fd();
+}
+
 struct SendFixture {
     serv::Socket listener;
     serv::Socket sender;
@@ -121,4 +156,244 @@ BOOST_AUTO_TEST_CASE( socket_try_send_fails_test ) {
 
     BOOST_ASSERT( !sock.try_send(std::vector<char>('0'), mock_send) );
     ASSERT_ERR_LOGGED( ERR_SOCKET_SEND_FAILED );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_try_send_queues_when_blocked, SendFixture ) {
+    auto blocked_send = [] (int i, const void* j, size_t k, int l) -> ssize_t {
+        errno = EAGAIN;
+        return -1;
+    };
+
+    const std::string data = "0123456789";
+
+    BOOST_ASSERT( sender.try_send(std::vector<char>(data.begin(), data.end()), blocked_send) );
+    BOOST_ASSERT( sender.has_pending() );
+    BOOST_ASSERT( sender.get_pending_bytes() == data.size() );
+
+    // Queued data keeps its place: later sends join the back of the queue rather than overtaking it.
+    BOOST_ASSERT( sender.try_send(std::vector<char>(data.begin(), data.end())) );
+    BOOST_ASSERT( sender.get_pending_bytes() == 2 * data.size() );
+
+    BOOST_ASSERT( sender.try_flush() );
+    BOOST_ASSERT( !sender.has_pending() );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_outbound_queue_applies_backpressure, SendFixture ) {
+    constexpr size_t CHUNK = 64 * 1024;
+    constexpr size_t TOTAL = 16 * 1024 * 1024;
+
+    sender.set_watermarks(CHUNK, 4 * CHUNK);
+
+    // Nobody is reading yet, so the socket soon stops taking data and the rest queues up.
+    std::vector<char> chunk(CHUNK, 'x');
+    size_t produced = 0;
+
+    while (produced < TOTAL && !sender.is_congested()) {
+        BOOST_ASSERT( sender.try_send(chunk) );
+        produced += CHUNK;
+    }
+
+    BOOST_ASSERT( sender.is_congested() );
+    BOOST_ASSERT( sender.has_pending() );
+
+    // A slow reader drains the socket, while the sender flushes until the queue empties.
+    std::atomic<size_t> consumed { 0 };
+
+    std::thread reader([this, &consumed, produced] () {
+        std::vector<char> dest(CHUNK);
+
+        while (consumed < produced) {
+            auto n = client.try_recv_raw(dest.data(), dest.size());
+
+            if (n <= 0) {
+                break;
+            }
+
+            consumed += n;
+        }
+    });
+
+    while (sender.has_pending()) {
+        BOOST_ASSERT( sender.try_flush() );
+        std::this_thread::yield();
+    }
+
+    reader.join();
+
+    BOOST_ASSERT( !sender.is_congested() );
+    BOOST_ASSERT( consumed == produced );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_length_prefixed_messages_arrive_whole, SendFixture ) {
+    sender.set_framing(serv::Framing::LENGTH_PREFIXED);
+    client.set_framing(serv::Framing::LENGTH_PREFIXED);
+
+    // Null bytes are just data when messages are length-prefixed.
+    const std::string binary { "\0a\0b\0", 5 };
+    BOOST_ASSERT( sender.try_send(binary) );
+
+    tiny_sleep();
+    BOOST_ASSERT( client.try_recv() == binary );
+
+    // A message longer than 127 bytes takes a two-byte prefix: { 0xac, 0x02 } for 300.
+    const std::string message(300, 'x');
+    std::vector<char> framed { (char)0xac, 0x02 };
+    framed.insert(framed.end(), message.begin(), message.end());
+
+    // Deliver the prefix and the message in pieces; nothing is returned until the last one arrives.
+    std::vector<std::pair<size_t, size_t>> pieces { { 0, 1 }, { 1, 100 }, { 101, 201 } };
+
+    for (auto i = 0; i < pieces.size(); ++i) {
+        auto [from, len] = pieces[i];
+        BOOST_ASSERT( sender.try_send(std::vector<char>(framed.begin() + from, framed.begin() + from + len)) );
+
+        tiny_sleep();
+        auto received = client.try_recv();
+
+        BOOST_ASSERT( received == (i + 1 == pieces.size() ? message : "") );
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_length_prefixed_empty_messages_are_delivered, SendFixture ) {
+    sender.set_framing(serv::Framing::LENGTH_PREFIXED);
+    client.set_framing(serv::Framing::LENGTH_PREFIXED);
+
+    // An empty frame, e.g. a protobuf message with every field at its default, then one behind it.
+    BOOST_ASSERT( client.try_send("") );
+    BOOST_ASSERT( client.try_send("after") );
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.try_recv().first == 7 );
+
+    std::string data { "stale" };
+
+    BOOST_ASSERT( sender.try_read_buffer(data) && data.empty() );
+    BOOST_ASSERT( sender.try_read_buffer(data) && data == "after" );
+    BOOST_ASSERT( !sender.try_read_buffer(data) );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_rejects_frames_larger_than_the_buffer, SendFixture ) {
+    BOOST_ASSERT( sender.set_buffer_backend(serv::CircularBuf::Backend::HEAP) );
+    BOOST_ASSERT( sender.set_buffer_limit(1024) );
+
+    sender.set_framing(serv::Framing::LENGTH_PREFIXED);
+    client.set_framing(serv::Framing::LENGTH_PREFIXED);
+
+    BOOST_ASSERT( client.try_send(std::string(4096, 'x')) );
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.try_recv().first > 0 );
+
+    // The frame could never complete, so rather than wait on it with a full buffer, the buffer is dropped.
+    std::string data;
+    BOOST_ASSERT( !sender.try_read_buffer(data) );
+    BOOST_ASSERT( sender.flush_buffer().empty() );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_rejects_length_prefixes_that_overflow_a_uint32, SendFixture ) {
+    sender.set_framing(serv::Framing::LENGTH_PREFIXED);
+
+    // 2^32 as a varint. Truncated to 32 bits it would read as an empty frame, and "abc" as the start of the next.
+    BOOST_ASSERT( client.try_send(std::string { "\x80\x80\x80\x80\x10" "abc" }) );
+
+    tiny_sleep();
+    BOOST_ASSERT( sender.try_recv().first > 0 );
+
+    std::string data;
+    BOOST_ASSERT( !sender.try_read_buffer(data) );
+    BOOST_ASSERT( sender.flush_buffer().empty() );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_buffer_grows_for_messages_larger_than_a_block, SendFixture ) {
+    auto used = serv::BufferPool::get().get_used_bytes();
+
+    const std::string message(200 * 1024, 'x');
+    BOOST_ASSERT( sender.try_send(message) );
+
+    std::string received;
+
+    // More than the socket takes at once: keep flushing while the client reads.
+    for (int i = 0; i < 20 && received.empty(); ++i) {
+        BOOST_ASSERT( sender.try_flush() );
+        tiny_sleep();
+        received = client.try_recv();
+    }
+
+    BOOST_ASSERT( received == message );
+
+    // Drained buffers hand their memory back to the pool.
+    BOOST_ASSERT( serv::BufferPool::get().get_used_bytes() == used );
+}
+
+BOOST_FIXTURE_TEST_CASE( socket_vectored_recv_syscall_benchmark, SendFixture ) {
+    using namespace std::chrono;
+
+    constexpr int NMESSAGES = 10000;
+    const std::string message(700, 'x');
+
+    // A small fixed buffer, so that the free space wraps on most receives.
+    BOOST_ASSERT( sender.set_buffer_backend(serv::CircularBuf::Backend::HEAP) );
+    BOOST_ASSERT( sender.set_buffer_limit(1024) );
+
+    struct Counter {
+        evutil_socket_t fd;
+        int syscalls;
+    };
+
+    // The receive path as it was: one recvfrom per free segment.
+    auto per_segment = [] (char* dest, uint32_t n, void* data) noexcept -> uint32_t {
+        auto counter = static_cast<Counter*>(data);
+        ++counter->syscalls;
+
+        auto nbytes = recvfrom(counter->fd, dest, n, MSG_DONTWAIT, nullptr, 0);
+        return nbytes > 0 ? nbytes : 0;
+    };
+
+    // As Socket::try_recv() now does it: one recvmsg across both segments.
+    auto vectored = [] (iovec* iov, int iovcnt, void* data) noexcept -> uint32_t {
+        auto counter = static_cast<Counter*>(data);
+        ++counter->syscalls;
+
+        msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        auto nbytes = recvmsg(counter->fd, &msg, MSG_DONTWAIT);
+        return nbytes > 0 ? nbytes : 0;
+    };
+
+    auto run = [&] (auto recv) {
+        Counter counter { sender.get_fd(), 0 };
+        auto start = steady_clock::now();
+
+        for (int i = 0; i < NMESSAGES; ++i) {
+            BOOST_ASSERT( client.try_send(message) );
+
+            std::string received;
+
+            while (received.empty()) {
+                // Wait for the data without counting the wait, so that only receives are measured.
+                pollfd pfd { sender.get_fd(), POLLIN, 0 };
+                poll(&pfd, 1, 1000);
+
+                sender.try_recv(recv, &counter);
+                received = sender.read_buffer();
+            }
+
+            BOOST_ASSERT( received == message );
+        }
+
+        auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / NMESSAGES;
+        return std::make_pair(static_cast<double>(counter.syscalls) / NMESSAGES, ns);
+    };
+
+    auto [per_segment_syscalls, per_segment_ns] = run(per_segment);
+    auto [vectored_syscalls, vectored_ns] = run(vectored);
+
+    BOOST_ASSERT( vectored_syscalls < per_segment_syscalls );
+
+    serv::Logger::get().log(
+        "BENCH: socket recv: per-segment " + std::to_string(per_segment_syscalls) + " syscalls/msg " + std::to_string(per_segment_ns)
+        + "ns/msg, vectored " + std::to_string(vectored_syscalls) + " syscalls/msg " + std::to_string(vectored_ns) + "ns/msg"
+    );
 }
\ No newline at end of file
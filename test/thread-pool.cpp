@@ -0,0 +1,455 @@
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <memory>
+#include <array>
+#include <stdexcept>
+#include "thread-pool.hpp"
+#include "task.hpp"
+#include "future.hpp"
+#include "logger.hpp"
+#include "header.pb.h"
+
+BOOST_AUTO_TEST_CASE( strand_runs_tasks_in_order ) {
+    serv::ThreadPool pool { 4 };
+    serv::Strand strand { &pool };
+
+    constexpr int NTASKS = 1000;
+    std::vector<int> order;
+
+    for (int i = 0; i < NTASKS; ++i) {
+        strand.post([&order, i] () {
+            order.push_back(i);
+        });
+    }
+
+    strand.join();
+
+    BOOST_ASSERT( order.size() == NTASKS );
+
+    for (int i = 0; i < NTASKS; ++i) {
+        BOOST_ASSERT( order[i] == i );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( strand_never_runs_tasks_concurrently ) {
+    serv::ThreadPool pool { 4 };
+
+    constexpr int NSTRANDS = 8;
+    constexpr int NTASKS = 200;
+
+    std::vector<std::unique_ptr<serv::Strand>> strands;
+    std::vector<std::atomic<int>> active(NSTRANDS);
+    std::atomic<bool> overlapped = false;
+
+    for (int i = 0; i < NSTRANDS; ++i) {
+        strands.emplace_back(std::make_unique<serv::Strand>(&pool));
+    }
+
+    for (int j = 0; j < NTASKS; ++j) {
+        for (int i = 0; i < NSTRANDS; ++i) {
+            strands[i]->post([&active, &overlapped, i] () {
+                if (active[i]++) {
+                    overlapped = true;
+                }
+
+                std::this_thread::yield();
+                --active[i];
+            });
+        }
+    }
+
+    for (auto& strand : strands) {
+        strand->join();
+    }
+
+    BOOST_ASSERT( !overlapped );
+}
+
+BOOST_AUTO_TEST_CASE( strand_runs_inline_without_pool ) {
+    serv::Strand strand;
+    int n = 0;
+
+    strand.post([&n] (int i) { n += i; }, 2);
+
+    BOOST_ASSERT( n == 2 );
+}
+
+BOOST_AUTO_TEST_CASE( strand_finishes_when_pool_stops_meanwhile ) {
+    constexpr int NTASKS = 10000;
+
+    for (auto scheduler : { serv::ThreadPool::Scheduler::SHARED_QUEUE, serv::ThreadPool::Scheduler::WORK_STEALING }) {
+        serv::ThreadPool pool { 4, scheduler };
+        serv::Strand strand { &pool };
+        std::atomic<int> count = 0;
+
+        std::thread stopping([&pool] () {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            pool.stop();
+        });
+
+        // Whether a batch reaches the pool before it stops or is turned away after, every task still runs.
+        for (int i = 0; i < NTASKS; ++i) {
+            strand.post([&count] () {
+                ++count;
+            });
+        }
+
+        stopping.join();
+        strand.join();
+
+        BOOST_ASSERT( count == NTASKS );
+        BOOST_ASSERT( !pool.enqueue([] () {}) );
+    }
+}
+
+/**
+ * @brief Compares the per-message cost of the old read dispatch (copy the connection state, spawn a thread, join it)
+ * against posting to a per-connection strand. Results are written to the log stream.
+ */
+BOOST_AUTO_TEST_CASE( strand_dispatch_benchmark ) {
+    using namespace std::chrono;
+
+    constexpr int NMESSAGES = 2000;
+
+    // Roughly the state that Context::receive_callback used to copy for every read event.
+    struct ConnectionState {
+        std::shared_ptr<int> sock;
+        std::shared_ptr<int> event;
+        std::string header_data;
+        std::string request_data;
+        serv::proto::Header header;
+    };
+
+    ConnectionState state { std::make_shared<int>(), std::make_shared<int>(), std::string(64, 'h'), std::string(256, 'r') };
+    state.header.set_path("/path/to/something");
+
+    std::atomic<int> handled = 0;
+
+    auto start = steady_clock::now();
+
+    for (int i = 0; i < NMESSAGES; ++i) {
+        auto cpy = state;
+        std::thread t([&cpy, &handled] () {
+            handled += cpy.header_data.size() > 0;
+        });
+        t.join();
+    }
+
+    auto thread_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / NMESSAGES;
+
+    serv::ThreadPool pool { 4 };
+    serv::Strand strand { &pool };
+
+    start = steady_clock::now();
+
+    for (int i = 0; i < NMESSAGES; ++i) {
+        strand.post([&state, &handled] () {
+            handled += state.header_data.size() > 0;
+        });
+    }
+
+    strand.join();
+
+    auto strand_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / NMESSAGES;
+
+    BOOST_ASSERT( handled == 2 * NMESSAGES );
+
+    serv::Logger::get().log("BENCH: read dispatch: thread-per-read " + std::to_string(thread_ns) + "ns/msg, strand " + std::to_string(strand_ns) + "ns/msg");
+}
+
+BOOST_AUTO_TEST_CASE( work_stealing_pool_runs_all_tasks ) {
+    constexpr int NTASKS = 10000;
+    std::atomic<int> count = 0;
+
+    {
+        serv::ThreadPool pool { 4, serv::ThreadPool::Scheduler::WORK_STEALING };
+
+        for (int i = 0; i < NTASKS; ++i) {
+            pool.enqueue([&count] (int n) {
+                count += n;
+            }, 1);
+        }
+    }
+
+    BOOST_ASSERT( count == NTASKS );
+}
+
+BOOST_AUTO_TEST_CASE( work_stealing_pool_runs_nested_tasks ) {
+    constexpr int NTASKS = 100;
+    constexpr int NCHILDREN = 100;
+    std::atomic<int> count = 0;
+
+    {
+        serv::ThreadPool pool { 4, serv::ThreadPool::Scheduler::WORK_STEALING };
+
+        for (int i = 0; i < NTASKS; ++i) {
+            pool.enqueue([&pool, &count] () {
+                // Fanned-out work lands on this thread's own deque, to be stolen by any idle thread.
+                for (int j = 0; j < NCHILDREN; ++j) {
+                    pool.enqueue([&count] () {
+                        ++count;
+                    });
+                }
+            });
+        }
+
+        while (count < NTASKS * NCHILDREN) {
+            std::this_thread::yield();
+        }
+    }
+
+    BOOST_ASSERT( count == NTASKS * NCHILDREN );
+}
+
+BOOST_AUTO_TEST_CASE( work_stealing_strand_runs_tasks_in_order ) {
+    serv::ThreadPool pool { 4, serv::ThreadPool::Scheduler::WORK_STEALING };
+    serv::Strand strand { &pool };
+
+    constexpr int NTASKS = 1000;
+    std::vector<int> order;
+
+    for (int i = 0; i < NTASKS; ++i) {
+        strand.post([&order, i] () {
+            order.push_back(i);
+        });
+    }
+
+    strand.join();
+
+    BOOST_ASSERT( order.size() == NTASKS );
+
+    for (int i = 0; i < NTASKS; ++i) {
+        BOOST_ASSERT( order[i] == i );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( task_stores_small_callables_inline ) {
+    auto counter = std::make_shared<int>(0);
+    std::string name = "task";
+
+    serv::Task task { [counter, name] () { *counter += name.size(); } };
+    serv::Task moved { std::move(task) };
+
+    BOOST_ASSERT( !task );
+    BOOST_ASSERT( moved );
+
+    moved();
+    BOOST_ASSERT( *counter == 4 );
+
+    // Large captures still work, via the heap.
+    std::array<char, 2 * serv::Task::INLINE_SIZE> big {};
+    big[0] = 3;
+
+    serv::Task large { [counter, big] () { *counter += big[0]; } };
+    moved = std::move(large);
+    moved();
+
+    BOOST_ASSERT( *counter == 7 );
+}
+
+BOOST_AUTO_TEST_CASE( task_releases_captures ) {
+    auto counter = std::make_shared<int>(0);
+
+    {
+        serv::Task task { [counter] () {} };
+        BOOST_ASSERT( counter.use_count() == 2 );
+    }
+
+    BOOST_ASSERT( counter.use_count() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( thread_pool_enqueue_batch_runs_all_tasks ) {
+    using Scheduler = serv::ThreadPool::Scheduler;
+
+    constexpr int NTASKS = 1000;
+
+    for (auto scheduler : { Scheduler::SHARED_QUEUE, Scheduler::WORK_STEALING }) {
+        std::atomic<int> count = 0;
+
+        {
+            serv::ThreadPool pool { 4, scheduler };
+            std::vector<serv::Task> batch;
+
+            for (int i = 0; i < NTASKS; ++i) {
+                batch.emplace_back([&count] () { ++count; });
+            }
+
+            pool.enqueue_batch(batch);
+            BOOST_ASSERT( batch.empty() );
+        }
+
+        BOOST_ASSERT( count == NTASKS );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( thread_pool_enqueue_batch_hands_back_tasks_once_stopped ) {
+    using Scheduler = serv::ThreadPool::Scheduler;
+
+    for (auto scheduler : { Scheduler::SHARED_QUEUE, Scheduler::WORK_STEALING }) {
+        serv::ThreadPool pool { 2, scheduler };
+        pool.stop();
+
+        std::vector<serv::Task> batch;
+        batch.emplace_back([] () {});
+
+        BOOST_ASSERT( !pool.enqueue_batch(batch) );
+        BOOST_ASSERT( batch.size() == 1 );
+    }
+}
+
+/**
+ * @brief Measures enqueue + execute throughput of small tasks, for each scheduler, one at a time and in batches.
+ * Results are written to the log stream.
+ */
+BOOST_AUTO_TEST_CASE( thread_pool_throughput_benchmark ) {
+    using namespace std::chrono;
+    using Scheduler = serv::ThreadPool::Scheduler;
+
+    constexpr int NTASKS = 200000;
+    constexpr int BATCH_SIZE = 64;
+
+    auto name = [] (Scheduler scheduler) {
+        return scheduler == Scheduler::SHARED_QUEUE ? std::string("shared-queue") : std::string("work-stealing");
+    };
+
+    for (auto scheduler : { Scheduler::SHARED_QUEUE, Scheduler::WORK_STEALING }) {
+        for (bool batched : { false, true }) {
+            std::atomic<int> count = 0;
+            auto payload = std::make_shared<int>(1);
+
+            serv::ThreadPool pool { 4, scheduler };
+            std::vector<serv::Task> batch;
+            batch.reserve(BATCH_SIZE);
+
+            auto start = steady_clock::now();
+
+            for (int i = 0; i < NTASKS; ++i) {
+                auto task = [&count, payload] () { count += *payload; };
+
+                if (!batched) {
+                    pool.enqueue(std::move(task));
+                    continue;
+                }
+
+                batch.emplace_back(std::move(task));
+
+                if (batch.size() == BATCH_SIZE) {
+                    pool.enqueue_batch(batch);
+                }
+            }
+
+            pool.enqueue_batch(batch);
+
+            while (count < NTASKS) {
+                std::this_thread::yield();
+            }
+
+            auto us = duration_cast<microseconds>(steady_clock::now() - start).count();
+            auto per_sec = us ? static_cast<uint64_t>(NTASKS) * 1000000 / us : 0;
+
+            serv::Logger::get().log("BENCH: thread pool: " + name(scheduler) + (batched ? " batched" : "") + " " + std::to_string(per_sec) + " tasks/s");
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( thread_pool_submit_returns_result ) {
+    serv::ThreadPool pool { 2 };
+
+    auto future = pool.submit([] (int a, int b) { return a + b; }, 2, 3);
+    BOOST_ASSERT( future.get() == 5 );
+
+    auto done = pool.submit([] () {});
+    done.get();
+    BOOST_ASSERT( done.is_ready() );
+}
+
+BOOST_AUTO_TEST_CASE( future_then_chains_continuations ) {
+    serv::ThreadPool pool { 2 };
+
+    auto future = pool.submit([] () { return 2; })
+        .then([] (int n) { return n * 10; })
+        .then([] (int n) { return std::to_string(n); });
+
+    BOOST_ASSERT( future.get() == "20" );
+}
+
+BOOST_AUTO_TEST_CASE( future_then_propagates_exceptions ) {
+    serv::ThreadPool pool { 2 };
+    std::atomic<bool> skipped = true;
+
+    auto future = pool.submit([] () -> int { throw std::runtime_error("failed"); })
+        .then([&skipped] (int n) { skipped = false; return n; });
+
+    BOOST_CHECK_THROW( future.get(), std::runtime_error );
+    BOOST_ASSERT( skipped );
+}
+
+BOOST_AUTO_TEST_CASE( futures_resolve_once_the_pool_has_stopped ) {
+    for (auto scheduler : { serv::ThreadPool::Scheduler::SHARED_QUEUE, serv::ThreadPool::Scheduler::WORK_STEALING }) {
+        serv::ThreadPool pool { 2, scheduler };
+
+        auto before = pool.submit([] () { return 2; });
+        before.get();
+
+        pool.stop();
+
+        // Work submitted to a stopped pool is dropped, and its future says so rather than never resolving.
+        auto dropped = pool.submit([] () { return 1; });
+        BOOST_ASSERT( dropped.is_ready() );
+
+        try {
+            dropped.get();
+            BOOST_ASSERT( false );
+        }
+        catch (const std::future_error& e) {
+            BOOST_ASSERT( e.code() == std::future_errc::broken_promise );
+        }
+
+        // Continuations can no longer be scheduled onto the pool, so they run inline instead.
+        auto chained = pool.submit([] () { return 1; }).then([] (int n) { return n; });
+        BOOST_CHECK_THROW( chained.get(), std::future_error );
+
+        auto value = serv::Promise<int> { &pool };
+        auto doubled = value.get_future().then([] (int n) { return n * 2; });
+        value.set_value(21);
+        BOOST_ASSERT( doubled.get() == 42 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( when_all_joins_fanned_out_work_without_blocking ) {
+    // A single thread: if joining parked it, the fanned-out work could never run.
+    serv::ThreadPool pool { 1 };
+
+    constexpr int NPARTS = 16;
+
+    auto total = pool.submit([&pool] () {
+        std::vector<serv::Future<int>> parts;
+
+        for (int i = 0; i < NPARTS; ++i) {
+            parts.emplace_back(pool.submit([i] () { return i; }));
+        }
+
+        return parts;
+    })
+    .then([] (std::vector<serv::Future<int>> parts) {
+        return serv::when_all(std::move(parts));
+    })
+    .get()
+    .then([] (std::vector<int> values) {
+        int sum = 0;
+
+        for (auto v : values) {
+            sum += v;
+        }
+
+        return sum;
+    });
+
+    BOOST_ASSERT( total.get() == NPARTS * (NPARTS - 1) / 2 );
+
+    std::vector<serv::Future<void>> none;
+    serv::when_all(std::move(none)).get();
+}
\ No newline at end of file